@@ -0,0 +1,806 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+// Archives can grow past 2 GB.
+#define _FILE_OFFSET_BITS 64
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "owon.h"
+#include "parse.h"
+#include "archive.h"
+
+// Layout of an archive; all integers are little-endian.
+//
+//   file:    "OWONARC1", records, index, footer
+//   record:  "OWRC", u32 payload length, u32 raw length, i64 timestamp, 
+//            u8 name length, name, payload
+//   payload: the file header as it came from the scope; for each channel,
+//            its header as it came and its encoded samples; then u32 length
+//            of whatever followed the channels, and those bytes
+//   samples: i16 first sample, then the differences between samples, zigzag
+//            coded and split into blocks of SAMPLE_BLOCK, each a u8 bit 
+//            width followed by the block packed at that width, least 
+//            significant bit first. A width of RAW_BITS means the block is
+//            stored as plain i16 samples instead, as differences that wide
+//            save nothing.
+//   index:   an entry for each record (see put_entry())
+//   footer:  u64 offset of the index, u32 number of entries, "OWONIDX1"
+//
+// New captures are written over the old index and the index is written 
+// again after them. If that is interrupted, the index is rebuilt from the 
+// records when the archive is next opened.
+#define ARCHIVE_MAGIC "OWONARC1"
+#define RECORD_MAGIC "OWRC"
+#define FOOTER_MAGIC "OWONIDX1"
+#define MAGIC_SIZE 8
+#define RECORD_HEADER_SIZE 21
+#define FOOTER_SIZE 20
+#define SAMPLE_BLOCK 128
+
+// Widest zigzag coded difference between two 16-bit samples.
+#define MAX_BITS 17
+#define RAW_BITS 16
+
+static void put_u16(unsigned char *p, unsigned int v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static void put_u32(unsigned char *p, unsigned int v) {
+    put_u16(p, v & 0xffff);
+    put_u16(p + 2, v >> 16);
+}
+
+static void put_u64(unsigned char *p, unsigned long long v) {
+    put_u32(p, v & 0xffffffff);
+    put_u32(p + 4, v >> 32);
+}
+
+static unsigned int get_u16(const unsigned char *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned int get_u32(const unsigned char *p) {
+    return get_u16(p) | ((unsigned int)get_u16(p + 2) << 16);
+}
+
+static unsigned long long get_u64(const unsigned char *p) {
+    return get_u32(p) | ((unsigned long long)get_u32(p + 4) << 32);
+}
+
+static short get_sample(const unsigned char *p) {
+    return (short)get_u16(p);
+}
+
+// Largest encoded size of `count` samples.
+static size_t encoded_size(int count) {
+    if (count < 1) {
+        return 0;
+    }
+    int blocks = (count - 1 + SAMPLE_BLOCK - 1) / SAMPLE_BLOCK;
+    return 2 + blocks + (size_t)(count - 1) * sizeof(short);
+}
+
+// Sample `i` of `raw`, less sample `i` of `reference` if it isn't NULL, 
+// wrapped to 16 bits.
+static int residual(const unsigned char *raw, const short *reference, 
+        int i) {
+    int sample = get_sample(raw + 2 * i);
+    return (NULL == reference) ? sample : (short)(sample - reference[i]);
+}
+
+// Encode `count` little-endian samples from `raw` into `out`, returning 
+// the end of the encoded data. With a `reference`, what is encoded is the 
+// difference of each sample from the same sample of `reference`.
+static unsigned char *encode_samples(const unsigned char *raw, int count, 
+        const short *reference, unsigned char *out) {
+    if (count < 1) {
+        return out;
+    }
+    int prev = residual(raw, reference, 0);
+    put_u16(out, (unsigned short)prev);
+    out += 2;
+
+    unsigned int zigzag[SAMPLE_BLOCK];
+    int start;
+    for (start = 1; start < count; start += SAMPLE_BLOCK) {
+        int n = count - start;
+        if (n > SAMPLE_BLOCK) {
+            n = SAMPLE_BLOCK;
+        }
+        unsigned int all = 0;
+        int i;
+        for (i = 0; i < n; i++) {
+            int sample = residual(raw, reference, start + i);
+            int delta = sample - prev;
+            zigzag[i] = ((unsigned int)delta << 1) ^ (unsigned int)(delta >> 31);
+            all |= zigzag[i];
+            prev = sample;
+        }
+        int bits = 0;
+        while (bits < MAX_BITS && (all >> bits)) {
+            bits++;
+        }
+        if (bits >= RAW_BITS) {
+            *out++ = RAW_BITS;
+            if (NULL == reference) {
+                memcpy(out, raw + 2 * start, n * sizeof(short));
+                out += n * sizeof(short);
+            } else {
+                for (i = 0; i < n; i++) {
+                    put_u16(out, (unsigned short)residual(raw, reference, 
+                                start + i));
+                    out += 2;
+                }
+            }
+            continue;
+        }
+        *out++ = bits;
+
+        unsigned long long acc = 0;
+        int filled = 0;
+        for (i = 0; i < n; i++) {
+            acc |= (unsigned long long)zigzag[i] << filled;
+            filled += bits;
+            while (filled >= 8) {
+                *out++ = acc & 0xff;
+                acc >>= 8;
+                filled -= 8;
+            }
+        }
+        if (filled > 0) {
+            *out++ = acc & 0xff;
+        }
+    }
+    return out;
+}
+
+// Decode `count` samples from `in`, which ends at `end`, into `raw` as 
+// little-endian shorts, adding back `reference` if it isn't NULL. Returns 
+// the end of the encoded data, or NULL if it is malformed.
+static const unsigned char *decode_samples(const unsigned char *in, 
+        const unsigned char *end, int count, const short *reference, 
+        unsigned char *raw) {
+    if (count < 1) {
+        return in;
+    }
+    if (end - in < 2) {
+        return NULL;
+    }
+    int prev = (short)get_u16(in);
+    in += 2;
+    put_u16(raw, (unsigned short)prev);
+
+    int start;
+    for (start = 1; start < count; start += SAMPLE_BLOCK) {
+        int n = count - start;
+        if (n > SAMPLE_BLOCK) {
+            n = SAMPLE_BLOCK;
+        }
+        if (in >= end) {
+            return NULL;
+        }
+        int bits = *in++;
+        if (bits > RAW_BITS || (size_t)(end - in) < 
+                ((size_t)n * bits + 7) / 8) {
+            return NULL;
+        }
+        if (RAW_BITS == bits) {
+            memcpy(raw + 2 * start, in, n * sizeof(short));
+            in += n * sizeof(short);
+            prev = get_sample(raw + 2 * (start + n - 1));
+            continue;
+        }
+        unsigned int mask = (1u << bits) - 1;
+        unsigned long long acc = 0;
+        int filled = 0;
+        int i;
+        for (i = 0; i < n; i++) {
+            while (filled < bits) {
+                acc |= (unsigned long long)*in++ << filled;
+                filled += 8;
+            }
+            unsigned int zigzag = acc & mask;
+            acc >>= bits;
+            filled -= bits;
+            int delta = (int)(zigzag >> 1) ^ -(int)(zigzag & 1);
+            prev = (short)(prev + delta);
+            put_u16(raw + 2 * (start + i), (unsigned short)prev);
+        }
+    }
+    if (NULL != reference) {
+        int i;
+        for (i = 0; i < count; i++) {
+            put_u16(raw + 2 * i, (unsigned short)(get_sample(raw + 2 * i) + 
+                        reference[i]));
+        }
+    }
+    return in;
+}
+
+// Work out where each channel of `data` starts with `capture` (already 
+// parsed from it) and encode it, against the samples of the channels in 
+// `reference` if it isn't NULL. Returns the payload in a new buffer.
+static unsigned char *encode_payload(const struct owon_capture *capture, 
+        const unsigned char *data, size_t length, 
+        const struct owon_channel *reference, size_t *payload_length) {
+    size_t consumed = OWON_FILE_HEADER_SIZE;
+    size_t size = OWON_FILE_HEADER_SIZE + 4;
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+        int count = capture->channels[chan_idx].sample_count;
+        size += OWON_CHANNEL_HEADER_SIZE + encoded_size(count);
+        consumed += OWON_CHANNEL_HEADER_SIZE + (size_t)count * sizeof(short);
+    }
+    if (consumed > length) {
+        return NULL;
+    }
+    size += length - consumed;
+
+    unsigned char *payload = malloc(size);
+    if (NULL == payload) {
+        return NULL;
+    }
+    unsigned char *out = payload;
+    memcpy(out, data, OWON_FILE_HEADER_SIZE);
+    out += OWON_FILE_HEADER_SIZE;
+    const unsigned char *in = data + OWON_FILE_HEADER_SIZE;
+    for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+        int count = capture->channels[chan_idx].sample_count;
+        memcpy(out, in, OWON_CHANNEL_HEADER_SIZE);
+        out += OWON_CHANNEL_HEADER_SIZE;
+        in += OWON_CHANNEL_HEADER_SIZE;
+        out = encode_samples(in, count, (NULL == reference) ? NULL : 
+                reference[chan_idx].samples, out);
+        in += (size_t)count * sizeof(short);
+    }
+    put_u32(out, length - consumed);
+    out += 4;
+    memcpy(out, in, length - consumed);
+    out += length - consumed;
+    *payload_length = out - payload;
+    return payload;
+}
+
+// Rebuild the capture from a payload into `raw`, which is `raw_length` 
+// bytes. A payload encoded against the `reference_count` channels of 
+// `reference` must be decoded against the same channels.
+static int decode_payload(const unsigned char *payload, size_t length, 
+        const struct owon_channel *reference, int reference_count,
+        unsigned char *raw, size_t raw_length) {
+    const unsigned char *in = payload;
+    const unsigned char *end = payload + length;
+    if (length < OWON_FILE_HEADER_SIZE || 
+            raw_length < OWON_FILE_HEADER_SIZE) {
+        return OWON_ERROR_READ;
+    }
+    memcpy(raw, in, OWON_FILE_HEADER_SIZE);
+    in += OWON_FILE_HEADER_SIZE;
+    // The channels run up to the length in the file header, as in 
+    // owon_parse_buffer().
+    long file_length = (int)get_u32(raw + 6);
+    size_t offset = OWON_FILE_HEADER_SIZE;
+    int chan_idx;
+    for (chan_idx = 0; (long)offset < file_length; chan_idx++) {
+        if (end - in < OWON_CHANNEL_HEADER_SIZE || 
+                raw_length - offset < OWON_CHANNEL_HEADER_SIZE) {
+            return OWON_ERROR_READ;
+        }
+        memcpy(raw + offset, in, OWON_CHANNEL_HEADER_SIZE);
+        int count = (int)get_u32(in + 7);
+        in += OWON_CHANNEL_HEADER_SIZE;
+        offset += OWON_CHANNEL_HEADER_SIZE;
+        if (count < 0 || (raw_length - offset) / sizeof(short) < 
+                (size_t)count) {
+            return OWON_ERROR_READ;
+        }
+        const short *base = NULL;
+        if (NULL != reference) {
+            if (chan_idx >= reference_count || 
+                    count != reference[chan_idx].sample_count) {
+                return OWON_ERROR_HEADER;
+            }
+            base = reference[chan_idx].samples;
+        }
+        in = decode_samples(in, end, count, base, raw + offset);
+        if (NULL == in) {
+            return OWON_ERROR_READ;
+        }
+        offset += (size_t)count * sizeof(short);
+    }
+    if (end - in < 4) {
+        return OWON_ERROR_READ;
+    }
+    size_t tail = get_u32(in);
+    in += 4;
+    if ((size_t)(end - in) != tail || raw_length - offset != tail) {
+        return OWON_ERROR_READ;
+    }
+    memcpy(raw + offset, in, tail);
+    return OWON_SUCCESS;
+}
+
+// Fill in the parts of an index entry that come from the capture.
+static void fill_entry(struct owon_archive_entry *entry, 
+        const struct owon_capture *capture) {
+    memcpy(entry->header, capture->header, sizeof(entry->header));
+    entry->channel_count = capture->channel_count;
+    if (entry->channel_count > OWON_ARCHIVE_CHANNELS) {
+        entry->channel_count = OWON_ARCHIVE_CHANNELS;
+    }
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < entry->channel_count; chan_idx++) {
+        const struct owon_channel *channel = &capture->channels[chan_idx];
+        memcpy(entry->channels[chan_idx].name, channel->name, 4);
+        entry->channels[chan_idx].sample_count = channel->sample_count;
+        short min = 0, max = 0;
+        int i;
+        for (i = 0; i < channel->sample_count; i++) {
+            if (0 == i || channel->samples[i] < min) {
+                min = channel->samples[i];
+            }
+            if (0 == i || channel->samples[i] > max) {
+                max = channel->samples[i];
+            }
+        }
+        float scale = channel->volts_mul * channel->attenuation;
+        entry->channels[chan_idx].min = (scale < 0 ? max : min) * scale;
+        entry->channels[chan_idx].max = (scale < 0 ? min : max) * scale;
+    }
+}
+
+static int add_entry(struct owon_archive *archive, 
+        struct owon_archive_entry **entry) {
+    if (archive->count == archive->capacity) {
+        int capacity = archive->capacity ? 2 * archive->capacity : 64;
+        struct owon_archive_entry *entries = realloc(archive->entries, 
+                capacity * sizeof(*entries));
+        if (NULL == entries) {
+            return OWON_ERROR_MEMORY;
+        }
+        archive->entries = entries;
+        archive->capacity = capacity;
+    }
+    *entry = &archive->entries[archive->count++];
+    memset(*entry, 0, sizeof(**entry));
+    return OWON_SUCCESS;
+}
+
+// Size of an index entry as written.
+static size_t entry_size(const struct owon_archive_entry *entry) {
+    return 8 + 4 + 4 + 8 + 6 + 1 + strlen(entry->name) + 1 + 
+        entry->channel_count * (3 + 4 + 4 + 4);
+}
+
+static unsigned char *put_entry(unsigned char *p, 
+        const struct owon_archive_entry *entry) {
+    put_u64(p, entry->offset);
+    put_u32(p + 8, entry->length);
+    put_u32(p + 12, entry->raw_length);
+    put_u64(p + 16, entry->timestamp);
+    memcpy(p + 24, entry->header, 6);
+    size_t name_length = strlen(entry->name);
+    p[30] = name_length;
+    memcpy(p + 31, entry->name, name_length);
+    p += 31 + name_length;
+    *p++ = entry->channel_count;
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < entry->channel_count; chan_idx++) {
+        unsigned int bits;
+        memcpy(p, entry->channels[chan_idx].name, 3);
+        put_u32(p + 3, entry->channels[chan_idx].sample_count);
+        memcpy(&bits, &entry->channels[chan_idx].min, 4);
+        put_u32(p + 7, bits);
+        memcpy(&bits, &entry->channels[chan_idx].max, 4);
+        put_u32(p + 11, bits);
+        p += 15;
+    }
+    return p;
+}
+
+static const unsigned char *get_entry(const unsigned char *p, 
+        const unsigned char *end, struct owon_archive_entry *entry) {
+    if (end - p < 31) {
+        return NULL;
+    }
+    entry->offset = get_u64(p);
+    entry->length = get_u32(p + 8);
+    entry->raw_length = get_u32(p + 12);
+    entry->timestamp = (long long)get_u64(p + 16);
+    memcpy(entry->header, p + 24, 6);
+    entry->header[6] = '\0';
+    size_t name_length = p[30];
+    p += 31;
+    if ((size_t)(end - p) < name_length + 1) {
+        return NULL;
+    }
+    memcpy(entry->name, p, name_length);
+    entry->name[name_length] = '\0';
+    p += name_length;
+    entry->channel_count = *p++;
+    if (entry->channel_count > OWON_ARCHIVE_CHANNELS || 
+            end - p < entry->channel_count * 15) {
+        return NULL;
+    }
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < entry->channel_count; chan_idx++) {
+        unsigned int bits;
+        memcpy(entry->channels[chan_idx].name, p, 3);
+        entry->channels[chan_idx].name[3] = '\0';
+        entry->channels[chan_idx].sample_count = get_u32(p + 3);
+        bits = get_u32(p + 7);
+        memcpy(&entry->channels[chan_idx].min, &bits, 4);
+        bits = get_u32(p + 11);
+        memcpy(&entry->channels[chan_idx].max, &bits, 4);
+        p += 15;
+    }
+    return p;
+}
+
+// Read the index through the footer. Returns OWON_ERROR_HEADER if there is
+// no usable index.
+static int read_index(struct owon_archive *archive, long long size) {
+    unsigned char footer[FOOTER_SIZE];
+    if (size < MAGIC_SIZE + FOOTER_SIZE || 
+            0 != fseeko(archive->fp, size - FOOTER_SIZE, SEEK_SET) ||
+            1 != fread(footer, FOOTER_SIZE, 1, archive->fp) ||
+            0 != memcmp(footer + 12, FOOTER_MAGIC, MAGIC_SIZE)) {
+        return OWON_ERROR_HEADER;
+    }
+    long long index_offset = get_u64(footer);
+    long long count = get_u32(footer + 8);
+    if (index_offset < MAGIC_SIZE || index_offset > size - FOOTER_SIZE) {
+        return OWON_ERROR_HEADER;
+    }
+    size_t index_length = size - FOOTER_SIZE - index_offset;
+    unsigned char *index = malloc(index_length > 0 ? index_length : 1);
+    if (NULL == index) {
+        return OWON_ERROR_MEMORY;
+    }
+    int ret = OWON_SUCCESS;
+    if (0 != fseeko(archive->fp, index_offset, SEEK_SET) || 
+            index_length != fread(index, 1, index_length, archive->fp)) {
+        ret = OWON_ERROR_HEADER;
+    }
+    const unsigned char *p = index;
+    const unsigned char *end = index + index_length;
+    while (OWON_SUCCESS == ret && archive->count < count) {
+        struct owon_archive_entry *entry;
+        ret = add_entry(archive, &entry);
+        if (OWON_SUCCESS == ret) {
+            p = get_entry(p, end, entry);
+            if (NULL == p) {
+                ret = OWON_ERROR_HEADER;
+            }
+        }
+    }
+    free(index);
+    if (OWON_SUCCESS != ret) {
+        archive->count = 0;
+        return ret;
+    }
+    archive->end = index_offset;
+    return OWON_SUCCESS;
+}
+
+// Read and check the record at `offset`, returning its payload and filling
+// in `entry` (but not its stats).
+static int read_record(struct owon_archive *archive, long long offset, 
+        long long size, struct owon_archive_entry *entry, 
+        unsigned char **payload, size_t *payload_length) {
+    unsigned char header[RECORD_HEADER_SIZE + OWON_ARCHIVE_NAME_MAX];
+    if (size - offset < RECORD_HEADER_SIZE || 
+            0 != fseeko(archive->fp, offset, SEEK_SET) ||
+            1 != fread(header, RECORD_HEADER_SIZE, 1, archive->fp) ||
+            0 != memcmp(header, RECORD_MAGIC, 4)) {
+        return OWON_ERROR_READ;
+    }
+    size_t length = get_u32(header + 4);
+    size_t name_length = header[20];
+    if (size - offset - RECORD_HEADER_SIZE < 
+            (long long)(name_length + length) ||
+            name_length != fread(header + RECORD_HEADER_SIZE, 1, 
+                name_length, archive->fp)) {
+        return OWON_ERROR_READ;
+    }
+    entry->offset = offset;
+    entry->length = RECORD_HEADER_SIZE + name_length + length;
+    entry->raw_length = get_u32(header + 8);
+    entry->timestamp = (long long)get_u64(header + 12);
+    memcpy(entry->name, header + RECORD_HEADER_SIZE, name_length);
+    entry->name[name_length] = '\0';
+
+    *payload = malloc(length > 0 ? length : 1);
+    if (NULL == *payload) {
+        return OWON_ERROR_MEMORY;
+    }
+    if (length != fread(*payload, 1, length, archive->fp)) {
+        free(*payload);
+        return OWON_ERROR_READ;
+    }
+    *payload_length = length;
+    return OWON_SUCCESS;
+}
+
+// Decode the record of `entry` back into the capture as owondump wrote it.
+static int decode_record(const struct owon_archive_entry *entry, 
+        const unsigned char *payload, size_t length, char **data) {
+    *data = malloc(entry->raw_length > 0 ? entry->raw_length : 1);
+    if (NULL == *data) {
+        return OWON_ERROR_MEMORY;
+    }
+    int ret = decode_payload(payload, length, NULL, 0, 
+            (unsigned char *)*data, 
+            entry->raw_length);
+    if (OWON_SUCCESS != ret) {
+        free(*data);
+    }
+    return ret;
+}
+
+// Rebuild the index by reading every record, stopping at the first one 
+// that is incomplete.
+static int recover_index(struct owon_archive *archive, long long size) {
+    long long offset = MAGIC_SIZE;
+    for (;;) {
+        struct owon_archive_entry entry;
+        memset(&entry, 0, sizeof(entry));
+        unsigned char *payload;
+        size_t length;
+        if (OWON_SUCCESS != read_record(archive, offset, size, &entry, 
+                    &payload, &length)) {
+            break;
+        }
+        char *data;
+        int ret = decode_record(&entry, payload, length, &data);
+        free(payload);
+        if (OWON_SUCCESS != ret) {
+            break;
+        }
+        struct owon_capture capture;
+        ret = owon_parse_buffer(&capture, data, entry.raw_length);
+        if (OWON_SUCCESS == ret) {
+            fill_entry(&entry, &capture);
+            owon_free_capture(&capture);
+        }
+        free(data);
+        if (OWON_SUCCESS != ret) {
+            break;
+        }
+        struct owon_archive_entry *added;
+        ret = add_entry(archive, &added);
+        if (OWON_SUCCESS != ret) {
+            return ret;
+        }
+        *added = entry;
+        offset += entry.length;
+    }
+    archive->end = offset;
+    archive->dirty = 1;
+    return OWON_SUCCESS;
+}
+
+// Open the archive at `path`. With `writable`, captures can be added and 
+// the archive is created if it does not exist.
+int owon_archive_open(struct owon_archive *archive, const char *path, 
+        int writable) {
+    memset(archive, 0, sizeof(*archive));
+    archive->writable = writable;
+    archive->fp = fopen(path, writable ? "r+b" : "rb");
+    if (NULL == archive->fp && writable) {
+        archive->fp = fopen(path, "w+b");
+        if (NULL != archive->fp) {
+            fwrite(ARCHIVE_MAGIC, 1, MAGIC_SIZE, archive->fp);
+            archive->end = MAGIC_SIZE;
+            archive->dirty = 1;
+            return OWON_SUCCESS;
+        }
+    }
+    if (NULL == archive->fp) {
+        return OWON_ERROR_OPEN;
+    }
+
+    char magic[MAGIC_SIZE];
+    if (1 != fread(magic, MAGIC_SIZE, 1, archive->fp) || 
+            0 != memcmp(magic, ARCHIVE_MAGIC, MAGIC_SIZE)) {
+        fclose(archive->fp);
+        return OWON_ERROR_HEADER;
+    }
+    fseeko(archive->fp, 0, SEEK_END);
+    long long size = ftello(archive->fp);
+
+    int ret = read_index(archive, size);
+    if (OWON_ERROR_HEADER == ret) {
+        ret = recover_index(archive, size);
+    }
+    if (OWON_SUCCESS != ret) {
+        fclose(archive->fp);
+        free(archive->entries);
+        return ret;
+    }
+    return OWON_SUCCESS;
+}
+
+// Append the capture in `data` (as written by owondump) under `name`, 
+// taken at `timestamp`.
+int owon_archive_add(struct owon_archive *archive, const char *data, 
+        size_t length, const char *name, long long timestamp) {
+    if (!archive->writable) {
+        return OWON_ERROR;
+    }
+    struct owon_capture capture;
+    int ret = owon_parse_buffer(&capture, data, length);
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+    size_t payload_length;
+    unsigned char *payload = encode_payload(&capture, 
+            (const unsigned char *)data, length, NULL, &payload_length);
+    if (NULL == payload) {
+        owon_free_capture(&capture);
+        return OWON_ERROR_MEMORY;
+    }
+
+    struct owon_archive_entry *entry;
+    ret = add_entry(archive, &entry);
+    if (OWON_SUCCESS != ret) {
+        free(payload);
+        owon_free_capture(&capture);
+        return ret;
+    }
+    fill_entry(entry, &capture);
+    owon_free_capture(&capture);
+
+    size_t name_length = strlen(name);
+    if (name_length > OWON_ARCHIVE_NAME_MAX) {
+        name_length = OWON_ARCHIVE_NAME_MAX;
+    }
+    memcpy(entry->name, name, name_length);
+    entry->name[name_length] = '\0';
+    entry->offset = archive->end;
+    entry->timestamp = timestamp;
+    entry->raw_length = length;
+    entry->length = RECORD_HEADER_SIZE + name_length + payload_length;
+
+    unsigned char header[RECORD_HEADER_SIZE];
+    memcpy(header, RECORD_MAGIC, 4);
+    put_u32(header + 4, payload_length);
+    put_u32(header + 8, length);
+    put_u64(header + 12, timestamp);
+    header[20] = name_length;
+
+    archive->dirty = 1;
+    if (0 != fseeko(archive->fp, archive->end, SEEK_SET) ||
+            1 != fwrite(header, RECORD_HEADER_SIZE, 1, archive->fp) ||
+            name_length != fwrite(name, 1, name_length, archive->fp) ||
+            payload_length != fwrite(payload, 1, payload_length, 
+                archive->fp)) {
+        archive->count--;
+        free(payload);
+        return OWON_ERROR;
+    }
+    free(payload);
+    archive->end += entry->length;
+    return OWON_SUCCESS;
+}
+
+// Read capture `index` back as owondump wrote it. `*data` is allocated and
+// must be freed by the caller.
+int owon_archive_read(struct owon_archive *archive, int index, char **data,
+        size_t *length) {
+    if (index < 0 || index >= archive->count) {
+        return OWON_ERROR;
+    }
+    const struct owon_archive_entry *entry = &archive->entries[index];
+    struct owon_archive_entry record;
+    unsigned char *payload;
+    size_t payload_length;
+    int ret = read_record(archive, entry->offset, 
+            entry->offset + entry->length, &record, &payload, 
+            &payload_length);
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+    ret = decode_record(&record, payload, payload_length, data);
+    free(payload);
+    if (OWON_SUCCESS == ret) {
+        *length = record.raw_length;
+    }
+    return ret;
+}
+
+// Write the index if captures were added, and close the archive.
+int owon_archive_close(struct owon_archive *archive) {
+    int ret = OWON_SUCCESS;
+    if (archive->writable && archive->dirty) {
+        size_t size = FOOTER_SIZE;
+        int i;
+        for (i = 0; i < archive->count; i++) {
+            size += entry_size(&archive->entries[i]);
+        }
+        unsigned char *index = malloc(size);
+        if (NULL == index) {
+            ret = OWON_ERROR_MEMORY;
+        } else {
+            unsigned char *p = index;
+            for (i = 0; i < archive->count; i++) {
+                p = put_entry(p, &archive->entries[i]);
+            }
+            put_u64(p, archive->end);
+            put_u32(p + 8, archive->count);
+            memcpy(p + 12, FOOTER_MAGIC, MAGIC_SIZE);
+            if (0 != fseeko(archive->fp, archive->end, SEEK_SET) ||
+                    size != fwrite(index, 1, size, archive->fp) ||
+                    0 != fflush(archive->fp) ||
+                    0 != ftruncate(fileno(archive->fp), archive->end + size)) {
+                ret = OWON_ERROR;
+            }
+            free(index);
+        }
+    }
+    if (0 != fclose(archive->fp) && OWON_SUCCESS == ret) {
+        ret = OWON_ERROR;
+    }
+    free(archive->entries);
+    memset(archive, 0, sizeof(*archive));
+    return ret;
+}
+
+// Encode the capture in `data`, already parsed into `capture`, as the 
+// difference of its samples from those of the `reference_count` channels 
+// of `reference`, in the format of an archive record's payload. Channel and
+// file headers are kept as they are, so owon_archive_decode_delta() 
+// rebuilds `data` exactly. The channels must have the same sample counts 
+// as in `reference`, otherwise OWON_ERROR_HEADER is returned.
+int owon_archive_encode_delta(const struct owon_capture *capture, 
+        const char *data, size_t length, 
+        const struct owon_channel *reference, int reference_count, 
+        unsigned char **payload, size_t *payload_length) {
+    if (capture->channel_count != reference_count) {
+        return OWON_ERROR_HEADER;
+    }
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+        if (capture->channels[chan_idx].sample_count != 
+                reference[chan_idx].sample_count || 
+                NULL == reference[chan_idx].samples) {
+            return OWON_ERROR_HEADER;
+        }
+    }
+    *payload = encode_payload(capture, (const unsigned char *)data, length,
+            reference, payload_length);
+    if (NULL == *payload) {
+        return OWON_ERROR_MEMORY;
+    }
+    return OWON_SUCCESS;
+}
+
+// Rebuild into `raw`, which is `raw_length` bytes, a capture encoded by 
+// owon_archive_encode_delta() against `reference`.
+int owon_archive_decode_delta(const unsigned char *payload, size_t length, 
+        const struct owon_channel *reference, int reference_count, 
+        char *raw, size_t raw_length) {
+    return decode_payload(payload, length, reference, reference_count, 
+            (unsigned char *)raw, raw_length);
+}
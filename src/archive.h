@@ -0,0 +1,77 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef __OWON__ARCHIVE_H__
+#define __OWON__ARCHIVE_H__
+
+struct owon_capture;
+struct owon_channel;
+
+// Longest capture name kept in an archive.
+#define OWON_ARCHIVE_NAME_MAX 255
+
+// Channels summarised in the index entry of a capture; any after these are
+// still stored, just not listed.
+#define OWON_ARCHIVE_CHANNELS 6
+
+// Index entry for one capture in an archive.
+struct owon_archive_entry {
+    long long offset;       // Start of the record in the archive.
+    long long timestamp;    // Seconds since the epoch.
+    unsigned int length;    // Size of the record.
+    unsigned int raw_length; // Size of the capture as owondump wrote it.
+    char header[7];
+    char name[OWON_ARCHIVE_NAME_MAX + 1];
+    int channel_count;
+    struct {
+        char name[4];
+        int sample_count;
+        float min;          // mV
+        float max;          // mV
+    } channels[OWON_ARCHIVE_CHANNELS];
+};
+
+// An archive file open for reading or appending. The index is held in 
+// memory and written back by owon_archive_close().
+struct owon_archive {
+    FILE *fp;
+    int writable;
+    int dirty;              // Captures have been added since opening.
+    long long end;          // End of the last record.
+    struct owon_archive_entry *entries;
+    int count;
+    int capacity;
+};
+
+int owon_archive_open(struct owon_archive *archive, const char *path, 
+        int writable);
+int owon_archive_add(struct owon_archive *archive, const char *data, 
+        size_t length, const char *name, long long timestamp);
+int owon_archive_read(struct owon_archive *archive, int index, char **data,
+        size_t *length);
+int owon_archive_close(struct owon_archive *archive);
+int owon_archive_encode_delta(const struct owon_capture *capture, 
+        const char *data, size_t length, 
+        const struct owon_channel *reference, int reference_count, 
+        unsigned char **payload, size_t *payload_length);
+int owon_archive_decode_delta(const unsigned char *payload, size_t length, 
+        const struct owon_channel *reference, int reference_count, 
+        char *raw, size_t raw_length);
+
+#endif // __OWON__ARCHIVE_H__
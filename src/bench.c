@@ -0,0 +1,298 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "owon.h"
+#include "parse.h"
+
+// Each case is repeated until it has run for at least this long.
+#define MIN_SECONDS 0.25
+
+// Default number of samples per channel in the enlarged captures.
+#define DEFAULT_SYNTHETIC_SAMPLES 2000000
+
+// A capture held in memory, and where to find it on disk if it came from 
+// a file.
+struct input {
+    const char *name;
+    const char *path;   // NULL for synthetic captures.
+    char *data;
+    size_t length;
+    long samples;       // Samples in all channels.
+};
+
+typedef int (*bench_fn)(struct input *input, FILE *null);
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peak_rss(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static int bench_parse_stdio(struct input *input, FILE *null) {
+    FILE *fp = fmemopen(input->data, input->length, "rb");
+    if (NULL == fp) {
+        return OWON_ERROR;
+    }
+    struct owon_capture capture;
+    int ret = owon_parse(&capture, fp);
+    if (OWON_SUCCESS == ret) {
+        owon_free_capture(&capture);
+    }
+    fclose(fp);
+    return ret;
+}
+
+static int bench_parse_buffer(struct input *input, FILE *null) {
+    struct owon_capture capture;
+    int ret = owon_parse_buffer(&capture, input->data, input->length);
+    if (OWON_SUCCESS == ret) {
+        owon_free_capture(&capture);
+    }
+    return ret;
+}
+
+static int bench_parse_file(struct input *input, FILE *null) {
+    if (NULL == input->path) {
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    struct owon_capture capture;
+    int ret = owon_parse_file(&capture, input->path);
+    if (OWON_SUCCESS == ret) {
+        owon_free_capture(&capture);
+    }
+    return ret;
+}
+
+// Arena reused by every parse_arena run, as in owonparse batch mode.
+static struct owon_arena arena;
+
+static int bench_parse_arena(struct input *input, FILE *null) {
+    if (NULL == input->path) {
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    struct owon_capture capture;
+    int ret = owon_parse_file_arena(&capture, input->path, &arena);
+    if (OWON_SUCCESS == ret) {
+        owon_free_capture(&capture);
+    }
+    return ret;
+}
+
+// Exporters are timed on their own, on an already parsed capture.
+static struct owon_capture parsed;
+
+static int bench_write_delim(struct input *input, FILE *null) {
+    return owon_write_delim(&parsed, "\t", "\n", 1, null);
+}
+
+static int bench_write_f32(struct input *input, FILE *null) {
+    return owon_write_f32(&parsed, null);
+}
+
+static int bench_write_i16(struct input *input, FILE *null) {
+    return owon_write_i16(&parsed, null);
+}
+
+static int bench_write_npy(struct input *input, FILE *null) {
+    return owon_write_npy(&parsed, null);
+}
+
+static const struct {
+    const char *name;
+    bench_fn fn;
+    int exporter;
+} cases[] = {
+    {"parse_stdio", bench_parse_stdio, 0},
+    {"parse_buffer", bench_parse_buffer, 0},
+    {"parse_file", bench_parse_file, 0},
+    {"parse_arena", bench_parse_arena, 0},
+    {"write_delim", bench_write_delim, 1},
+    {"write_f32", bench_write_f32, 1},
+    {"write_i16", bench_write_i16, 1},
+    {"write_npy", bench_write_npy, 1},
+    {NULL, NULL, 0}
+};
+
+static void run_cases(struct input *input, FILE *null) {
+    int ret = owon_parse_buffer(&parsed, input->data, input->length);
+    if (OWON_SUCCESS != ret) {
+        fprintf(stderr, "%s: unable to parse: %i\n", input->name, ret);
+        return;
+    }
+    int chan_idx;
+    input->samples = 0;
+    for (chan_idx = 0; chan_idx < parsed.channel_count; chan_idx++) {
+        input->samples += parsed.channels[chan_idx].sample_count;
+    }
+
+    int i;
+    for (i = 0; NULL != cases[i].name; i++) {
+        long iterations = 0;
+        double start = now();
+        double elapsed;
+        do {
+            ret = cases[i].fn(input, null);
+            iterations++;
+            elapsed = now() - start;
+        } while (OWON_SUCCESS == ret && elapsed < MIN_SECONDS);
+        if (OWON_ERROR_UNSUPPORTED == ret) {
+            continue;
+        }
+        if (OWON_SUCCESS != ret) {
+            printf("%-14s %-24s failed: %i\n", cases[i].name, input->name, 
+                    ret);
+            continue;
+        }
+        double per_run = elapsed / iterations;
+        printf("%-14s %-24s %10.1f %12.2f %10ld\n", cases[i].name, 
+                input->name, input->length / 1e6 / per_run, 
+                input->samples / 1e6 / per_run, peak_rss());
+    }
+    owon_free_capture(&parsed);
+}
+
+static int read_input(struct input *input, const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (NULL == fp) {
+        return OWON_ERROR_OPEN;
+    }
+    fseek(fp, 0, SEEK_END);
+    long length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    input->data = malloc(length > 0 ? length : 1);
+    if (NULL == input->data) {
+        fclose(fp);
+        return OWON_ERROR_MEMORY;
+    }
+    input->length = fread(input->data, sizeof(char), length, fp);
+    fclose(fp);
+    const char *base = strrchr(path, '/');
+    input->name = (NULL == base) ? path : base + 1;
+    input->path = path;
+    return OWON_SUCCESS;
+}
+
+// Build a capture like `input` but with `samples` samples in each channel,
+// by repeating the original samples.
+static int enlarge_input(struct input *large, const struct input *input,
+        int samples) {
+    struct owon_capture capture;
+    int ret = owon_parse_buffer(&capture, input->data, input->length);
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+    size_t length = OWON_FILE_HEADER_SIZE + capture.channel_count * 
+        (OWON_CHANNEL_HEADER_SIZE + (size_t)samples * sizeof(short));
+    large->data = malloc(length);
+    if (NULL == large->data) {
+        owon_free_capture(&capture);
+        return OWON_ERROR_MEMORY;
+    }
+    large->length = length;
+    large->path = NULL;
+
+    memcpy(large->data, input->data, OWON_FILE_HEADER_SIZE);
+    int file_length = (int)length - 1;
+    memcpy(large->data + 6, &file_length, sizeof(int));
+
+    // Walk the original channel headers, copying each one with new lengths.
+    const char *src = input->data + OWON_FILE_HEADER_SIZE;
+    char *dst = large->data + OWON_FILE_HEADER_SIZE;
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < capture.channel_count; chan_idx++) {
+        struct owon_channel *channel = &capture.channels[chan_idx];
+        memcpy(dst, src, OWON_CHANNEL_HEADER_SIZE);
+        int chan_length = samples * sizeof(short) + 48;
+        memcpy(dst + 3, &chan_length, sizeof(int));
+        memcpy(dst + 7, &samples, sizeof(int));
+        memcpy(dst + 11, &samples, sizeof(int));
+        src += OWON_CHANNEL_HEADER_SIZE + 
+            channel->sample_count * sizeof(short);
+        dst += OWON_CHANNEL_HEADER_SIZE;
+        int i;
+        for (i = 0; i < samples; i++) {
+            short sample = (channel->sample_count > 0) ? 
+                channel->samples[i % channel->sample_count] : 0;
+            memcpy(dst, &sample, sizeof(short));
+            dst += sizeof(short);
+        }
+    }
+    owon_free_capture(&capture);
+    return OWON_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    int samples = DEFAULT_SYNTHETIC_SAMPLES;
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "n:"))) {
+        if ('n' == opt) {
+            samples = strtol(optarg, NULL, 10);
+        } else {
+            fprintf(stderr, "Usage: %s [-n SAMPLES] FILE...\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc || samples < 1) {
+        fprintf(stderr, "Usage: %s [-n SAMPLES] FILE...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *null = fopen("/dev/null", "wb");
+    if (NULL == null) {
+        fprintf(stderr, "Unable to open /dev/null\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%-14s %-24s %10s %12s %10s\n", "case", "input", "MB/s", 
+            "Msamples/s", "RSS (KiB)");
+    int i;
+    for (i = optind; i < argc; i++) {
+        struct input input;
+        if (OWON_SUCCESS != read_input(&input, argv[i])) {
+            fprintf(stderr, "Unable to read %s\n", argv[i]);
+            continue;
+        }
+        run_cases(&input, null);
+
+        struct input large;
+        if (OWON_SUCCESS == enlarge_input(&large, &input, samples)) {
+            char name[64];
+            snprintf(name, sizeof(name), "%s*%d", input.name, samples);
+            large.name = name;
+            run_cases(&large, null);
+            free(large.data);
+        }
+        free(input.data);
+    }
+
+    owon_arena_free(&arena);
+    fclose(null);
+    return EXIT_SUCCESS;
+}
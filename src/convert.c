@@ -0,0 +1,167 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+
+#include "owon.h"
+#include "parse.h"
+#include "convert.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OWON_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// All versions multiply by `volts_mul` and then by `attenuation` as two 
+// separate single precision operations, the same as 
+// `samples[i] * volts_mul * attenuation`, so the results are identical.
+
+static void convert_scalar(const short *samples, int count, float volts_mul,
+        float attenuation, float *values) {
+    int i;
+    for (i = 0; i < count; i++) {
+        values[i] = samples[i] * volts_mul * attenuation;
+    }
+}
+
+static void time_axis_scalar(int start, int count, float time_mul, 
+        float *times) {
+    int i;
+    for (i = 0; i < count; i++) {
+        times[i] = (start + i) * time_mul;
+    }
+}
+
+#ifdef OWON_X86_SIMD
+__attribute__((target("sse2")))
+static void convert_sse2(const short *samples, int count, float volts_mul,
+        float attenuation, float *values) {
+    __m128 vm = _mm_set1_ps(volts_mul);
+    __m128 att = _mm_set1_ps(attenuation);
+    int i;
+    for (i = 0; i + 8 <= count; i += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(samples + i));
+        // Sign extend each half to 32 bits.
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+        __m128 flo = _mm_mul_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), vm), att);
+        __m128 fhi = _mm_mul_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi), vm), att);
+        _mm_storeu_ps(values + i, flo);
+        _mm_storeu_ps(values + i + 4, fhi);
+    }
+    convert_scalar(samples + i, count - i, volts_mul, attenuation, 
+            values + i);
+}
+
+__attribute__((target("avx2")))
+static void convert_avx2(const short *samples, int count, float volts_mul,
+        float attenuation, float *values) {
+    __m256 vm = _mm256_set1_ps(volts_mul);
+    __m256 att = _mm256_set1_ps(attenuation);
+    int i;
+    for (i = 0; i + 16 <= count; i += 16) {
+        __m128i s0 = _mm_loadu_si128((const __m128i *)(samples + i));
+        __m128i s1 = _mm_loadu_si128((const __m128i *)(samples + i + 8));
+        __m256 f0 = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(s0));
+        __m256 f1 = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(s1));
+        _mm256_storeu_ps(values + i, _mm256_mul_ps(_mm256_mul_ps(f0, vm), 
+                    att));
+        _mm256_storeu_ps(values + i + 8, _mm256_mul_ps(_mm256_mul_ps(f1, vm),
+                    att));
+    }
+    convert_sse2(samples + i, count - i, volts_mul, attenuation, 
+            values + i);
+}
+
+__attribute__((target("sse2")))
+static void time_axis_sse2(int start, int count, float time_mul, 
+        float *times) {
+    __m128 mul = _mm_set1_ps(time_mul);
+    __m128i index = _mm_add_epi32(_mm_set1_epi32(start), 
+            _mm_set_epi32(3, 2, 1, 0));
+    __m128i step = _mm_set1_epi32(4);
+    int i;
+    for (i = 0; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(times + i, _mm_mul_ps(_mm_cvtepi32_ps(index), mul));
+        index = _mm_add_epi32(index, step);
+    }
+    time_axis_scalar(start + i, count - i, time_mul, times + i);
+}
+#endif
+
+typedef void (*convert_fn)(const short *, int, float, float, float *);
+
+// Pick the widest version the CPU supports.
+static convert_fn get_convert(void) {
+    static convert_fn convert = NULL;
+    if (NULL == convert) {
+#ifdef OWON_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            convert = convert_avx2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            convert = convert_sse2;
+        } else {
+            convert = convert_scalar;
+        }
+#else
+        convert = convert_scalar;
+#endif
+    }
+    return convert;
+}
+
+// Convert `count` raw samples to mV.
+void owon_convert_samples(const short *samples, int count, float volts_mul,
+        float attenuation, float *values) {
+    get_convert()(samples, count, volts_mul, attenuation, values);
+}
+
+// Fill `times` with the time, in us, of samples `start` to 
+// `start + count - 1`.
+void owon_time_axis(int start, int count, float time_mul, float *times) {
+#ifdef OWON_X86_SIMD
+    if (__builtin_cpu_supports("sse2")) {
+        time_axis_sse2(start, count, time_mul, times);
+        return;
+    }
+#endif
+    time_axis_scalar(start, count, time_mul, times);
+}
+
+// Convert all of the channel's samples to mV. `values` must have room for
+// `channel->sample_count` floats.
+void owon_channel_to_mv(const struct owon_channel *channel, float *values) {
+    owon_convert_samples(channel->samples, channel->sample_count, 
+            channel->volts_mul, channel->attenuation, values);
+}
+
+// Fill `times` with the time, in us, of each of the channel's samples.
+void owon_channel_time_axis(const struct owon_channel *channel, 
+        float *times) {
+    owon_time_axis(0, channel->sample_count, channel->time_mul, times);
+}
+
+// Fill `frequencies` with the frequency, in Hz, of each point of an FFT 
+// channel. The points are evenly spaced, so this is the time axis again 
+// with a different step.
+void owon_channel_frequency_axis(const struct owon_channel *channel, 
+        float *frequencies) {
+    owon_time_axis(0, channel->sample_count, channel->frequency_mul, 
+            frequencies);
+}
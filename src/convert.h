@@ -0,0 +1,33 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef __OWON__CONVERT_H__
+#define __OWON__CONVERT_H__
+
+struct owon_channel;
+
+void owon_convert_samples(const short *samples, int count, float volts_mul,
+        float attenuation, float *values);
+void owon_time_axis(int start, int count, float time_mul, float *times);
+void owon_channel_to_mv(const struct owon_channel *channel, float *values);
+void owon_channel_time_axis(const struct owon_channel *channel, 
+        float *times);
+void owon_channel_frequency_axis(const struct owon_channel *channel, 
+        float *frequencies);
+
+#endif // __OWON__CONVERT_H__
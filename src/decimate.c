@@ -0,0 +1,313 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "owon.h"
+#include "parse.h"
+#include "decimate.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OWON_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Samples summed in 32-bit lanes before they are added to the total. Each
+// lane gains at most 2 * 32768 for every 8 samples, so this is well short 
+// of overflowing.
+#define SUM_BLOCK 65536
+
+static long long sum_scalar(const short *samples, int count) {
+    long long sum = 0;
+    int i;
+    for (i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    return sum;
+}
+
+static void min_max_scalar(const short *samples, int count, short *min, 
+        short *max) {
+    short lo = samples[0];
+    short hi = samples[0];
+    int i;
+    for (i = 1; i < count; i++) {
+        if (samples[i] < lo) {
+            lo = samples[i];
+        }
+        if (samples[i] > hi) {
+            hi = samples[i];
+        }
+    }
+    *min = lo;
+    *max = hi;
+}
+
+// Round the sum `total` of `count` samples to their mean, half away from 
+// zero.
+static short block_mean(long long total, int count) {
+    total += (total < 0) ? -(count / 2) : count / 2;
+    return (short)(total / count);
+}
+
+// Write the mean of each block of `factor` of the `count` samples to `out`;
+// the last block may be shorter.
+static void decimate_scalar(const short *samples, int count, int factor, 
+        short *out) {
+    int i;
+    for (i = 0; i < count; i += factor) {
+        int n = (count - i > factor) ? factor : count - i;
+        *out++ = block_mean(sum_scalar(samples + i, n), n);
+    }
+}
+
+// Write the minimum then the maximum of each block of `bucket` of the 
+// `count` samples to `out`; the last block may be shorter.
+static void envelope_scalar(const short *samples, int count, int bucket, 
+        short *out) {
+    int i;
+    for (i = 0; i < count; i += bucket) {
+        int n = (count - i > bucket) ? bucket : count - i;
+        min_max_scalar(samples + i, n, out, out + 1);
+        out += 2;
+    }
+}
+
+#ifdef OWON_X86_SIMD
+__attribute__((target("sse2")))
+static long long sum_sse2(const short *samples, int count) {
+    const __m128i ones = _mm_set1_epi16(1);
+    long long sum = 0;
+    int i = 0;
+    while (i + 8 <= count) {
+        int end = (count - i > SUM_BLOCK) ? i + SUM_BLOCK : count;
+        __m128i acc = _mm_setzero_si128();
+        for (; i + 8 <= end; i += 8) {
+            __m128i s = _mm_loadu_si128((const __m128i *)(samples + i));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(s, ones));
+        }
+        int lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        sum += (long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    return sum + sum_scalar(samples + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static void min_max_sse2(const short *samples, int count, short *min, 
+        short *max) {
+    if (count < 8) {
+        min_max_scalar(samples, count, min, max);
+        return;
+    }
+    __m128i lo = _mm_loadu_si128((const __m128i *)samples);
+    __m128i hi = lo;
+    int i;
+    for (i = 8; i + 8 <= count; i += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(samples + i));
+        lo = _mm_min_epi16(lo, s);
+        hi = _mm_max_epi16(hi, s);
+    }
+    short lanes_lo[8], lanes_hi[8];
+    _mm_storeu_si128((__m128i *)lanes_lo, lo);
+    _mm_storeu_si128((__m128i *)lanes_hi, hi);
+    short tail_lo, tail_hi;
+    min_max_scalar(lanes_lo, 8, &tail_lo, &tail_hi);
+    *min = tail_lo;
+    min_max_scalar(lanes_hi, 8, &tail_lo, &tail_hi);
+    *max = tail_hi;
+    if (i < count) {
+        min_max_scalar(samples + i, count - i, &tail_lo, &tail_hi);
+        if (tail_lo < *min) {
+            *min = tail_lo;
+        }
+        if (tail_hi > *max) {
+            *max = tail_hi;
+        }
+    }
+}
+
+// As decimate_scalar(). Blocks narrower than a vector are left to the 
+// scalar loop, which is faster for them.
+__attribute__((target("sse2")))
+static void decimate_sse2(const short *samples, int count, int factor, 
+        short *out) {
+    if (factor < 8) {
+        decimate_scalar(samples, count, factor, out);
+        return;
+    }
+    int i;
+    for (i = 0; i < count; i += factor) {
+        int n = (count - i > factor) ? factor : count - i;
+        *out++ = block_mean(sum_sse2(samples + i, n), n);
+    }
+}
+
+// As envelope_scalar(), and likewise for narrow blocks.
+__attribute__((target("sse2")))
+static void envelope_sse2(const short *samples, int count, int bucket, 
+        short *out) {
+    if (bucket < 8) {
+        envelope_scalar(samples, count, bucket, out);
+        return;
+    }
+    int i;
+    for (i = 0; i < count; i += bucket) {
+        int n = (count - i > bucket) ? bucket : count - i;
+        min_max_sse2(samples + i, n, out, out + 1);
+        out += 2;
+    }
+}
+#endif
+
+// Reduces a whole channel, so the kernel is picked once per channel rather
+// than once per block.
+typedef void (*reduce_fn)(const short *, int, int, short *);
+
+static reduce_fn get_decimate(void) {
+#ifdef OWON_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        return decimate_sse2;
+    }
+#endif
+    return decimate_scalar;
+}
+
+static reduce_fn get_envelope(void) {
+#ifdef OWON_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        return envelope_sse2;
+    }
+#endif
+    return envelope_scalar;
+}
+
+// Set up `reduced` as a copy of the headers of `capture` with room for 
+// `samples` samples per channel, all in one block owned by `reduced`. The
+// samples of a windowed capture (owon_open_capture()) are not in memory to 
+// be reduced.
+static int alloc_reduced(struct owon_capture const *capture, int samples,
+        struct owon_capture *reduced) {
+    memset(reduced, 0, sizeof(*reduced));
+    if (capture->windowed) {
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    memcpy(reduced->header, capture->header, sizeof(reduced->header));
+    reduced->model = capture->model;
+    size_t table = capture->channel_count * sizeof(struct owon_channel);
+    size_t size = table + (size_t)capture->channel_count * samples * 
+        sizeof(short);
+    char *data = malloc(size > 0 ? size : 1);
+    if (NULL == data) {
+        return OWON_ERROR_MEMORY;
+    }
+    reduced->memory.data = data;
+    reduced->memory.size = size;
+    reduced->memory.used = size;
+    reduced->channels = (struct owon_channel *)data;
+    reduced->channel_count = capture->channel_count;
+    reduced->channel_capacity = capture->channel_count;
+
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+        struct owon_channel *channel = &reduced->channels[chan_idx];
+        *channel = capture->channels[chan_idx];
+        channel->samples = (short *)(data + table) + 
+            (size_t)chan_idx * samples;
+        channel->borrowed = 0;
+    }
+    return OWON_SUCCESS;
+}
+
+static int max_sample_count(struct owon_capture const *capture) {
+    int max_samples = 0;
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+        if (capture->channels[chan_idx].sample_count > max_samples) {
+            max_samples = capture->channels[chan_idx].sample_count;
+        }
+    }
+    return max_samples;
+}
+
+// Build `reduced` with each channel of `capture` averaged over blocks of 
+// `factor` samples (the last block may be shorter), rounded to the nearest
+// raw sample so the scale of each channel is unchanged. Free `reduced` with
+// owon_free_capture().
+int owon_decimate(struct owon_capture const *capture, int factor, 
+        struct owon_capture *reduced) {
+    if (factor < 1) {
+        return OWON_ERROR;
+    }
+    int max_samples = max_sample_count(capture);
+    int ret = alloc_reduced(capture, (max_samples + factor - 1) / factor,
+            reduced);
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+    reduce_fn decimate = get_decimate();
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+        struct owon_channel *src = &capture->channels[chan_idx];
+        struct owon_channel *dst = &reduced->channels[chan_idx];
+        decimate(src->samples, src->sample_count, factor, dst->samples);
+        dst->sample_count = (src->sample_count + factor - 1) / factor;
+        dst->time_mul = src->time_mul * factor;
+        dst->frequency_mul = src->frequency_mul * factor;
+    }
+    return OWON_SUCCESS;
+}
+
+// Build `reduced` with each channel of `capture` cut into `width` blocks,
+// giving the minimum then the maximum of each block, so a plot of the 
+// result `width` points wide keeps every peak. All channels use the same 
+// block size, so they share a time axis. Free `reduced` with 
+// owon_free_capture().
+int owon_envelope(struct owon_capture const *capture, int width, 
+        struct owon_capture *reduced) {
+    if (width < 1) {
+        return OWON_ERROR;
+    }
+    int max_samples = max_sample_count(capture);
+    int bucket = (max_samples + width - 1) / width;
+    if (bucket < 1) {
+        bucket = 1;
+    }
+    int buckets = (max_samples + bucket - 1) / bucket;
+    int ret = alloc_reduced(capture, 2 * buckets, reduced);
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+    reduce_fn envelope = get_envelope();
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+        struct owon_channel *src = &capture->channels[chan_idx];
+        struct owon_channel *dst = &reduced->channels[chan_idx];
+        envelope(src->samples, src->sample_count, bucket, dst->samples);
+        dst->sample_count = 2 * ((src->sample_count + bucket - 1) / bucket);
+        // Two points per block, half a block apart.
+        dst->time_mul = src->time_mul * bucket / 2;
+        dst->frequency_mul = src->frequency_mul * bucket / 2;
+    }
+    return OWON_SUCCESS;
+}
@@ -0,0 +1,30 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef __OWON__DECIMATE_H__
+#define __OWON__DECIMATE_H__
+
+struct owon_capture;
+
+int owon_decimate(struct owon_capture const *capture, int factor, 
+        struct owon_capture *reduced);
+int owon_envelope(struct owon_capture const *capture, int width, 
+        struct owon_capture *reduced);
+
+#endif // __OWON__DECIMATE_H__
@@ -0,0 +1,436 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "owon.h"
+#include "parse.h"
+#include "archive.h"
+#include "delta.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OWON_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Continuous downloads of a signal that isn't changing give the same 
+// capture, or one that differs only by noise, over and over. These compare
+// each capture with the last one that changed so the repeats can be 
+// dropped.
+
+// Layout of a delta record, which stands in for a capture that is no 
+// different from the reference; all integers are little-endian.
+//
+//   "OWONDLT1", u32 number of the reference capture, u32 largest sample 
+//   difference from it, u32 length of the capture, then the capture encoded
+//   against the reference by owon_archive_encode_delta()
+#define RECORD_MAGIC "OWONDLT1"
+#define MAGIC_SIZE 8
+#define RECORD_HEADER_SIZE 20
+
+#define HASH_SEED 0x9e3779b97f4a7c15ULL
+#define HASH_MUL1 0x87c37b91114253d5ULL
+#define HASH_MUL2 0x4cf5ad432745937fULL
+
+static unsigned long long rotate(unsigned long long x, int bits) {
+    return (x << bits) | (x >> (64 - bits));
+}
+
+static unsigned long long hash_word(unsigned long long hash, 
+        unsigned long long word) {
+    word *= HASH_MUL1;
+    word = rotate(word, 31);
+    word *= HASH_MUL2;
+    hash ^= word;
+    return rotate(hash, 27) * 5 + 0x52dce729;
+}
+
+// Hash `length` bytes, 8 at a time, in the style of MurmurHash3's 64-bit 
+// mixing.
+static unsigned long long hash_bytes(unsigned long long hash, 
+        const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    while (length >= sizeof(unsigned long long)) {
+        unsigned long long word;
+        memcpy(&word, bytes, sizeof(word));
+        hash = hash_word(hash, word);
+        bytes += sizeof(word);
+        length -= sizeof(word);
+    }
+    unsigned long long tail = 0;
+    memcpy(&tail, bytes, length);
+    return hash_word(hash, tail);
+}
+
+// Hash of a channel's name, scales and samples. Channels with the same 
+// hash are taken to be the same.
+unsigned long long owon_channel_hash(const struct owon_channel *channel) {
+    unsigned long long hash = HASH_SEED;
+    hash = hash_bytes(hash, channel->name, sizeof(channel->name));
+    hash = hash_bytes(hash, &channel->volts_mul, sizeof(float));
+    hash = hash_bytes(hash, &channel->attenuation, sizeof(float));
+    hash = hash_bytes(hash, &channel->time_mul, sizeof(float));
+    hash = hash_word(hash, channel->sample_count);
+    hash = hash_bytes(hash, channel->samples, 
+            (size_t)channel->sample_count * sizeof(short));
+    // Final mix, so every bit of the last word reaches every bit of the 
+    // hash.
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static int max_abs_diff_scalar(const short *a, const short *b, int count) {
+    int max = 0;
+    int i;
+    for (i = 0; i < count; i++) {
+        int diff = abs(a[i] - b[i]);
+        if (diff > max) {
+            max = diff;
+        }
+    }
+    return max;
+}
+
+#ifdef OWON_X86_SIMD
+// The difference of two 16-bit samples needs 17 bits signed, but as 
+// max - min it is never negative and fits 16 bits unsigned. SSE2 has no 
+// unsigned 16-bit max, so the differences are offset by 0x8000 to compare 
+// them as signed.
+__attribute__((target("sse2")))
+static int max_abs_diff_sse2(const short *a, const short *b, int count) {
+    __m128i bias = _mm_set1_epi16((short)0x8000);
+    __m128i best = bias;
+    int i;
+    for (i = 0; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i diff = _mm_sub_epi16(_mm_max_epi16(x, y), 
+                _mm_min_epi16(x, y));
+        best = _mm_max_epi16(best, _mm_xor_si128(diff, bias));
+    }
+    unsigned short lanes[8];
+    _mm_storeu_si128((__m128i *)lanes, _mm_xor_si128(best, bias));
+    int max = max_abs_diff_scalar(a + i, b + i, count - i);
+    int lane;
+    for (lane = 0; lane < 8; lane++) {
+        if (lanes[lane] > max) {
+            max = lanes[lane];
+        }
+    }
+    return max;
+}
+
+__attribute__((target("avx2")))
+static int max_abs_diff_avx2(const short *a, const short *b, int count) {
+    __m256i best = _mm256_setzero_si256();
+    int i;
+    for (i = 0; i + 16 <= count; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i diff = _mm256_sub_epi16(_mm256_max_epi16(x, y), 
+                _mm256_min_epi16(x, y));
+        best = _mm256_max_epu16(best, diff);
+    }
+    unsigned short lanes[16];
+    _mm256_storeu_si256((__m256i *)lanes, best);
+    int max = max_abs_diff_sse2(a + i, b + i, count - i);
+    int lane;
+    for (lane = 0; lane < 16; lane++) {
+        if (lanes[lane] > max) {
+            max = lanes[lane];
+        }
+    }
+    return max;
+}
+#endif
+
+typedef int (*max_abs_diff_fn)(const short *, const short *, int);
+
+// Pick the widest version the CPU supports.
+static max_abs_diff_fn get_max_abs_diff(void) {
+    static max_abs_diff_fn max_abs_diff = NULL;
+    if (NULL == max_abs_diff) {
+#ifdef OWON_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            max_abs_diff = max_abs_diff_avx2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            max_abs_diff = max_abs_diff_sse2;
+        } else {
+            max_abs_diff = max_abs_diff_scalar;
+        }
+#else
+        max_abs_diff = max_abs_diff_scalar;
+#endif
+    }
+    return max_abs_diff;
+}
+
+// The largest difference between `a[i]` and `b[i]`, from 0 to 65535.
+int owon_max_abs_diff(const short *a, const short *b, int count) {
+    return get_max_abs_diff()(a, b, count);
+}
+
+// Start with no reference; the first capture checked always changes. The
+// samples of the reference are only kept when a `tolerance` above 0 needs
+// them, or `keep_samples` is set afterwards; otherwise the hashes decide.
+void owon_delta_init(struct owon_delta *delta, int tolerance) {
+    memset(delta, 0, sizeof(*delta));
+    delta->tolerance = tolerance;
+    delta->channel_count = -1;
+}
+
+void owon_delta_free(struct owon_delta *delta) {
+    int keep_samples = delta->keep_samples;
+    free(delta->channels);
+    free(delta->hashes);
+    owon_delta_init(delta, delta->tolerance);
+    delta->keep_samples = keep_samples;
+}
+
+// Whether `channel` has the same name and scales as `reference`, so their 
+// samples can be compared.
+static int same_settings(const struct owon_channel *reference, 
+        const struct owon_channel *channel) {
+    return 0 == memcmp(reference->name, channel->name, 
+            sizeof(channel->name)) && 
+        reference->sample_count == channel->sample_count && 
+        reference->volts_mul == channel->volts_mul && 
+        reference->attenuation == channel->attenuation && 
+        reference->time_mul == channel->time_mul;
+}
+
+// The largest difference between the samples of `channel` and 
+// `reference`, stopping at the first block that differs by more than 
+// `tolerance`.
+static int channel_diff(const struct owon_channel *reference, 
+        const struct owon_channel *channel, int tolerance) {
+    max_abs_diff_fn max_abs_diff = get_max_abs_diff();
+    int max = 0;
+    int start;
+    for (start = 0; start < channel->sample_count && max <= tolerance; 
+            start += OWON_DELTA_BLOCK) {
+        int count = channel->sample_count - start;
+        if (count > OWON_DELTA_BLOCK) {
+            count = OWON_DELTA_BLOCK;
+        }
+        int diff = max_abs_diff(reference->samples + start, 
+                channel->samples + start, count);
+        if (diff > max) {
+            max = diff;
+        }
+    }
+    return max;
+}
+
+// Make `capture`, whose channel hashes are `hashes`, the reference. Takes 
+// ownership of `hashes`.
+static int set_reference(struct owon_delta *delta, 
+        const struct owon_capture *capture, unsigned long long *hashes) {
+    size_t table = capture->channel_count * sizeof(struct owon_channel);
+    size_t size = table;
+    int chan_idx;
+    int keep = delta->tolerance > 0 || delta->keep_samples;
+    if (keep) {
+        for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+            size += capture->channels[chan_idx].sample_count * 
+                sizeof(short);
+        }
+    }
+    char *data = malloc(size > 0 ? size : 1);
+    if (NULL == data) {
+        free(hashes);
+        return OWON_ERROR_MEMORY;
+    }
+    struct owon_channel *channels = (struct owon_channel *)data;
+    char *samples = data + table;
+    for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+        const struct owon_channel *channel = &capture->channels[chan_idx];
+        channels[chan_idx] = *channel;
+        channels[chan_idx].borrowed = 0;
+        channels[chan_idx].samples = NULL;
+        if (keep) {
+            size_t length = channel->sample_count * sizeof(short);
+            memcpy(samples, channel->samples, length);
+            channels[chan_idx].samples = (short *)samples;
+            samples += length;
+        }
+    }
+    free(delta->channels);
+    free(delta->hashes);
+    delta->channels = channels;
+    delta->hashes = hashes;
+    delta->channel_count = capture->channel_count;
+    return OWON_SUCCESS;
+}
+
+// Compare `capture` with the reference. `*changed` is set to 0 when every 
+// channel has the same settings as in the reference and no sample differs 
+// by more than the tolerance; otherwise it is set to 1 and `capture` 
+// becomes the reference. Channels with the same hash as in the reference 
+// aren't compared sample by sample. If `max_diff` isn't NULL it is set to 
+// the largest difference seen; comparing stops at the first block over the
+// tolerance, so for a changed capture it may not be the largest overall.
+int owon_delta_check(struct owon_delta *delta, 
+        const struct owon_capture *capture, int *changed, int *max_diff) {
+    if (capture->windowed) {
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    unsigned long long *hashes = malloc((capture->channel_count + 1) * 
+            sizeof(*hashes));
+    if (NULL == hashes) {
+        return OWON_ERROR_MEMORY;
+    }
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+        hashes[chan_idx] = owon_channel_hash(&capture->channels[chan_idx]);
+    }
+
+    int diff = 0;
+    int same = (capture->channel_count == delta->channel_count);
+    for (chan_idx = 0; same && chan_idx < capture->channel_count; 
+            chan_idx++) {
+        const struct owon_channel *channel = &capture->channels[chan_idx];
+        const struct owon_channel *reference = &delta->channels[chan_idx];
+        if (hashes[chan_idx] == delta->hashes[chan_idx]) {
+            continue;
+        }
+        if (0 == delta->tolerance || !same_settings(reference, channel)) {
+            same = 0;
+            break;
+        }
+        int channel_max = channel_diff(reference, channel, 
+                delta->tolerance);
+        if (channel_max > diff) {
+            diff = channel_max;
+        }
+        same = (diff <= delta->tolerance);
+    }
+    if (NULL != max_diff) {
+        *max_diff = diff;
+    }
+    *changed = !same;
+    if (same) {
+        free(hashes);
+        return OWON_SUCCESS;
+    }
+    return set_reference(delta, capture, hashes);
+}
+
+static void put_u32(unsigned char *p, unsigned int v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+static unsigned int get_u32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+// Write a delta record for the capture in `data`, which owon_delta_check()
+// found no different from the reference, capture number `reference`. The 
+// record holds the differences of its samples from the reference, so 
+// owon_delta_rebuild() gives back `data` exactly whatever the tolerance. 
+// The samples of the reference must have been kept (see `keep_samples`).
+int owon_delta_write(const struct owon_delta *delta, const char *data, 
+        size_t length, long reference, int max_diff, FILE *fp) {
+    if (length > 0xffffffffUL || delta->channel_count < 0) {
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    struct owon_capture capture;
+    int ret = owon_parse_buffer(&capture, data, length);
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+    unsigned char *payload;
+    size_t payload_length;
+    ret = owon_archive_encode_delta(&capture, data, length, delta->channels,
+            delta->channel_count, &payload, &payload_length);
+    owon_free_capture(&capture);
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+    unsigned char header[RECORD_HEADER_SIZE];
+    memcpy(header, RECORD_MAGIC, MAGIC_SIZE);
+    put_u32(header + 8, reference);
+    put_u32(header + 12, max_diff);
+    put_u32(header + 16, length);
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite(payload, 1, payload_length, fp);
+    free(payload);
+    if (ferror(fp)) {
+        return OWON_ERROR;
+    }
+    return OWON_SUCCESS;
+}
+
+// Read the number of the reference capture and the largest sample 
+// difference from a delta record. Returns OWON_ERROR_HEADER if `record` 
+// isn't one.
+int owon_delta_read(const char *record, size_t length, long *reference, 
+        int *max_diff) {
+    const unsigned char *p = (const unsigned char *)record;
+    if (length < RECORD_HEADER_SIZE || 
+            0 != memcmp(p, RECORD_MAGIC, MAGIC_SIZE)) {
+        return OWON_ERROR_HEADER;
+    }
+    if (NULL != reference) {
+        *reference = get_u32(p + 8);
+    }
+    if (NULL != max_diff) {
+        *max_diff = get_u32(p + 12);
+    }
+    return OWON_SUCCESS;
+}
+
+// Rebuild the capture a delta record stands for from `reference`, the 
+// capture it names, into a new buffer `*data` of `*data_length` bytes. 
+// Returns OWON_ERROR_HEADER if `record` isn't a delta record or 
+// `reference` doesn't have the channels it was made against.
+int owon_delta_rebuild(const char *record, size_t length, 
+        const struct owon_capture *reference, char **data, 
+        size_t *data_length) {
+    int ret = owon_delta_read(record, length, NULL, NULL);
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+    if (reference->windowed) {
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    size_t raw_length = get_u32((const unsigned char *)record + 16);
+    char *raw = malloc(raw_length > 0 ? raw_length : 1);
+    if (NULL == raw) {
+        return OWON_ERROR_MEMORY;
+    }
+    ret = owon_archive_decode_delta(
+            (const unsigned char *)record + RECORD_HEADER_SIZE, 
+            length - RECORD_HEADER_SIZE, reference->channels, 
+            reference->channel_count, raw, raw_length);
+    if (OWON_SUCCESS != ret) {
+        free(raw);
+        return ret;
+    }
+    *data = raw;
+    *data_length = raw_length;
+    return OWON_SUCCESS;
+}
@@ -0,0 +1,56 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef __OWON__DELTA_H__
+#define __OWON__DELTA_H__
+
+struct owon_capture;
+struct owon_channel;
+
+// Samples compared at a time by owon_delta_check(), which stops at the 
+// first block that differs by more than the tolerance.
+#define OWON_DELTA_BLOCK 4096
+
+// The capture a run of downloads is compared against: the channels of the
+// last one that changed, with a hash of each.
+struct owon_delta {
+    int tolerance;          // Largest difference, in raw sample units, 
+                            // between samples that count as the same.
+    int keep_samples;       // Keep the samples of the reference even when
+                            // `tolerance` is 0, for owon_delta_write().
+    int channel_count;      // -1 before the first capture.
+    struct owon_channel *channels; // Samples are NULL when `tolerance` is 0
+                                   // and `keep_samples` isn't set.
+    unsigned long long *hashes;
+};
+
+unsigned long long owon_channel_hash(const struct owon_channel *channel);
+int owon_max_abs_diff(const short *a, const short *b, int count);
+void owon_delta_init(struct owon_delta *delta, int tolerance);
+int owon_delta_check(struct owon_delta *delta, 
+        const struct owon_capture *capture, int *changed, int *max_diff);
+void owon_delta_free(struct owon_delta *delta);
+int owon_delta_write(const struct owon_delta *delta, const char *data, 
+        size_t length, long reference, int max_diff, FILE *fp);
+int owon_delta_read(const char *record, size_t length, long *reference, 
+        int *max_diff);
+int owon_delta_rebuild(const char *record, size_t length, 
+        const struct owon_capture *reference, char **data, 
+        size_t *data_length);
+
+#endif // __OWON__DELTA_H__
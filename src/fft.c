@@ -0,0 +1,331 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "owon.h"
+#include "parse.h"
+#include "fft.h"
+
+// Plans made so far, most recent first. Captures from one scope come in a
+// handful of lengths, so a list is plenty.
+static struct owon_fft_plan *plans = NULL;
+static pthread_mutex_t plans_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_plan(struct owon_fft_plan *plan) {
+    free(plan->window);
+    free(plan->twiddle);
+    free(plan->reverse);
+    free(plan);
+}
+
+static struct owon_fft_plan *make_plan(int sample_count) {
+    struct owon_fft_plan *plan = calloc(1, sizeof(*plan));
+    if (NULL == plan) {
+        return NULL;
+    }
+    plan->sample_count = sample_count;
+    plan->size = 2;
+    while (plan->size < sample_count) {
+        plan->size *= 2;
+    }
+    int half = plan->size / 2;
+    plan->window = malloc(sample_count * sizeof(double));
+    plan->twiddle = malloc(2 * half * sizeof(double));
+    plan->reverse = malloc(half * sizeof(int));
+    if (NULL == plan->window || NULL == plan->twiddle || 
+            NULL == plan->reverse) {
+        free_plan(plan);
+        return NULL;
+    }
+
+    int i;
+    for (i = 0; i < sample_count; i++) {
+        plan->window[i] = (sample_count > 1) ? 
+            0.5 - 0.5 * cos(2 * M_PI * i / (sample_count - 1)) : 1.0;
+        plan->window_sum += plan->window[i];
+    }
+    for (i = 0; i < half; i++) {
+        plan->twiddle[2 * i] = cos(2 * M_PI * i / plan->size);
+        plan->twiddle[2 * i + 1] = -sin(2 * M_PI * i / plan->size);
+    }
+    int bits = 0;
+    while ((1 << bits) < half) {
+        bits++;
+    }
+    for (i = 0; i < half; i++) {
+        int r = 0;
+        int b;
+        for (b = 0; b < bits; b++) {
+            if (i & (1 << b)) {
+                r |= 1 << (bits - 1 - b);
+            }
+        }
+        plan->reverse[i] = r;
+    }
+    return plan;
+}
+
+// Return the plan for channels of `sample_count` samples, making it the 
+// first time. Plans are kept until owon_fft_cleanup(), so one made for the
+// first channel or file is reused by every other of the same length.
+const struct owon_fft_plan *owon_fft_plan(int sample_count) {
+    if (sample_count < 1) {
+        return NULL;
+    }
+    pthread_mutex_lock(&plans_mutex);
+    struct owon_fft_plan *plan;
+    for (plan = plans; NULL != plan; plan = plan->next) {
+        if (plan->sample_count == sample_count) {
+            break;
+        }
+    }
+    if (NULL == plan) {
+        plan = make_plan(sample_count);
+        if (NULL != plan) {
+            plan->next = plans;
+            plans = plan;
+        }
+    }
+    pthread_mutex_unlock(&plans_mutex);
+    return plan;
+}
+
+// Free every cached plan. No plan may be in use.
+void owon_fft_cleanup(void) {
+    pthread_mutex_lock(&plans_mutex);
+    while (NULL != plans) {
+        struct owon_fft_plan *next = plans->next;
+        free_plan(plans);
+        plans = next;
+    }
+    pthread_mutex_unlock(&plans_mutex);
+}
+
+// In-place complex FFT of size / 2 points held as re, im pairs.
+static void fft_half(const struct owon_fft_plan *plan, double *data) {
+    int half = plan->size / 2;
+    int i;
+    for (i = 0; i < half; i++) {
+        int r = plan->reverse[i];
+        if (r > i) {
+            double re = data[2 * i];
+            double im = data[2 * i + 1];
+            data[2 * i] = data[2 * r];
+            data[2 * i + 1] = data[2 * r + 1];
+            data[2 * r] = re;
+            data[2 * r + 1] = im;
+        }
+    }
+    int len;
+    for (len = 2; len <= half; len *= 2) {
+        // e^(-2 pi i j / len) is entry j * size / len of the table.
+        int step = plan->size / len;
+        int start;
+        for (start = 0; start < half; start += len) {
+            int j;
+            for (j = 0; j < len / 2; j++) {
+                double wr = plan->twiddle[2 * j * step];
+                double wi = plan->twiddle[2 * j * step + 1];
+                double *a = data + 2 * (start + j);
+                double *b = data + 2 * (start + j + len / 2);
+                double tr = wr * b[0] - wi * b[1];
+                double ti = wr * b[1] + wi * b[0];
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+}
+
+// Number of frequency bins owon_spectrum() produces for `channel`; none for
+// the scope's own FFT channel, which is a spectrum already.
+int owon_spectrum_bins(const struct owon_channel *channel) {
+    if (OWON_CHANNEL_FFT == channel->kind) {
+        return 0;
+    }
+    const struct owon_fft_plan *plan = owon_fft_plan(channel->sample_count);
+    return (NULL == plan) ? 0 : plan->size / 2 + 1;
+}
+
+// Spacing, in Hz, of the frequency bins of `channel`.
+float owon_spectrum_resolution(const struct owon_channel *channel) {
+    const struct owon_fft_plan *plan = owon_fft_plan(channel->sample_count);
+    if (NULL == plan) {
+        return 0;
+    }
+    // time_mul is in us.
+    return 1e6 / (plan->size * (double)channel->time_mul);
+}
+
+// Fill `amplitudes` with the single-sided amplitude spectrum of `channel`,
+// in mV, with owon_spectrum_bins() entries from DC up to the Nyquist 
+// frequency. The samples are Hann windowed and padded with zeros to a 
+// power of two; the window's loss is corrected for.
+int owon_spectrum(const struct owon_channel *channel, float *amplitudes) {
+    if (OWON_CHANNEL_FFT == channel->kind) {
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    const struct owon_fft_plan *plan = owon_fft_plan(channel->sample_count);
+    if (NULL == plan) {
+        return (channel->sample_count < 1) ? OWON_ERROR : OWON_ERROR_MEMORY;
+    }
+    int n = plan->size;
+    int half = n / 2;
+    // The real samples are packed as the real and imaginary parts of half 
+    // as many complex points, transformed, and then pulled apart.
+    double *data = calloc(n, sizeof(double));
+    if (NULL == data) {
+        return OWON_ERROR_MEMORY;
+    }
+    double scale = (double)channel->volts_mul * channel->attenuation;
+    int i;
+    for (i = 0; i < plan->sample_count; i++) {
+        data[i] = channel->samples[i] * scale * plan->window[i];
+    }
+    fft_half(plan, data);
+
+    double norm = (plan->window_sum > 0) ? 1.0 / plan->window_sum : 0;
+    int k;
+    for (k = 0; k <= half; k++) {
+        int a = (k == half) ? 0 : k;
+        int b = (0 == k) ? 0 : half - k;
+        double zr = data[2 * a], zi = data[2 * a + 1];
+        double cr = data[2 * b], ci = -data[2 * b + 1]; // conj(Z[half - k])
+        // Even and odd sample transforms.
+        double er = (zr + cr) / 2, ei = (zi + ci) / 2;
+        double or_ = (zi - ci) / 2, oi = -(zr - cr) / 2;
+        double wr, wi;
+        if (k == half) {
+            wr = -1;
+            wi = 0;
+        } else {
+            wr = plan->twiddle[2 * k];
+            wi = plan->twiddle[2 * k + 1];
+        }
+        double xr = er + wr * or_ - wi * oi;
+        double xi = ei + wr * oi + wi * or_;
+        double magnitude = sqrt(xr * xr + xi * xi) * norm;
+        if (0 != k && half != k) {
+            magnitude *= 2;
+        }
+        amplitudes[k] = magnitude;
+    }
+    free(data);
+    return OWON_SUCCESS;
+}
+
+// Write `value` to `fp` as owon_write_delim_precision() does.
+static void write_value(float value, int precision, FILE *fp) {
+    char str[OWON_VALUE_SIZE];
+    fwrite(str, sizeof(char), owon_format_fixed(str, value, precision), fp);
+}
+
+// Write the spectrum of each channel as delimited columns: for each channel
+// the frequency in Hz, then the amplitude in mV. Channels can differ in 
+// sample count and sample rate, so each has a frequency axis of its own. 
+// FFT channels are left blank.
+int owon_write_spectrum(struct owon_capture const *capture, char *delim, 
+        char *line_end, int header, int precision, FILE *fp) {
+    if (capture->channel_count < 1) {
+        return OWON_ERROR;
+    }
+    if (precision < 0 || precision > OWON_MAX_PRECISION) {
+        return OWON_ERROR;
+    }
+    // Needs every sample in memory; see owon_open_capture().
+    if (capture->windowed) {
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    float **spectra = calloc(capture->channel_count, sizeof(float *));
+    int *bins = calloc(capture->channel_count, sizeof(int));
+    float *resolution = calloc(capture->channel_count, sizeof(float));
+    int ret = OWON_SUCCESS;
+    if (NULL == spectra || NULL == bins || NULL == resolution) {
+        ret = OWON_ERROR_MEMORY;
+        goto done;
+    }
+    int max_bins = 0;
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+        struct owon_channel *channel = &capture->channels[chan_idx];
+        bins[chan_idx] = owon_spectrum_bins(channel);
+        if (0 == bins[chan_idx]) {
+            continue;
+        }
+        spectra[chan_idx] = malloc(bins[chan_idx] * sizeof(float));
+        if (NULL == spectra[chan_idx]) {
+            ret = OWON_ERROR_MEMORY;
+            goto done;
+        }
+        ret = owon_spectrum(channel, spectra[chan_idx]);
+        if (OWON_SUCCESS != ret) {
+            goto done;
+        }
+        resolution[chan_idx] = owon_spectrum_resolution(channel);
+        if (bins[chan_idx] > max_bins) {
+            max_bins = bins[chan_idx];
+        }
+    }
+
+    if (header) {
+        for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+            fprintf(fp, "%s frequency (Hz)%s%s (mV)%s", 
+                    capture->channels[chan_idx].name, delim, 
+                    capture->channels[chan_idx].name, 
+                    (chan_idx < capture->channel_count - 1) ? delim : 
+                    line_end);
+        }
+    }
+    int k;
+    for (k = 0; k < max_bins; k++) {
+        for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+            char *s = (chan_idx < capture->channel_count - 1) ? delim : 
+                line_end;
+            if (k < bins[chan_idx]) {
+                write_value(k * resolution[chan_idx], precision, fp);
+                fputs(delim, fp);
+                write_value(spectra[chan_idx][k], precision, fp);
+                fputs(s, fp);
+            } else {
+                fprintf(fp, " %s %s", delim, s);
+            }
+        }
+    }
+    if (ferror(fp)) {
+        ret = OWON_ERROR;
+    }
+
+done:
+    if (NULL != spectra) {
+        for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+            free(spectra[chan_idx]);
+        }
+    }
+    free(spectra);
+    free(bins);
+    free(resolution);
+    return ret;
+}
@@ -0,0 +1,48 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef __OWON__FFT_H__
+#define __OWON__FFT_H__
+
+struct owon_channel;
+struct owon_capture;
+
+// Everything needed to transform channels of one length: the window and
+// the tables for an FFT of `size`, the power of two the samples are padded
+// to. Plans are shared between threads and never change once made.
+struct owon_fft_plan {
+    int sample_count;
+    int size;
+    double *window;         // Hann window, `sample_count` long.
+    double window_sum;
+    double *twiddle;        // e^(-2 pi i k / size) for k < size / 2, as 
+                            // pairs of cos and sin.
+    int *reverse;           // Bit reversal of indices below size / 2.
+    struct owon_fft_plan *next;
+};
+
+const struct owon_fft_plan *owon_fft_plan(int sample_count);
+void owon_fft_cleanup(void);
+int owon_spectrum_bins(const struct owon_channel *channel);
+float owon_spectrum_resolution(const struct owon_channel *channel);
+int owon_spectrum(const struct owon_channel *channel, float *amplitudes);
+int owon_write_spectrum(struct owon_capture const *capture, char *delim, 
+        char *line_end, int header, int precision, FILE *fp);
+
+#endif // __OWON__FFT_H__
@@ -0,0 +1,569 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "owon.h"
+#include "image.h"
+#include "pool.h"
+
+// Compression field of a bitmap info header.
+#define BI_RGB 0
+#define BI_BITFIELDS 3
+
+// Largest width or height accepted; screens are far smaller.
+#define MAX_DIMENSION 16384
+
+// Block read from a FILE when reading a whole bitmap.
+#define READ_BLOCK_SIZE 65536
+
+// Window kept by deflate, and so the most of the previous band that is 
+// worth handing to the next as a dictionary.
+#define DEFLATE_WINDOW 32768
+
+// Slack added to deflateBound(), which does not allow for flushes.
+#define DEFLATE_SLACK 64
+
+static const unsigned char png_signature[8] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+};
+
+// PNG filter types used.
+enum {
+    FILTER_NONE = 0,
+    FILTER_SUB = 1,
+    FILTER_UP = 2
+};
+
+static unsigned int get_u16(const unsigned char *p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u32_be(unsigned char *p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+// One colour component of 16 and 32 bit pixels, given by a mask.
+struct bitfield {
+    uint32_t mask;
+    int shift;
+    uint32_t max;   // Largest value of the component after shifting.
+};
+
+static void bitfield_init(struct bitfield *field, uint32_t mask) {
+    field->mask = mask;
+    field->shift = 0;
+    field->max = 0;
+    if (0 == mask) {
+        return;
+    }
+    while (0 == (mask & 1)) {
+        mask >>= 1;
+        field->shift++;
+    }
+    field->max = mask;
+}
+
+static unsigned char bitfield_get(const struct bitfield *field, 
+        uint32_t value) {
+    if (0 == field->max) {
+        return 0;
+    }
+    uint64_t component = (value & field->mask) >> field->shift;
+    return component * 255 / field->max;
+}
+
+// Everything needed to turn one row of the bitmap into RGB.
+struct bitmap_format {
+    int bpp;
+    unsigned char palette[256][3];
+    struct bitfield fields[3];  // Red, green and blue.
+};
+
+static void decode_row(const struct bitmap_format *format, 
+        const unsigned char *row, int width, unsigned char *out) {
+    int x, i;
+    switch (format->bpp) {
+    case 1:
+    case 4:
+    case 8: {
+        int bpp = format->bpp;
+        int mask = (1 << bpp) - 1;
+        for (x = 0; x < width; x++) {
+            int bit = x * bpp;
+            int index = (row[bit / 8] >> (8 - bpp - bit % 8)) & mask;
+            memcpy(out + x * 3, format->palette[index], 3);
+        }
+        break;
+    }
+    case 24:
+        for (x = 0; x < width; x++) {
+            out[x * 3] = row[x * 3 + 2];
+            out[x * 3 + 1] = row[x * 3 + 1];
+            out[x * 3 + 2] = row[x * 3];
+        }
+        break;
+    case 16:
+    case 32:
+        for (x = 0; x < width; x++) {
+            uint32_t value = (16 == format->bpp) ? get_u16(row + x * 2) : 
+                get_u32(row + x * 4);
+            for (i = 0; i < 3; i++) {
+                out[x * 3 + i] = bitfield_get(&format->fields[i], value);
+            }
+        }
+        break;
+    }
+}
+
+// Check whether `data` looks like a screen capture rather than a waveform.
+int owon_is_bitmap(const void *data, size_t length) {
+    return length >= 2 && 0 == memcmp(data, "BM", 2);
+}
+
+// Decode the bitmap (BMP) screen capture in `data` into `image`, which is 
+// released with owon_free_image(). Uncompressed bitmaps of 1, 4, 8, 16, 24
+// and 32 bits a pixel are supported, with either the OS/2 or the Windows 
+// header.
+int owon_decode_bitmap(struct owon_image *image, const void *data, 
+        size_t length) {
+    const unsigned char *bytes = data;
+    memset(image, 0, sizeof(*image));
+    if (!owon_is_bitmap(data, length)) {
+        return OWON_ERROR_HEADER;
+    }
+    if (length < OWON_BITMAP_HEADER_SIZE + 4) {
+        return OWON_ERROR_READ;
+    }
+    size_t pixel_offset = get_u32(bytes + 10);
+    const unsigned char *info = bytes + OWON_BITMAP_HEADER_SIZE;
+    size_t info_size = get_u32(info);
+    if (info_size < 12 || length - OWON_BITMAP_HEADER_SIZE < info_size) {
+        return OWON_ERROR_READ;
+    }
+
+    struct bitmap_format *format = calloc(1, sizeof(*format));
+    if (NULL == format) {
+        return OWON_ERROR_MEMORY;
+    }
+    long width, height;
+    uint32_t compression = BI_RGB;
+    size_t colors = 0;
+    size_t palette_entry = 4;
+    if (12 == info_size) {
+        // OS/2 header: 16-bit sizes and 3 byte palette entries.
+        width = get_u16(info + 4);
+        height = get_u16(info + 6);
+        format->bpp = get_u16(info + 10);
+        palette_entry = 3;
+    } else if (info_size >= 40) {
+        width = (int32_t)get_u32(info + 4);
+        height = (int32_t)get_u32(info + 8);
+        format->bpp = get_u16(info + 14);
+        compression = get_u32(info + 16);
+        colors = get_u32(info + 32);
+    } else {
+        free(format);
+        return OWON_ERROR_UNSUPPORTED;
+    }
+
+    // Rows are stored from the bottom up unless the height is negative.
+    int top_down = (height < 0);
+    if (top_down) {
+        height = -height;
+    }
+    int ret = OWON_ERROR_UNSUPPORTED;
+    if (width <= 0 || height <= 0 || 
+            width > MAX_DIMENSION || height > MAX_DIMENSION) {
+        goto done;
+    }
+
+    // The palette, or the masks of a 40 byte header, follow the header.
+    size_t table = OWON_BITMAP_HEADER_SIZE + info_size;
+    uint32_t masks[3] = {0x7c00, 0x03e0, 0x001f};   // 16 bit: 5, 5, 5
+    if (32 == format->bpp) {
+        masks[0] = 0xff0000;
+        masks[1] = 0x00ff00;
+        masks[2] = 0x0000ff;
+    }
+    if (BI_BITFIELDS == compression) {
+        if (16 != format->bpp && 32 != format->bpp) {
+            goto done;
+        }
+        const unsigned char *source = info + 40;
+        if (info_size < 52) {
+            if (length < table + 12) {
+                ret = OWON_ERROR_READ;
+                goto done;
+            }
+            source = bytes + table;
+            table += 12;
+        }
+        int i;
+        for (i = 0; i < 3; i++) {
+            masks[i] = get_u32(source + i * 4);
+        }
+    } else if (BI_RGB != compression) {
+        goto done;
+    }
+
+    int i;
+    switch (format->bpp) {
+    case 1:
+    case 4:
+    case 8: {
+        size_t max_colors = (size_t)1 << format->bpp;
+        if (0 == colors || colors > max_colors) {
+            colors = max_colors;
+        }
+        // Entries missing from a short palette are left black.
+        size_t c;
+        for (c = 0; c < colors; c++) {
+            size_t at = table + c * palette_entry;
+            if (at + 3 > length) {
+                break;
+            }
+            format->palette[c][0] = bytes[at + 2];
+            format->palette[c][1] = bytes[at + 1];
+            format->palette[c][2] = bytes[at];
+        }
+        break;
+    }
+    case 16:
+    case 32:
+        for (i = 0; i < 3; i++) {
+            bitfield_init(&format->fields[i], masks[i]);
+        }
+        break;
+    case 24:
+        break;
+    default:
+        goto done;
+    }
+
+    // Rows are padded to a multiple of 4 bytes.
+    size_t stride = ((size_t)width * format->bpp + 31) / 32 * 4;
+    if (pixel_offset > length || 
+            (length - pixel_offset) / stride < (size_t)height) {
+        ret = OWON_ERROR_READ;
+        goto done;
+    }
+
+    image->pixels = malloc((size_t)width * height * 3);
+    if (NULL == image->pixels) {
+        ret = OWON_ERROR_MEMORY;
+        goto done;
+    }
+    image->width = width;
+    image->height = height;
+    long y;
+    for (y = 0; y < height; y++) {
+        long stored = top_down ? y : height - 1 - y;
+        decode_row(format, bytes + pixel_offset + stride * stored, width, 
+                image->pixels + (size_t)y * width * 3);
+    }
+    ret = OWON_SUCCESS;
+
+done:
+    free(format);
+    return ret;
+}
+
+// Read a whole bitmap from `fp`, which may be a pipe, and decode it.
+int owon_read_bitmap(struct owon_image *image, FILE *fp) {
+    memset(image, 0, sizeof(*image));
+    char *data = NULL;
+    size_t length = 0;
+    size_t size = 0;
+    for (;;) {
+        if (size - length < READ_BLOCK_SIZE) {
+            size = (0 == size) ? READ_BLOCK_SIZE * 4 : size * 2;
+            char *grown = realloc(data, size);
+            if (NULL == grown) {
+                free(data);
+                return OWON_ERROR_MEMORY;
+            }
+            data = grown;
+        }
+        size_t count = fread(data + length, 1, size - length, fp);
+        length += count;
+        if (0 == count) {
+            break;
+        }
+    }
+    int ret = ferror(fp) ? OWON_ERROR_READ : 
+        owon_decode_bitmap(image, data, length);
+    free(data);
+    return ret;
+}
+
+void owon_free_image(struct owon_image *image) {
+    free(image->pixels);
+    memset(image, 0, sizeof(*image));
+}
+
+// Write `image` as a binary PPM (P6) file.
+int owon_write_ppm(const struct owon_image *image, FILE *fp) {
+    fprintf(fp, "P6\n%d %d\n255\n", image->width, image->height);
+    fwrite(image->pixels, 3, (size_t)image->width * image->height, fp);
+    if (ferror(fp)) {
+        return OWON_ERROR;
+    }
+    return OWON_SUCCESS;
+}
+
+// One band of rows of a PNG being written.
+struct png_band {
+    size_t start;           // Offset of the band in the filtered rows.
+    size_t size;
+    unsigned char *out;     // Compressed band, as it goes in its IDAT.
+    size_t out_length;
+    uLong adler;            // Adler-32 of the filtered band.
+    int status;
+};
+
+struct png_job {
+    const struct owon_image *image;
+    unsigned char *filtered;    // Every row with its filter type byte.
+    size_t row_size;
+    int band_count;
+    struct png_band *bands;
+};
+
+static long filter_cost(const unsigned char *row, const unsigned char *prev,
+        size_t n, int type) {
+    long cost = 0;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        unsigned char left = (i >= 3) ? row[i - 3] : 0;
+        unsigned char up = (NULL != prev) ? prev[i] : 0;
+        unsigned char value = row[i];
+        if (FILTER_SUB == type) {
+            value -= left;
+        } else if (FILTER_UP == type) {
+            value -= up;
+        }
+        cost += abs((signed char)value);
+    }
+    return cost;
+}
+
+// Filter one row of `n` bytes into `out`, preceded by the filter type. The
+// filter with the smallest sum of absolute differences is used, the usual 
+// guess at what will compress best; Paeth and Average rarely beat Sub and 
+// Up on screen captures.
+static void filter_row(unsigned char *out, const unsigned char *row, 
+        const unsigned char *prev, size_t n) {
+    int type = FILTER_NONE;
+    long best = filter_cost(row, prev, n, FILTER_NONE);
+    long cost = filter_cost(row, prev, n, FILTER_SUB);
+    if (cost < best) {
+        best = cost;
+        type = FILTER_SUB;
+    }
+    if (NULL != prev) {
+        cost = filter_cost(row, prev, n, FILTER_UP);
+        if (cost < best) {
+            type = FILTER_UP;
+        }
+    }
+    out[0] = type;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        unsigned char value = row[i];
+        if (FILTER_SUB == type && i >= 3) {
+            value -= row[i - 3];
+        } else if (FILTER_UP == type) {
+            value -= prev[i];
+        }
+        out[i + 1] = value;
+    }
+}
+
+// Pool work function: filter the rows of band `index`.
+static void filter_band(int worker, int index, void *user_data) {
+    struct png_job *job = user_data;
+    const struct owon_image *image = job->image;
+    size_t n = (size_t)image->width * 3;
+    int y = index * OWON_PNG_BAND_ROWS;
+    int end = y + OWON_PNG_BAND_ROWS;
+    if (end > image->height) {
+        end = image->height;
+    }
+    for (; y < end; y++) {
+        const unsigned char *row = image->pixels + y * n;
+        filter_row(job->filtered + y * job->row_size, row, 
+                (0 == y) ? NULL : row - n, n);
+    }
+}
+
+// Pool work function: deflate band `index` on its own. The end of the 
+// band before it is given as a dictionary, so splitting the image costs 
+// little compression. Every band but the last ends with a sync flush, 
+// which leaves it on a byte boundary, so the bands can just be 
+// concatenated into one zlib stream.
+static void deflate_band(int worker, int index, void *user_data) {
+    struct png_job *job = user_data;
+    struct png_band *band = &job->bands[index];
+    int first = (0 == index);
+    int last = (job->band_count - 1 == index);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (Z_OK != deflateInit2(&stream, OWON_PNG_LEVEL, Z_DEFLATED, -15, 8, 
+                Z_DEFAULT_STRATEGY)) {
+        band->status = OWON_ERROR_MEMORY;
+        return;
+    }
+    if (!first) {
+        size_t dictionary = (band->start < DEFLATE_WINDOW) ? band->start : 
+            DEFLATE_WINDOW;
+        deflateSetDictionary(&stream, 
+                job->filtered + band->start - dictionary, dictionary);
+    }
+
+    // The first band starts with the zlib header and the last ends with 
+    // the Adler-32 of the whole stream, so leave room for them.
+    size_t header = first ? 2 : 0;
+    size_t bound = deflateBound(&stream, band->size) + DEFLATE_SLACK;
+    band->out = malloc(header + bound + 4);
+    if (NULL == band->out) {
+        deflateEnd(&stream);
+        band->status = OWON_ERROR_MEMORY;
+        return;
+    }
+    stream.next_in = job->filtered + band->start;
+    stream.avail_in = band->size;
+    stream.next_out = band->out + header;
+    stream.avail_out = bound;
+    int ret = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if ((last ? Z_STREAM_END : Z_OK) != ret || 0 != stream.avail_in || 
+            0 == stream.avail_out) {
+        band->status = OWON_ERROR;
+    } else {
+        band->out_length = header + bound - stream.avail_out;
+        band->adler = adler32(adler32(0, NULL, 0), 
+                job->filtered + band->start, band->size);
+        band->status = OWON_SUCCESS;
+    }
+    deflateEnd(&stream);
+}
+
+static void write_chunk(FILE *fp, const char *type, 
+        const unsigned char *data, size_t length) {
+    unsigned char field[4];
+    put_u32_be(field, length);
+    fwrite(field, 1, 4, fp);
+    fwrite(type, 1, 4, fp);
+    uLong crc = crc32(0, (const Bytef *)type, 4);
+    if (length > 0) {
+        fwrite(data, 1, length, fp);
+        crc = crc32(crc, data, length);
+    }
+    put_u32_be(field, crc);
+    fwrite(field, 1, 4, fp);
+}
+
+// Write `image` as an RGB PNG file. Rows are filtered and compressed in 
+// bands of OWON_PNG_BAND_ROWS, using up to `threads` threads; each band 
+// becomes one IDAT chunk.
+int owon_write_png(const struct owon_image *image, int threads, FILE *fp) {
+    if (image->width <= 0 || image->height <= 0) {
+        return OWON_ERROR;
+    }
+    struct png_job job;
+    job.image = image;
+    job.row_size = 1 + (size_t)image->width * 3;
+    job.band_count = (image->height + OWON_PNG_BAND_ROWS - 1) / 
+        OWON_PNG_BAND_ROWS;
+    job.filtered = malloc(job.row_size * image->height);
+    job.bands = calloc(job.band_count, sizeof(*job.bands));
+    int ret = OWON_ERROR_MEMORY;
+    if (NULL == job.filtered || NULL == job.bands) {
+        goto done;
+    }
+    int i;
+    for (i = 0; i < job.band_count; i++) {
+        job.bands[i].start = (size_t)i * OWON_PNG_BAND_ROWS * job.row_size;
+        job.bands[i].size = job.row_size * ((i == job.band_count - 1) ? 
+                image->height - i * OWON_PNG_BAND_ROWS : OWON_PNG_BAND_ROWS);
+    }
+
+    // Every band is filtered before any is compressed, since each band 
+    // needs the end of the one before as its dictionary.
+    ret = owon_pool_run(threads, job.band_count, filter_band, &job);
+    if (OWON_SUCCESS != ret) {
+        goto done;
+    }
+    ret = owon_pool_run(threads, job.band_count, deflate_band, &job);
+    if (OWON_SUCCESS != ret) {
+        goto done;
+    }
+    uLong adler = adler32(0, NULL, 0);
+    for (i = 0; i < job.band_count; i++) {
+        if (OWON_SUCCESS != job.bands[i].status) {
+            ret = job.bands[i].status;
+            goto done;
+        }
+        adler = adler32_combine(adler, job.bands[i].adler, 
+                job.bands[i].size);
+    }
+    // zlib header: deflate with a 32K window, default compression.
+    job.bands[0].out[0] = 0x78;
+    job.bands[0].out[1] = 0x9c;
+    struct png_band *last = &job.bands[job.band_count - 1];
+    put_u32_be(last->out + last->out_length, adler);
+    last->out_length += 4;
+
+    unsigned char ihdr[13];
+    put_u32_be(ihdr, image->width);
+    put_u32_be(ihdr + 4, image->height);
+    ihdr[8] = 8;    // bits per component
+    ihdr[9] = 2;    // RGB
+    ihdr[10] = 0;   // deflate
+    ihdr[11] = 0;   // adaptive filtering
+    ihdr[12] = 0;   // not interlaced
+    fwrite(png_signature, 1, sizeof(png_signature), fp);
+    write_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+    for (i = 0; i < job.band_count; i++) {
+        write_chunk(fp, "IDAT", job.bands[i].out, job.bands[i].out_length);
+    }
+    write_chunk(fp, "IEND", NULL, 0);
+    ret = ferror(fp) ? OWON_ERROR : OWON_SUCCESS;
+
+done:
+    if (NULL != job.bands) {
+        for (i = 0; i < job.band_count; i++) {
+            free(job.bands[i].out);
+        }
+    }
+    free(job.bands);
+    free(job.filtered);
+    return ret;
+}
@@ -0,0 +1,48 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef __OWON__IMAGE_H__
+#define __OWON__IMAGE_H__
+
+// Size of the file header of a bitmap, which starts with "BM".
+#define OWON_BITMAP_HEADER_SIZE 14
+
+// Rows compressed together when writing PNG; each band is deflated on its
+// own, so bands can be compressed on separate threads.
+#define OWON_PNG_BAND_ROWS 64
+
+// zlib compression level used for PNG.
+#define OWON_PNG_LEVEL 6
+
+// A decoded screen capture: 8-bit RGB, 3 bytes a pixel, rows from the top
+// of the screen down with no padding between them.
+struct owon_image {
+    int width;
+    int height;
+    unsigned char *pixels;
+};
+
+int owon_is_bitmap(const void *data, size_t length);
+int owon_decode_bitmap(struct owon_image *image, const void *data, 
+        size_t length);
+int owon_read_bitmap(struct owon_image *image, FILE *fp);
+void owon_free_image(struct owon_image *image);
+int owon_write_ppm(const struct owon_image *image, FILE *fp);
+int owon_write_png(const struct owon_image *image, int threads, FILE *fp);
+
+#endif // __OWON__IMAGE_H__
@@ -0,0 +1,46 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+// Everything in libowon. Programs using the library include this rather 
+// than the individual headers.
+
+#ifndef __OWON__LIBOWON_H__
+#define __OWON__LIBOWON_H__
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define OWON_LIB_VERSION "0.1"
+
+#include "owon.h"
+#include "parse.h"
+#include "models.h"
+#include "convert.h"
+#include "decimate.h"
+#include "measure.h"
+#include "fft.h"
+#include "archive.h"
+#include "image.h"
+#include "usb.h"
+#include "sim.h"
+#include "session.h"
+#include "delta.h"
+#include "search.h"
+
+#endif // __OWON__LIBOWON_H__
@@ -0,0 +1,291 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "owon.h"
+#include "parse.h"
+#include "measure.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OWON_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Samples summed in 32-bit lanes before they are added to the total, as in
+// decimate.c.
+#define SUM_BLOCK 65536
+
+// Samples the signal has to stay in the bottom 10% for before a rising edge
+// can follow, so a one-sample bounce on a falling edge is not taken for a
+// new cycle.
+#define EDGE_DWELL 2
+
+// Totals over the raw samples of a channel.
+struct stats {
+    short min;
+    short max;
+    long long sum;
+    unsigned long long sum_squares;
+};
+
+static void stats_scalar(const short *samples, int count, 
+        struct stats *stats) {
+    int i;
+    for (i = 0; i < count; i++) {
+        short s = samples[i];
+        if (s < stats->min) {
+            stats->min = s;
+        }
+        if (s > stats->max) {
+            stats->max = s;
+        }
+        stats->sum += s;
+        stats->sum_squares += (unsigned long long)((int)s * s);
+    }
+}
+
+#ifdef OWON_X86_SIMD
+__attribute__((target("sse2")))
+static void stats_sse2(const short *samples, int count, 
+        struct stats *stats) {
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_set1_epi16(stats->min);
+    __m128i hi = _mm_set1_epi16(stats->max);
+    __m128i squares = zero;
+    int i = 0;
+    while (i + 8 <= count) {
+        int end = (count - i > SUM_BLOCK) ? i + SUM_BLOCK : count;
+        __m128i sum = zero;
+        for (; i + 8 <= end; i += 8) {
+            __m128i s = _mm_loadu_si128((const __m128i *)(samples + i));
+            lo = _mm_min_epi16(lo, s);
+            hi = _mm_max_epi16(hi, s);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(s, ones));
+            // A pair of squares is at most 2^31, which only fits unsigned,
+            // so widen to 64 bits straight away.
+            __m128i sq = _mm_madd_epi16(s, s);
+            squares = _mm_add_epi64(squares, _mm_unpacklo_epi32(sq, zero));
+            squares = _mm_add_epi64(squares, _mm_unpackhi_epi32(sq, zero));
+        }
+        int lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, sum);
+        stats->sum += (long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    short lanes_lo[8], lanes_hi[8];
+    unsigned long long lanes_sq[2];
+    _mm_storeu_si128((__m128i *)lanes_lo, lo);
+    _mm_storeu_si128((__m128i *)lanes_hi, hi);
+    _mm_storeu_si128((__m128i *)lanes_sq, squares);
+    int j;
+    for (j = 0; j < 8; j++) {
+        if (lanes_lo[j] < stats->min) {
+            stats->min = lanes_lo[j];
+        }
+        if (lanes_hi[j] > stats->max) {
+            stats->max = lanes_hi[j];
+        }
+    }
+    stats->sum_squares += lanes_sq[0] + lanes_sq[1];
+    stats_scalar(samples + i, count - i, stats);
+}
+#endif
+
+static void get_stats(const short *samples, int count, struct stats *stats) {
+    stats->min = samples[0];
+    stats->max = samples[0];
+    stats->sum = 0;
+    stats->sum_squares = 0;
+#ifdef OWON_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        stats_sse2(samples, count, stats);
+        return;
+    }
+#endif
+    stats_scalar(samples, count, stats);
+}
+
+// Where, between samples `i` - 1 and `i`, the signal crosses `level`.
+static double crossing(int i, double a, double b, double level) {
+    return i - 1 + (level - a) / (b - a);
+}
+
+// Find the rising edges: the time from leaving the bottom 10% to reaching 
+// the top 90%, and where the midpoint is crossed. The search has 
+// hysteresis: it is armed once the signal has stayed in the bottom 10% for
+// EDGE_DWELL samples, and is only armed again after the signal has reached
+// the top 90%, so noise and bounces around a level are not taken for edges.
+static void find_edges(const short *samples, int count, 
+        const struct stats *stats, double time_mul, 
+        struct owon_measurement *measurement) {
+    double range = stats->max - stats->min;
+    double low = stats->min + 0.1 * range;
+    double mid = stats->min + 0.5 * range;
+    double high = stats->min + 0.9 * range;
+
+    int armed = 0;
+    int armed_mid = 0;
+    int been_high = 1;  // The first low level may arm the search.
+    int low_run = (samples[0] <= low) ? 1 : 0;
+    int left_low = 0;
+    double t_low = 0;
+    double rise_total = 0;
+    int rises = 0;
+    double first = 0, last = 0;
+    int crossings = 0;
+    int i;
+    for (i = 1; i < count; i++) {
+        double a = samples[i - 1];
+        double b = samples[i];
+        if (b <= low) {
+            low_run++;
+            if (been_high && low_run >= EDGE_DWELL) {
+                armed = 1;
+                armed_mid = 1;
+                been_high = 0;
+            }
+            left_low = 0;
+            continue;
+        }
+        low_run = 0;
+        if (armed && a <= low) {
+            t_low = crossing(i, a, b, low);
+            left_low = 1;
+        }
+        if (armed_mid && a < mid && b >= mid) {
+            last = crossing(i, a, b, mid);
+            if (0 == crossings) {
+                first = last;
+            }
+            crossings++;
+            armed_mid = 0;
+        }
+        if (b >= high) {
+            if (armed && a < high && left_low) {
+                rise_total += crossing(i, a, b, high) - t_low;
+                rises++;
+            }
+            armed = 0;
+            armed_mid = 0;
+            been_high = 1;
+        }
+    }
+
+    measurement->edges = rises;
+    measurement->rise_time = (rises > 0) ? 
+        rise_total / rises * time_mul : NAN;
+    if (crossings > 1 && last > first) {
+        measurement->period = (last - first) / (crossings - 1) * time_mul;
+        measurement->frequency = 1e6 / measurement->period;
+    } else {
+        measurement->period = NAN;
+        measurement->frequency = NAN;
+    }
+}
+
+// Measure `channel`: one SIMD pass over the samples for the levels, then a
+// scalar pass for the edges, which need the levels to place the 10%, 50% 
+// and 90% points.
+int owon_measure_channel(const struct owon_channel *channel, 
+        struct owon_measurement *measurement) {
+    if (channel->sample_count < 1) {
+        return OWON_ERROR;
+    }
+    // The levels and edges of a spectrum mean nothing.
+    if (OWON_CHANNEL_FFT == channel->kind) {
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    struct stats stats;
+    get_stats(channel->samples, channel->sample_count, &stats);
+
+    double scale = (double)channel->volts_mul * channel->attenuation;
+    double mean = (double)stats.sum / channel->sample_count;
+    double mean_square = (double)stats.sum_squares / channel->sample_count;
+    measurement->min = stats.min * scale;
+    measurement->max = stats.max * scale;
+    if (scale < 0) {
+        float tmp = measurement->min;
+        measurement->min = measurement->max;
+        measurement->max = tmp;
+    }
+    measurement->vpp = measurement->max - measurement->min;
+    measurement->mean = mean * scale;
+    measurement->rms = sqrt(mean_square) * fabs(scale);
+
+    find_edges(channel->samples, channel->sample_count, &stats, 
+            channel->time_mul, measurement);
+    return OWON_SUCCESS;
+}
+
+static void put_field(FILE *fp, float value, const char *end) {
+    if (isnan(value)) {
+        fprintf(fp, "nan%s", end);
+    } else {
+        fprintf(fp, "%.9g%s", value, end);
+    }
+}
+
+// One line per channel with every measurement, plus the frequency and 
+// period reported by the scope, for use by scripts.
+int owon_write_measurements(struct owon_capture const *capture, char *delim,
+        char *line_end, int header, FILE *fp) {
+    if (capture->channel_count < 1) {
+        return OWON_ERROR;
+    }
+    // Needs every sample in memory; see owon_open_capture().
+    if (capture->windowed) {
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    if (header) {
+        fprintf(fp, "Channel%sMin (mV)%sMax (mV)%sVpp (mV)%sMean (mV)%s"
+                "RMS (mV)%sRise time (us)%sFrequency (Hz)%sPeriod (us)%s"
+                "Scope frequency (Hz)%sScope period (us)%s", delim, delim, 
+                delim, delim, delim, delim, delim, delim, delim, delim, 
+                line_end);
+    }
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+        struct owon_channel *channel = &capture->channels[chan_idx];
+        struct owon_measurement m;
+        fprintf(fp, "%s%s", channel->name, delim);
+        if (OWON_SUCCESS != owon_measure_channel(channel, &m)) {
+            m.min = m.max = m.vpp = m.mean = m.rms = NAN;
+            m.rise_time = m.frequency = m.period = NAN;
+        }
+        put_field(fp, m.min, delim);
+        put_field(fp, m.max, delim);
+        put_field(fp, m.vpp, delim);
+        put_field(fp, m.mean, delim);
+        put_field(fp, m.rms, delim);
+        put_field(fp, m.rise_time, delim);
+        put_field(fp, m.frequency, delim);
+        put_field(fp, m.period, delim);
+        put_field(fp, channel->frequency, delim);
+        put_field(fp, channel->period, line_end);
+    }
+    if (ferror(fp)) {
+        return OWON_ERROR;
+    }
+    return OWON_SUCCESS;
+}
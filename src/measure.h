@@ -0,0 +1,46 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef __OWON__MEASURE_H__
+#define __OWON__MEASURE_H__
+
+struct owon_channel;
+struct owon_capture;
+
+// Measurements of one channel. Voltages are in mV and times in us, the 
+// same units as the rest of the channel. Values that can't be measured 
+// (no complete rising edge, say) are NaN.
+struct owon_measurement {
+    float min;
+    float max;
+    float vpp;
+    float mean;
+    float rms;
+    float rise_time;    // Mean 10% to 90% rise time of the rising edges.
+    float frequency;    // In Hz, from crossings of the midpoint.
+    float period;
+    int edges;          // Number of rising edges found.
+};
+
+int owon_measure_channel(const struct owon_channel *channel, 
+        struct owon_measurement *measurement);
+int owon_write_measurements(struct owon_capture const *capture, char *delim,
+        char *line_end, int header, FILE *fp);
+
+#endif // __OWON__MEASURE_H__
@@ -0,0 +1,123 @@
+# owon-utils - a set of programs to use with OWON Oscilloscopes
+# Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+
+# Generate models.c, the table of struct owon_model, from doc/models.tab:
+#
+#     awk -f models.awk ../doc/models.tab > models.c
+#
+# Models without a header are left out. Models that write the same header 
+# must agree on everything else; their names are joined. The time scale 
+# index in a file counts from the smallest horizontal scale, or from the 
+# TimeBase column where the model's files count from another scale.
+
+BEGIN {
+    FS = "\t"
+    units["ns"] = 0; units["us"] = 3; units["ms"] = 6; units["s"] = 9
+    tables["1,2,5"] = "_time_table_10_20_50"
+    tables["1,2.5,5"] = "_time_table_10_25_50"
+    count = 0
+}
+
+function fail(message) {
+    printf("%s:%d: %s\n", FILENAME, FNR, message) > "/dev/stderr"
+    failed = 1
+    exit 1
+}
+
+# Index in the time tables of a scale such as `2.5ms`.
+function scale_index(scale, step,    value, unit, decade, steps, n, i) {
+    if (!match(scale, /[a-z]+$/)) {
+        fail("bad scale `" scale "'")
+    }
+    value = substr(scale, 1, RSTART - 1) + 0
+    unit = substr(scale, RSTART)
+    if (!(unit in units) || value <= 0) {
+        fail("bad scale `" scale "'")
+    }
+    decade = units[unit]
+    while (value >= 10) {
+        value /= 10
+        decade++
+    }
+    n = split(step, steps, ",")
+    for (i = 1; i <= n; i++) {
+        if (steps[i] + 0 == value) {
+            return decade * 3 + i - 1
+        }
+    }
+    fail("scale `" scale "' is not a step of " step)
+}
+
+FNR == 1 { next }
+NF < 5 || $5 == "" { next }
+
+{
+    header = $5
+    if (length(header) != 6) {
+        fail("bad header `" header "'")
+    }
+    if (!($3 in tables)) {
+        fail("unknown horizontal step `" $3 "'")
+    }
+    if (split($2, range, "-") != 2) {
+        fail("bad horizontal scale `" $2 "'")
+    }
+    first = scale_index(NF < 6 || $6 == "" ? range[1] : $6, $3)
+    last = scale_index(range[2], $3)
+    if (first > last || last >= 36) { # OWON_TIME_TABLE_SIZE
+        fail("bad horizontal scale `" $2 "'")
+    }
+    entry = tables[$3] " + " first ", " (last - first + 1) ", " $4
+
+    if (header in entries) {
+        if (entries[header] != entry) {
+            fail("`" $1 "' disagrees with other models writing " header)
+        }
+        names[header] = names[header] "/" $1
+        next
+    }
+    order[count++] = header
+    entries[header] = entry
+    names[header] = $1
+    steps[header] = tables[$3]
+    offsets[header] = first
+    lengths[header] = last - first + 1
+    channels[header] = $4
+}
+
+END {
+    if (failed) {
+        exit 1
+    }
+    print "/* Generated from doc/models.tab by models.awk; do not edit. */"
+    print ""
+    print "#include \"models.h\""
+    print ""
+    print "const struct owon_model owon_models[] = {"
+    for (i = 0; i < count; i++) {
+        header = order[i]
+        printf("    {\"%s\", \"%s\", %d,\n", header, names[header], 
+                channels[header])
+        printf("        %s + %d, %d,\n", steps[header], offsets[header],
+                lengths[header])
+        print "        _volt_table, OWON_VOLT_TABLE_SIZE,"
+        print "        _attenuation_table, OWON_ATTENUATION_TABLE_SIZE},"
+    }
+    print "};"
+    print ""
+    print "const int owon_model_count = sizeof(owon_models) / " \
+            "sizeof(owon_models[0]);"
+}
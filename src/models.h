@@ -0,0 +1,53 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef __OWON__MODELS_H__
+#define __OWON__MODELS_H__
+
+// Entries in the scale tables of parse.c.
+#define OWON_TIME_TABLE_SIZE 36         // 1 ns to 500 s
+#define OWON_VOLT_TABLE_SIZE 21         // 2 mV to 10 kV
+#define OWON_ATTENUATION_TABLE_SIZE 4   // 1x to 1000x
+
+extern float _attenuation_table[OWON_ATTENUATION_TABLE_SIZE];
+extern float _volt_table[OWON_VOLT_TABLE_SIZE];
+extern float _time_table_10_20_50[OWON_TIME_TABLE_SIZE];
+extern float _time_table_10_25_50[OWON_TIME_TABLE_SIZE];
+
+// Everything needed to read the files of one kind of oscilloscope: the 
+// scale tables the indices in its channel headers refer to, each with the 
+// number of entries the model can use.
+struct owon_model {
+    char header[6];     // File header string; not null-terminated.
+    const char *names;  // Models writing this header, separated by `/`.
+    int channels;       // Analog channels, or 0 when not known.
+    const float *time_table;
+    int time_count;
+    const float *volt_table;
+    int volt_count;
+    const float *attenuation_table;
+    int attenuation_count;
+};
+
+// Generated from doc/models.tab into models.c.
+extern const struct owon_model owon_models[];
+extern const int owon_model_count;
+
+const struct owon_model *owon_find_model(const char *header);
+
+#endif // __OWON__MODELS_H__
@@ -27,5 +27,7 @@
 #define OWON_ERROR_HEADER           (-5)
 #define OWON_ERROR_USB              (-6)
 #define OWON_ERROR_USB_NOT_FOUND    (-7)
+#define OWON_ERROR_OPEN             (-8)
+#define OWON_ERROR_BITMAP           (-9) // A screen capture, not a waveform
 
 #endif
@@ -0,0 +1,438 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "owon.h"
+#include "parse.h"
+#include "archive.h"
+
+#define __(x) #x
+#define PROGRAM __(owonarchive)
+#define PACKAGE __(owon-utils)
+#define VERSION __(0.1)
+#define AUTHORS __(Lana Larsen)
+
+// Size of the blocks standard input is read in.
+#define READ_BLOCK_SIZE 65536
+
+static char *invocation_name;
+
+struct {
+    char *delim;
+    int header;
+    char *outdir;
+    long long from;
+    long long to;
+} options;
+
+/* For long options that have no equivalent short option, use a
+   non-character as a pseudo short option, starting with CHAR_MAX + 1.  */
+enum {
+    OPTION_HELP = CHAR_MAX + 1,
+    OPTION_VERSION,
+    OPTION_FROM,
+    OPTION_TO
+};
+
+static const char *optstring = "d:ho:";
+static const struct option longopts[] = {
+    {"delimiter", required_argument, NULL, 'd'},
+    {"noheader", no_argument, NULL, 'h'},
+    {"output-dir", required_argument, NULL, 'o'},
+    {"from", required_argument, NULL, OPTION_FROM},
+    {"to", required_argument, NULL, OPTION_TO},
+    {"help", no_argument, NULL, OPTION_HELP},
+    {"version", no_argument, NULL, OPTION_VERSION},
+    {NULL, no_argument, NULL, 0}
+};
+
+void usage(int status) {
+    if (status != EXIT_SUCCESS) {
+        fprintf(stderr, "Try `%s --help' for more information\n", 
+                invocation_name);
+    } else {
+        printf("Usage: %s [OPTION]... add ARCHIVE FILE...\n", 
+                invocation_name);
+        printf("  or:  %s [OPTION]... list ARCHIVE\n", invocation_name);
+        printf("  or:  %s [OPTION]... extract ARCHIVE INDEX FILEOUT\n", 
+                invocation_name);
+        printf("  or:  %s [OPTION]... extract -o DIR ARCHIVE\n", 
+                invocation_name);
+        fputs(
+"Keep captures created by owondump compressed in ARCHIVE.\n"
+"\n"
+"  add      append each FILE to ARCHIVE, creating it if needed\n"
+"  list     print one line for each capture in ARCHIVE: its index, time,\n"
+"           name, model header, original and stored sizes, and for each\n"
+"           channel its name, samples, minimum and maximum in mV\n"
+"  extract  write capture INDEX to FILEOUT as owondump wrote it, or with\n"
+"           -o every capture to DIR as INDEX-NAME\n"
+"\n"
+"  -d, --delimiter=DELIM use DELIM between fields of list (default is \\t)\n"
+"  -h, --noheader        do not print a header line with list\n"
+"  -o, --output-dir=DIR  extract into DIR\n"
+"  --from=TIME           only list or extract captures taken at or after\n"
+"                        TIME, in seconds since the epoch\n"
+"  --to=TIME             only list or extract captures taken before TIME\n"
+"  --help                display this help and exit\n"
+"  --version             output version information and exit\n"
+"\n"
+"When FILE is -, add standard input, timestamped with the current time;\n"
+"otherwise captures are timestamped with the time FILE was modified.\n"
+"When FILEOUT is -, write to standard output.\n"
+, stdout);
+    }
+    exit(status);
+}
+
+void version() {
+    printf("%s (%s) %s\n", PROGRAM, PACKAGE, VERSION);
+    fputs(
+"License GPLv3+: GNU GPL version 3 or later "
+"<http://gnu.org/licenses/gpl.html>.\n"
+"This is free software: you are free to change and redistribute it.\n"
+"There is NO WARRANTY, to the extent permitted by law.\n"
+"\n"
+, stdout);
+    printf("Written by %s\n", AUTHORS);
+    exit(EXIT_SUCCESS);
+}
+
+/* Describe an error returned by the archive functions. */
+const char *error_message(int ret) {
+    switch (ret) {
+        case OWON_ERROR_OPEN:
+            return "Unable to open file.";
+        case OWON_ERROR_UNSUPPORTED:
+            return "The osocilloscope model or feature is not currently "
+                "supported.";
+        case OWON_ERROR_MEMORY:
+            return "Unable to allocate adquate memory.";
+        case OWON_ERROR_READ:
+            return "A read error occured.";
+        case OWON_ERROR_HEADER:
+            return "This file is not in the correct format.";
+        case OWON_ERROR_BITMAP:
+            return "This file is a screen capture, not a waveform.";
+        default:
+            return "An unknown error occurred.";
+    }
+}
+
+/* Read all of `fp` into a new buffer. */
+int read_all(FILE *fp, char **data, size_t *length) {
+    size_t size = READ_BLOCK_SIZE;
+    size_t used = 0;
+    char *buffer = malloc(size);
+    while (NULL != buffer) {
+        used += fread(buffer + used, 1, size - used, fp);
+        if (used < size) {
+            break;
+        }
+        size *= 2;
+        char *larger = realloc(buffer, size);
+        if (NULL == larger) {
+            free(buffer);
+        }
+        buffer = larger;
+    }
+    if (NULL == buffer) {
+        return OWON_ERROR_MEMORY;
+    }
+    if (ferror(fp)) {
+        free(buffer);
+        return OWON_ERROR_READ;
+    }
+    *data = buffer;
+    *length = used;
+    return OWON_SUCCESS;
+}
+
+/* Append each of `files` to the archive at `path`. */
+int add_files(const char *path, char **files, int count) {
+    struct owon_archive archive;
+    int ret = owon_archive_open(&archive, path, 1);
+    if (OWON_SUCCESS != ret) {
+        fprintf(stderr, "%s: %s\n", path, error_message(ret));
+        return EXIT_FAILURE;
+    }
+    int failed = 0;
+    int i;
+    for (i = 0; i < count; i++) {
+        char *data = NULL;
+        size_t length = 0;
+        long long timestamp;
+        char name[32];
+        const char *base;
+        if (0 == strcmp(files[i], "-")) {
+            timestamp = time(NULL);
+            snprintf(name, sizeof(name), "%lld.bin", timestamp);
+            base = name;
+            ret = read_all(stdin, &data, &length);
+        } else {
+            FILE *fp = fopen(files[i], "rb");
+            if (NULL == fp) {
+                ret = OWON_ERROR_OPEN;
+            } else {
+                struct stat st;
+                timestamp = (0 == fstat(fileno(fp), &st)) ? 
+                    st.st_mtime : time(NULL);
+                ret = read_all(fp, &data, &length);
+                fclose(fp);
+            }
+            base = strrchr(files[i], '/');
+            base = (NULL == base) ? files[i] : base + 1;
+        }
+        if (OWON_SUCCESS == ret) {
+            ret = owon_archive_add(&archive, data, length, base, timestamp);
+            free(data);
+        }
+        if (OWON_SUCCESS != ret) {
+            fprintf(stderr, "%s: %s\n", files[i], error_message(ret));
+            failed++;
+        }
+    }
+    ret = owon_archive_close(&archive);
+    if (OWON_SUCCESS != ret) {
+        fprintf(stderr, "%s: Unable to write the index.\n", path);
+        failed++;
+    }
+    return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Whether `entry` was taken within --from and --to. */
+int selected(const struct owon_archive_entry *entry) {
+    return entry->timestamp >= options.from && entry->timestamp < options.to;
+}
+
+/* Print the index of the archive at `path`. */
+int list_archive(const char *path) {
+    struct owon_archive archive;
+    int ret = owon_archive_open(&archive, path, 0);
+    if (OWON_SUCCESS != ret) {
+        fprintf(stderr, "%s: %s\n", path, error_message(ret));
+        return EXIT_FAILURE;
+    }
+    char *d = options.delim;
+    if (options.header) {
+        printf("Index%sTime%sName%sHeader%sSize%sStored%sChannels\n", d, d, 
+                d, d, d, d);
+    }
+    int i;
+    for (i = 0; i < archive.count; i++) {
+        const struct owon_archive_entry *entry = &archive.entries[i];
+        if (!selected(entry)) {
+            continue;
+        }
+        char when[32];
+        time_t t = entry->timestamp;
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+        printf("%d%s%s%s%s%s%s%s%u%s%u", i, d, when, d, entry->name, d, 
+                entry->header, d, entry->raw_length, d, entry->length);
+        int chan_idx;
+        for (chan_idx = 0; chan_idx < entry->channel_count; chan_idx++) {
+            printf("%s%s:%d:%g:%g", d, entry->channels[chan_idx].name, 
+                    entry->channels[chan_idx].sample_count,
+                    entry->channels[chan_idx].min, 
+                    entry->channels[chan_idx].max);
+        }
+        printf("\n");
+    }
+    owon_archive_close(&archive);
+    return EXIT_SUCCESS;
+}
+
+/* Write capture `index` of `archive` to `fileout`, or standard output if
+ * it is NULL. */
+int extract_one(struct owon_archive *archive, int index, 
+        const char *fileout) {
+    char *data;
+    size_t length;
+    int ret = owon_archive_read(archive, index, &data, &length);
+    if (OWON_SUCCESS != ret) {
+        fprintf(stderr, "Capture %d: %s\n", index, error_message(ret));
+        return ret;
+    }
+    FILE *fp = stdout;
+    if (NULL != fileout) {
+        fp = fopen(fileout, "wb");
+        if (NULL == fp) {
+            fprintf(stderr, "Unable to open %s\n", fileout);
+            free(data);
+            return OWON_ERROR_OPEN;
+        }
+    }
+    if (length != fwrite(data, 1, length, fp)) {
+        ret = OWON_ERROR;
+    }
+    // Only close if actual file (not stdout)
+    if (NULL != fileout && 0 != fclose(fp)) {
+        ret = OWON_ERROR;
+    }
+    if (OWON_SUCCESS != ret) {
+        fprintf(stderr, "Unable to write capture %d\n", index);
+    }
+    free(data);
+    return ret;
+}
+
+/* Extract capture `index` (a string from the command line), or with -o 
+ * every selected capture. */
+int extract_archive(const char *path, const char *index, 
+        const char *fileout) {
+    struct owon_archive archive;
+    int ret = owon_archive_open(&archive, path, 0);
+    if (OWON_SUCCESS != ret) {
+        fprintf(stderr, "%s: %s\n", path, error_message(ret));
+        return EXIT_FAILURE;
+    }
+    int failed = 0;
+    if (NULL == options.outdir) {
+        char *end;
+        long i = strtol(index, &end, 10);
+        if ('\0' != *end || i < 0 || i >= archive.count) {
+            fprintf(stderr, "No capture %s in %s\n", index, path);
+            failed++;
+        } else if (OWON_SUCCESS != extract_one(&archive, i, 
+                    (0 == strcmp(fileout, "-")) ? NULL : fileout)) {
+            failed++;
+        }
+    } else {
+        int i;
+        for (i = 0; i < archive.count; i++) {
+            if (!selected(&archive.entries[i])) {
+                continue;
+            }
+            int size = strlen(options.outdir) + 
+                strlen(archive.entries[i].name) + 32;
+            char *out = malloc(size);
+            if (NULL == out) {
+                failed++;
+                break;
+            }
+            snprintf(out, size, "%s/%06d-%s", options.outdir, i, 
+                    archive.entries[i].name);
+            if (OWON_SUCCESS != extract_one(&archive, i, out)) {
+                failed++;
+            }
+            free(out);
+        }
+    }
+    owon_archive_close(&archive);
+    return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+long long parse_time(const char *arg) {
+    char *end;
+    long long t = strtoll(arg, &end, 10);
+    if ('\0' != *end) {
+        fprintf(stderr, "Invalid time: %s\n", arg);
+        usage(EXIT_FAILURE);
+    }
+    return t;
+}
+
+int main(int argc, char **argv) {
+    // make copy because basename might modify path
+    char *argv0 = strdup(argv[0]);
+    // make copy because basename might reuse pointer
+    invocation_name = strdup(basename(argv0));
+    free(argv0);
+
+    // default options
+    options.delim = "\t";
+    options.header = 1;
+    options.from = LLONG_MIN;
+    options.to = LLONG_MAX;
+
+    int opt = getopt_long(argc, argv, optstring, longopts, NULL);
+    while (opt > -1) {
+        switch (opt) {
+            case 'd':
+                options.delim = optarg;
+                break;
+            case 'h':
+                options.header = 0;
+                break;
+            case 'o':
+                options.outdir = optarg;
+                break;
+            case OPTION_FROM:
+                options.from = parse_time(optarg);
+                break;
+            case OPTION_TO:
+                options.to = parse_time(optarg);
+                break;
+            case OPTION_HELP:
+                usage(EXIT_SUCCESS);
+            case OPTION_VERSION:
+                version();
+            default:
+                usage(EXIT_FAILURE);
+        }
+        opt = getopt_long(argc, argv, optstring, longopts, NULL);
+    }
+
+    int fargc = argc - optind;
+    char **fargv = argv + optind;
+    if (fargc < 2) {
+        fprintf(stderr, "A command and ARCHIVE are required.\n");
+        usage(EXIT_FAILURE);
+    }
+
+    int status = EXIT_FAILURE;
+    if (0 == strcmp(fargv[0], "add")) {
+        if (fargc < 3) {
+            fprintf(stderr, "FILE arguments are required.\n");
+            usage(EXIT_FAILURE);
+        }
+        status = add_files(fargv[1], fargv + 2, fargc - 2);
+    } else if (0 == strcmp(fargv[0], "list")) {
+        if (fargc > 2) {
+            fprintf(stderr, "Too many file arguments.\n");
+            usage(EXIT_FAILURE);
+        }
+        status = list_archive(fargv[1]);
+    } else if (0 == strcmp(fargv[0], "extract")) {
+        if (NULL == options.outdir && fargc != 4) {
+            fprintf(stderr, "INDEX and FILEOUT are required.\n");
+            usage(EXIT_FAILURE);
+        }
+        if (NULL != options.outdir && fargc != 2) {
+            fprintf(stderr, "Too many file arguments.\n");
+            usage(EXIT_FAILURE);
+        }
+        status = extract_archive(fargv[1], 
+                (4 == fargc) ? fargv[2] : NULL, 
+                (4 == fargc) ? fargv[3] : NULL);
+    } else {
+        fprintf(stderr, "Unrecognized command: %s\n", fargv[0]);
+        usage(EXIT_FAILURE);
+    }
+
+    free(invocation_name);
+    return status;
+}
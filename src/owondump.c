@@ -21,8 +21,19 @@
 #include <string.h>
 #include <getopt.h>
 #include <limits.h> // CHAR_MAX
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
 #include "owon.h"
 #include "usb.h"
+#include "parse.h"
+#include "delta.h"
+#include "image.h"
+#include "queue.h"
+#include "sim.h"
+#ifdef OWON_USB1
+#include "usb1.h"
+#endif
 
 #define __(x) #x
 #define PROGRAM __(owondump)
@@ -30,15 +41,106 @@
 #define VERSION __(0.1)
 #define AUTHORS __(Lana Larsen)
 
+// Number of downloaded captures that may wait for the writer thread.
+#define QUEUE_LENGTH 16
+
+// Added to the file name of a capture written as a delta record.
+#define DELTA_EXTENSION ".delta"
+
+// What --unchanged does with a capture no different from the last one.
+enum {
+    UNCHANGED_KEEP,     // Write it like any other.
+    UNCHANGED_SKIP,     // Leave it out.
+    UNCHANGED_DELTA     // Write a delta record instead (see write_delta()).
+};
+
 static char *invocation_name;
 
+struct {
+    char *format;
+    char *delim;
+    int header;
+    int continuous;
+    long count;     // Number of captures in continuous mode; 0 for no limit.
+    long interval;  // Minimum time between captures, in milliseconds.
+    int all;        // Download from every attached device.
+    int *locations; // Bus and address pairs given with --device.
+    int location_count;
+    struct owon_sim_config sim; // Simulated oscilloscopes are used instead 
+                                // of USB devices when there are payloads.
+    int sim_devices;
+    int async;      // Use the asynchronous libusb-1.0 backend.
+    int unchanged;  // UNCHANGED_KEEP, UNCHANGED_SKIP or UNCHANGED_DELTA.
+    int tolerance;  // Largest sample difference of an unchanged capture.
+} options;
+
+// One downloaded capture on its way to the writer thread.
+struct capture_item {
+    long index;
+    char *buffer;
+    long long length;
+};
+
+struct writer_args {
+    struct owon_queue *queue;
+    char *fileout;
+    int status;
+    struct owon_delta *delta;   // NULL unless --unchanged was given.
+    long reference;     // Number of the last capture that changed.
+    long checked;       // Captures compared.
+    long unchanged;     // Captures found unchanged.
+};
+
+// A device being downloaded from by its own thread.
+struct device_job {
+    struct usb_device *dev;     // NULL for a simulated device.
+    char *fileout;
+    int status;
+    pthread_t thread;
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
 enum {
     OPTION_HELP = CHAR_MAX + 1,
-    OPTION_VERSION
+    OPTION_VERSION,
+    OPTION_CONTINUOUS,
+    OPTION_COUNT,
+    OPTION_INTERVAL,
+    OPTION_ALL,
+    OPTION_DEVICE,
+    OPTION_SIMULATE,
+    OPTION_SIM_GENERATE,
+    OPTION_SIM_RESPONSE,
+    OPTION_SIM_BANDWIDTH,
+    OPTION_SIM_LATENCY,
+    OPTION_SIM_DEVICES,
+    OPTION_ASYNC,
+    OPTION_UNCHANGED,
+    OPTION_TOLERANCE
 };
 
-static const char *optstring = "";
+static const char *optstring = "f:d:h";
 static const struct option longopts[] = {
+    {"format", required_argument, NULL, 'f'},
+    {"delimiter", required_argument, NULL, 'd'},
+    {"noheader", no_argument, NULL, 'h'},
+    {"continuous", no_argument, NULL, OPTION_CONTINUOUS},
+    {"count", required_argument, NULL, OPTION_COUNT},
+    {"interval", required_argument, NULL, OPTION_INTERVAL},
+    {"unchanged", required_argument, NULL, OPTION_UNCHANGED},
+    {"tolerance", required_argument, NULL, OPTION_TOLERANCE},
+    {"all", no_argument, NULL, OPTION_ALL},
+    {"device", required_argument, NULL, OPTION_DEVICE},
+    {"simulate", required_argument, NULL, OPTION_SIMULATE},
+    {"sim-generate", required_argument, NULL, OPTION_SIM_GENERATE},
+    {"sim-response", required_argument, NULL, OPTION_SIM_RESPONSE},
+    {"sim-bandwidth", required_argument, NULL, OPTION_SIM_BANDWIDTH},
+    {"sim-latency", required_argument, NULL, OPTION_SIM_LATENCY},
+    {"sim-devices", required_argument, NULL, OPTION_SIM_DEVICES},
+#ifdef OWON_USB1
+    {"async", no_argument, NULL, OPTION_ASYNC},
+#endif
     {"help", no_argument, NULL, OPTION_HELP},
     {"version", no_argument, NULL, OPTION_VERSION},
     {NULL, 0, NULL, 0}
@@ -53,10 +155,58 @@ void usage(int status) {
         fputs(
 "Download data from OWON oscilloscopes to FILE.\n"
 "\n"
+"  -f, --format=FORMAT   output in FORMAT (default is raw)\n"
+"  -d, --delimiter=DELIM use DELIM as a delimiter for supported formats\n"
+"                        (default is \\t)\n"
+"  -h, --noheader        do not include header in formats that support it\n"
+"  --continuous          keep downloading until interrupted\n"
+"  --count=N             stop after N captures in continuous mode\n"
+"  --interval=MS         wait at least MS milliseconds between the start of\n"
+"                        each capture in continuous mode\n"
+"  --unchanged=ACTION    in continuous mode, what to do with a waveform no\n"
+"                        different from the last one that changed: keep\n"
+"                        (the default), skip, or delta to write only its\n"
+"                        differences from that capture (raw format only)\n"
+"  --tolerance=N         samples within N raw units of the last capture\n"
+"                        that changed are no different (default is 0)\n"
+"  --all                 download from every attached device in parallel\n"
+"  --device=BUS:ADDR     download from the device at BUS:ADDR (as listed by\n"
+"                        lsusb); may be given more than once\n"
+"  --simulate=FILE       download from a simulated oscilloscope that sends\n"
+"                        FILE (as written by owondump) for each capture;\n"
+"                        may be given more than once to send files in turn\n"
+"  --sim-generate=N      have the simulated oscilloscope send a generated\n"
+"                        two channel capture with N samples per channel\n"
+"  --sim-response=LENGTH:UNKNOWN:BITMAP\n"
+"                        fields of the simulated reply to START (a LENGTH\n"
+"                        of 0 means the length of the data)\n"
+"  --sim-bandwidth=BYTES send simulated data at BYTES per second\n"
+"  --sim-latency=MS      wait MS milliseconds before replying to START\n"
+"  --sim-devices=N       simulate N oscilloscopes (default is 1)\n"
+#ifdef OWON_USB1
+"  --async               use asynchronous libusb-1.0 transfers, keeping\n"
+"                        several reads in flight\n"
+#endif
 "  --help                display this help and exit\n"
 "  --version             output version information and exit\n"
 "\n"
 "When FILE is -, write to standard output.\n"
+"In continuous mode, the capture number is added to FILE before its\n"
+"extension (capture-000001.bin, ...); with -, captures are written one\n"
+"after the other to standard output.\n"
+"Delta records are written to FILE with .delta added. Each holds the\n"
+"number of the capture matched and the differences of every sample from\n"
+"it; owonparse --reference=CAPTURE rebuilds the original exactly.\n"
+"When downloading from more than one device, the bus and address of each\n"
+"device are added to FILE the same way (capture-001-005.bin, ...).\n"
+"\n"
+"Supported formats:\n"
+"  raw     Data exactly as sent by the device, for use with owonparse\n"
+"  delim   Waveform parsed in memory and written as delimited values,\n"
+"          use -d to specify delimiter, use -h to omit header\n"
+"  png     Screen capture decoded in memory and written as a PNG image\n"
+"  ppm     Screen capture decoded in memory and written as a binary PPM\n"
+"          image\n"
 , stdout);
     }
     exit(status);
@@ -75,14 +225,485 @@ void version() {
     exit(EXIT_SUCCESS);
 }
 
+static void handle_interrupt(int signum) {
+    interrupted = 1;
+}
+
+/* Return a newly allocated copy of `path` with `suffix` inserted before 
+ * the extension of the last path component, or appended if there is 
+ * none. */
+char *insert_suffix(const char *path, const char *suffix) {
+    const char *base = strrchr(path, '/');
+    base = (NULL == base) ? path : base + 1;
+    const char *ext = strrchr(base, '.');
+    if (NULL == ext || ext == base) {
+        ext = path + strlen(path);
+    }
+    int size = strlen(path) + strlen(suffix) + 1;
+    char *str = malloc(size);
+    if (NULL != str) {
+        snprintf(str, size, "%.*s%s%s", (int)(ext - path), path, suffix, ext);
+    }
+    return str;
+}
+
+/* Write the data downloaded from the device to `fp` in the selected 
+ * format. Takes ownership of `buffer`. */
+int write_capture(char *buffer, long long length, FILE *fp) {
+    if (0 == strcmp(options.format, "delim")) {
+        // Parse straight from the transfer buffer; no temporary file.
+        struct owon_capture capture;
+        int ret = owon_parse_usb_buffer(&capture, buffer, length);
+        if (OWON_SUCCESS != ret) {
+            free(buffer);
+            return ret;
+        }
+        owon_write_delim(&capture, options.delim, "\n", options.header, 
+                fp);
+        owon_free_capture(&capture);
+    } else if (0 == strcmp(options.format, "png") || 
+            0 == strcmp(options.format, "ppm")) {
+        // Screen captures are decoded straight from the transfer buffer.
+        struct owon_image image;
+        int ret = owon_decode_bitmap(&image, buffer, length);
+        free(buffer);
+        if (OWON_SUCCESS != ret) {
+            return ret;
+        }
+        if (0 == strcmp(options.format, "png")) {
+            ret = owon_write_png(&image, 1, fp);
+        } else {
+            ret = owon_write_ppm(&image, fp);
+        }
+        owon_free_image(&image);
+        if (OWON_SUCCESS != ret) {
+            return ret;
+        }
+    } else {
+        fwrite(buffer, sizeof(char), length, fp);
+        free(buffer);
+    }
+    if (ferror(fp)) {
+        return OWON_ERROR;
+    }
+    return OWON_SUCCESS;
+}
+
+/* Chunk callback for owon_usb_read_stream(): write the chunk to the 
+ * FILE pointed to by `user_data`. */
+int write_chunk(const char *chunk, int length, long long offset, 
+        long long total, void *user_data) {
+    FILE *fp = user_data;
+    if (length != fwrite(chunk, sizeof(char), length, fp)) {
+        return 1;
+    }
+    return 0;
+}
+
+/* Whether the capture in `item` differs from the last one that changed. 
+ * `*max_diff` is set to the largest sample difference found. Anything that
+ * isn't a waveform, such as a screen capture, counts as changed. */
+int capture_changed(struct owon_delta *delta, 
+        const struct capture_item *item, int *max_diff) {
+    struct owon_capture capture;
+    *max_diff = 0;
+    if (OWON_SUCCESS != owon_parse_buffer(&capture, item->buffer, 
+                item->length)) {
+        return 1;
+    }
+    int changed;
+    if (OWON_SUCCESS != owon_delta_check(delta, &capture, &changed, 
+                max_diff)) {
+        changed = 1;
+    }
+    owon_free_capture(&capture);
+    return changed;
+}
+
+/* Write the record kept in place of an unchanged capture (see 
+ * owon_delta_write()). Takes ownership of `item`'s buffer. */
+int write_delta(const struct writer_args *args, struct capture_item *item,
+        int max_diff, FILE *fp) {
+    int ret = owon_delta_write(args->delta, item->buffer, item->length, 
+            args->reference, max_diff, fp);
+    free(item->buffer);
+    return ret;
+}
+
+/* Writer thread for continuous mode: take captures off the queue and write
+ * each one out, so disk writes overlap the next USB transfer. On error the
+ * queue is closed, which stops the download loop. */
+void *writer_main(void *arg) {
+    struct writer_args *args = arg;
+    struct capture_item *item;
+    while (NULL != (item = owon_queue_pop(args->queue))) {
+        if (OWON_SUCCESS != args->status) {
+            // Drain what was queued before the error.
+            free(item->buffer);
+            free(item);
+            continue;
+        }
+        int changed = 1;
+        int max_diff = 0;
+        if (NULL != args->delta) {
+            changed = capture_changed(args->delta, item, &max_diff);
+            args->checked++;
+            if (changed) {
+                args->reference = item->index;
+            } else {
+                args->unchanged++;
+            }
+        }
+        if (!changed && UNCHANGED_SKIP == options.unchanged) {
+            free(item->buffer);
+            free(item);
+            continue;
+        }
+        FILE *fp = stdout;
+        char *name = NULL;
+        if (NULL != args->fileout) {
+            char suffix[24];
+            snprintf(suffix, sizeof(suffix), "-%06ld", item->index);
+            name = insert_suffix(args->fileout, suffix);
+            if (!changed && NULL != name) {
+                char *delta_name = realloc(name, 
+                        strlen(name) + sizeof(DELTA_EXTENSION));
+                if (NULL == delta_name) {
+                    free(name);
+                    name = NULL;
+                } else {
+                    name = strcat(delta_name, DELTA_EXTENSION);
+                }
+            }
+            fp = (NULL == name) ? NULL : fopen(name, "wb");
+        }
+        if (NULL == fp) {
+            fprintf(stderr, "Unable to open %s\n", 
+                    (NULL == name) ? args->fileout : name);
+            free(item->buffer);
+            args->status = OWON_ERROR;
+        } else {
+            int ret;
+            if (changed) {
+                ret = write_capture(item->buffer, item->length, fp);
+            } else {
+                ret = write_delta(args, item, max_diff, fp);
+            }
+            if (OWON_SUCCESS != ret) {
+                fprintf(stderr, "Unable to write capture %ld: %i\n", 
+                        item->index, ret);
+                args->status = ret;
+            }
+            if (stdout == fp) {
+                fflush(fp);
+            } else {
+                fclose(fp);
+            }
+        }
+        free(name);
+        free(item);
+        if (OWON_SUCCESS != args->status) {
+            owon_queue_close(args->queue);
+        }
+    }
+    return NULL;
+}
+
+/* Download captures until `options.count` is reached or the user 
+ * interrupts, keeping the device open. Each buffer is handed to the writer
+ * thread through a bounded queue. */
+int download_continuous(struct owon_usb_handle *handle, char *fileout) {
+    struct owon_queue queue;
+    if (OWON_SUCCESS != owon_queue_init(&queue, QUEUE_LENGTH)) {
+        return OWON_ERROR_MEMORY;
+    }
+    struct owon_delta delta;
+    owon_delta_init(&delta, options.tolerance);
+    struct writer_args args = {&queue, fileout, OWON_SUCCESS};
+    if (UNCHANGED_KEEP != options.unchanged) {
+        args.delta = &delta;
+    }
+    // Delta records hold the differences from the reference's samples.
+    delta.keep_samples = (UNCHANGED_DELTA == options.unchanged);
+    pthread_t writer;
+    if (0 != pthread_create(&writer, NULL, writer_main, &args)) {
+        owon_queue_destroy(&queue);
+        return OWON_ERROR;
+    }
+    signal(SIGINT, handle_interrupt);
+    signal(SIGTERM, handle_interrupt);
+
+    int status = OWON_SUCCESS;
+    long index;
+    for (index = 1; !interrupted && 
+            (0 == options.count || index <= options.count); index++) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        char *buffer;
+        long long length = owon_usb_read(handle, &buffer);
+        if (0 > length) {
+            fprintf(stderr, "Error reading from device: %lli\n", length);
+            status = (int)length;
+            break;
+        }
+        struct capture_item *item = malloc(sizeof(*item));
+        if (NULL == item) {
+            free(buffer);
+            status = OWON_ERROR_MEMORY;
+            break;
+        }
+        item->index = index;
+        item->buffer = buffer;
+        item->length = length;
+        if (OWON_SUCCESS != owon_queue_push(&queue, item)) {
+            // The writer gave up.
+            free(buffer);
+            free(item);
+            break;
+        }
+
+        if (options.interval > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long elapsed = (now.tv_sec - start.tv_sec) * 1000 + 
+                (now.tv_nsec - start.tv_nsec) / 1000000;
+            if (elapsed < options.interval) {
+                long remaining = options.interval - elapsed;
+                struct timespec delay = {remaining / 1000, 
+                    (remaining % 1000) * 1000000};
+                nanosleep(&delay, NULL);
+            }
+        }
+    }
+
+    owon_queue_close(&queue);
+    pthread_join(writer, NULL);
+    owon_queue_destroy(&queue);
+    if (NULL != args.delta) {
+        fprintf(stderr, "%s: %ld of %ld captures unchanged\n", 
+                (NULL == fileout) ? "-" : fileout, args.unchanged, 
+                args.checked);
+    }
+    owon_delta_free(&delta);
+    if (OWON_SUCCESS == status) {
+        status = args.status;
+    }
+    return status;
+}
+
+/* Download a single capture and write it to `fileout`, or standard output
+ * if NULL. */
+int download_once(struct owon_usb_handle *handle, char *fileout) {
+    FILE *fp = stdout;
+    if (NULL != fileout) {
+        fp = fopen(fileout, "wb");
+        if (NULL == fp) {
+            fprintf(stderr, "Unable to open %s\n", fileout);
+            return OWON_ERROR;
+        }
+    }
+
+    int ret;
+    if (0 == strcmp(options.format, "raw")) {
+        // Write each chunk as soon as it arrives.
+        long long length = owon_usb_read_stream(handle, NULL, 
+                OWON_USB_CHUNK_SIZE, write_chunk, fp);
+        if (0 > length) {
+            fprintf(stderr, "Error reading from device: %lli\n", length);
+        }
+        ret = (0 > length) ? length : OWON_SUCCESS;
+    } else {
+        char *buffer;
+        long long length = 0;
+        length = owon_usb_read(handle, &buffer);
+        if (0 > length) {
+            fprintf(stderr, "Error reading from device: %lli\n", length);
+            ret = (int)length;
+        } else {
+            // Write data out
+            ret = write_capture(buffer, length, fp);
+            if (OWON_SUCCESS != ret) {
+                fprintf(stderr, "Unable to write data from device: %i\n", 
+                        ret);
+            }
+        }
+    }
+
+    // Only close fp if it's an actually file (don't close stdout).
+    if (NULL != fileout) {
+        fclose(fp);
+    }
+    return ret;
+}
+
+/* Thread for one device: open it, download as the options say, and close 
+ * it again. */
+void *device_main(void *arg) {
+    struct device_job *job = arg;
+    struct owon_usb_handle *handle;
+    if (NULL == job->dev) {
+        handle = owon_sim_open(&options.sim);
+#ifdef OWON_USB1
+    } else if (options.async) {
+        int bus, address;
+        owon_usb_get_location(job->dev, &bus, &address);
+        handle = owon_usb1_open(bus, address);
+#endif
+    } else {
+        handle = owon_usb_open(job->dev);
+    }
+    if (NULL == handle) {
+        fprintf(stderr, "Unable to open device\n");
+        job->status = OWON_ERROR_USB;
+        return NULL;
+    }
+    if (options.continuous) {
+        job->status = download_continuous(handle, job->fileout);
+    } else {
+        job->status = download_once(handle, job->fileout);
+    }
+    owon_usb_close(handle);
+    return NULL;
+}
+
+/* Check whether `dev` was selected with --device. */
+int device_selected(struct usb_device *dev) {
+    int bus, address;
+    owon_usb_get_location(dev, &bus, &address);
+    int i;
+    for (i = 0; i < options.location_count; i++) {
+        if (options.locations[2 * i] == bus && 
+                options.locations[2 * i + 1] == address) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 int main (int argc, char **argv) {
     invocation_name = argv[0];
+
+    // default options
+    options.format = "raw";
+    options.sim_devices = 1;
+    options.delim = "\t";
+    options.header = 1;
     
     //TODO: add verbose option
-    //TODO: add option to download continuously
     int opt = getopt_long(argc, argv, optstring, longopts, NULL);
     while (opt > -1) {
         switch (opt) {
+            case 'f':
+                options.format = optarg;
+                break;
+            case 'd':
+                options.delim = optarg;
+                break;
+            case 'h':
+                options.header = 0;
+                break;
+            case OPTION_CONTINUOUS:
+                options.continuous = 1;
+                break;
+            case OPTION_COUNT:
+                options.count = strtol(optarg, NULL, 10);
+                if (options.count < 0) {
+                    fprintf(stderr, "Invalid count: %s\n", optarg);
+                    usage(EXIT_FAILURE);
+                }
+                break;
+            case OPTION_INTERVAL:
+                options.interval = strtol(optarg, NULL, 10);
+                if (options.interval < 0) {
+                    fprintf(stderr, "Invalid interval: %s\n", optarg);
+                    usage(EXIT_FAILURE);
+                }
+                break;
+            case OPTION_ALL:
+                options.all = 1;
+                break;
+            case OPTION_DEVICE: {
+                int bus, address;
+                if (2 != sscanf(optarg, "%d:%d", &bus, &address)) {
+                    fprintf(stderr, "Invalid device: %s\n", optarg);
+                    usage(EXIT_FAILURE);
+                }
+                int *locations = realloc(options.locations, 
+                        2 * (options.location_count + 1) * sizeof(int));
+                if (NULL == locations) {
+                    exit(EXIT_FAILURE);
+                }
+                locations[2 * options.location_count] = bus;
+                locations[2 * options.location_count + 1] = address;
+                options.locations = locations;
+                options.location_count++;
+                break;
+            }
+            case OPTION_SIMULATE: 
+                if (OWON_SUCCESS != owon_sim_add_file(&options.sim, optarg)) {
+                    fprintf(stderr, "Unable to read %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPTION_SIM_GENERATE: {
+                int samples = strtol(optarg, NULL, 10);
+                if (OWON_SUCCESS != owon_sim_add_generated(&options.sim, 2,
+                            samples)) {
+                    fprintf(stderr, "Invalid number of samples: %s\n", 
+                            optarg);
+                    usage(EXIT_FAILURE);
+                }
+                break;
+            }
+            case OPTION_SIM_RESPONSE: {
+                struct owon_start_response *response = 
+                    &options.sim.response;
+                if (3 != sscanf(optarg, "%u:%u:%u", &response->length, 
+                            &response->unknown, &response->bitmap)) {
+                    fprintf(stderr, "Invalid response: %s\n", optarg);
+                    usage(EXIT_FAILURE);
+                }
+                break;
+            }
+            case OPTION_SIM_BANDWIDTH:
+                options.sim.bandwidth = strtol(optarg, NULL, 10);
+                break;
+            case OPTION_SIM_LATENCY:
+                options.sim.latency = strtol(optarg, NULL, 10);
+                break;
+            case OPTION_SIM_DEVICES:
+                options.sim_devices = strtol(optarg, NULL, 10);
+                if (options.sim_devices < 1) {
+                    fprintf(stderr, "Invalid number of devices: %s\n", 
+                            optarg);
+                    usage(EXIT_FAILURE);
+                }
+                break;
+            case OPTION_ASYNC:
+                options.async = 1;
+                break;
+            case OPTION_UNCHANGED:
+                if (0 == strcmp(optarg, "keep")) {
+                    options.unchanged = UNCHANGED_KEEP;
+                } else if (0 == strcmp(optarg, "skip")) {
+                    options.unchanged = UNCHANGED_SKIP;
+                } else if (0 == strcmp(optarg, "delta")) {
+                    options.unchanged = UNCHANGED_DELTA;
+                } else {
+                    fprintf(stderr, "Invalid action: %s\n", optarg);
+                    usage(EXIT_FAILURE);
+                }
+                break;
+            case OPTION_TOLERANCE: {
+                char *end;
+                options.tolerance = strtol(optarg, &end, 10);
+                if (*end != '\0' || options.tolerance < 0) {
+                    fprintf(stderr, "Invalid tolerance: %s\n", optarg);
+                    usage(EXIT_FAILURE);
+                }
+                break;
+            }
             case OPTION_HELP:
                 usage(EXIT_SUCCESS);
             case OPTION_VERSION:
@@ -105,52 +726,111 @@ int main (int argc, char **argv) {
         usage(EXIT_FAILURE);
     }
 
+    if (0 != strcmp(options.format, "raw") && 
+            0 != strcmp(options.format, "delim") && 
+            0 != strcmp(options.format, "png") && 
+            0 != strcmp(options.format, "ppm")) {
+        fprintf(stderr, "Unrecognized format.\n");
+        usage(EXIT_FAILURE);
+    }
+
     char *fileout = NULL;
 
     if (*argv[optind] != '-') {
         fileout = argv[optind];
     }
 
-    // Get file pointer to file or stdout.
-    FILE *fp;
-    if (NULL == fileout) {
-        fp = stdout;
+    if (UNCHANGED_KEEP != options.unchanged && !options.continuous) {
+        fprintf(stderr, "--unchanged can only be used with --continuous.\n");
+        usage(EXIT_FAILURE);
+    }
+    if (UNCHANGED_DELTA == options.unchanged && NULL == fileout) {
+        fprintf(stderr, "Delta records can't be written to standard "
+                "output.\n");
+        usage(EXIT_FAILURE);
+    }
+    if (UNCHANGED_DELTA == options.unchanged && 
+            0 != strcmp(options.format, "raw")) {
+        fprintf(stderr, "Delta records can only be written with the raw "
+                "format.\n");
+        usage(EXIT_FAILURE);
+    }
+
+    struct usb_device **devices;
+    int device_count = 0;
+    int i;
+    if (options.sim.payload_count > 0) {
+        // Simulated devices are represented by NULL.
+        device_count = options.sim_devices;
+        devices = calloc(device_count + 1, sizeof(*devices));
     } else {
-        fp = fopen(fileout, "wb");
-        if (NULL == fp) {
-            fprintf(stderr, "Unable to open %s\n", fileout);
-            exit(EXIT_FAILURE);
-        }
+        owon_usb_init();
+        devices = owon_usb_get_devices();
+    }
+    if (NULL == devices) {
+        fprintf(stderr, "Unable to allocate adequate memory.\n");
+        exit(EXIT_FAILURE);
     }
 
-    owon_usb_init();
-    struct usb_device *dev = owon_usb_get_device();
-    if (NULL == dev) {
+    // Keep only the selected devices; by default, the first one found.
+    for (i = 0; NULL != devices[i]; i++) {
+        if (options.all || device_selected(devices[i]) || 
+                (0 == options.location_count && 0 == device_count)) {
+            devices[device_count++] = devices[i];
+        }
+    }
+    if (0 == device_count) {
         fprintf(stderr, "No devices found\n");
         exit(EXIT_FAILURE);
     }
-    struct usb_dev_handle *dev_handle = owon_usb_open(dev);
-    if (NULL == dev_handle) {
-        fprintf(stderr, "Unable to open device\n");
+    if (device_count > 1 && NULL == fileout) {
+        fprintf(stderr, "Standard output can't be used with more than one "
+                "device.\n");
         exit(EXIT_FAILURE);
     }
-    char *buffer;
-    long length = 0;
-    length = owon_usb_read(dev_handle, &buffer);
-    if (0 > length) {
-        fprintf(stderr, "Error reading from device: %li\n", length);
-    }
-    owon_usb_close(dev_handle);
 
-    // Write data out
-    fwrite(buffer, sizeof(char), length, fp);
-    free(buffer);
+    // One thread per device, each writing to its own file.
+    struct device_job *jobs = calloc(device_count, sizeof(*jobs));
+    if (NULL == jobs) {
+        fprintf(stderr, "Unable to allocate adequate memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < device_count; i++) {
+        jobs[i].dev = devices[i];
+        jobs[i].fileout = fileout;
+        if (device_count > 1) {
+            char suffix[24];
+            if (NULL == devices[i]) {
+                snprintf(suffix, sizeof(suffix), "-sim-%03d", i + 1);
+            } else {
+                int bus, address;
+                owon_usb_get_location(devices[i], &bus, &address);
+                snprintf(suffix, sizeof(suffix), "-%03d-%03d", bus, address);
+            }
+            jobs[i].fileout = insert_suffix(fileout, suffix);
+        }
+        if (0 != pthread_create(&jobs[i].thread, NULL, device_main, 
+                    &jobs[i])) {
+            fprintf(stderr, "Unable to start thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    // Only close fp if it's an actually file (don't close stdout).
-    if (NULL != fileout) {
-        fclose(fp);
+    int ret = OWON_SUCCESS;
+    for (i = 0; i < device_count; i++) {
+        pthread_join(jobs[i].thread, NULL);
+        if (OWON_SUCCESS != jobs[i].status) {
+            ret = jobs[i].status;
+        }
+        if (jobs[i].fileout != fileout) {
+            free(jobs[i].fileout);
+        }
     }
+    free(jobs);
+    free(devices);
+    free(options.locations);
+    owon_sim_free_config(&options.sim);
 
-    return 0;
+    return (OWON_SUCCESS == ret) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -19,11 +19,21 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 #include <libgen.h>
 #include <getopt.h>
 #include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "owon.h"
 #include "parse.h"
+#include "convert.h"
+#include "decimate.h"
+#include "measure.h"
+#include "fft.h"
+#include "image.h"
+#include "pool.h"
+#include "delta.h"
 
 #define __(x) #x
 #define PROGRAM __(owonparse)
@@ -31,6 +41,13 @@
 #define VERSION __(0.1)
 #define AUTHORS __(Lana Larsen)
 
+// Size of the blocks read from standard input when streaming.
+#define STREAM_BLOCK_SIZE 65536
+
+// Size from which a capture file is converted in windows rather than mapped
+// whole (see open_input()).
+#define WINDOWED_INPUT_SIZE (256L << 20)
+
 static char *invocation_name;
 
 struct {
@@ -38,20 +55,51 @@ struct {
     char *format;
     char *delim;
     int header;
+    int precision;
+    int jobs;
+    char *outdir;
+    char *reference;    // Capture a delta record is rebuilt from.
+    int decimate;
+    int envelope;
+    int measure;
 } options;
 
+// Outcome of converting one file in batch mode.
+struct batch_item {
+    char *filein;
+    int status;
+    long bytes;     // Size of the input file.
+    long samples;   // Samples in all channels.
+};
+
+struct batch {
+    struct batch_item *items;
+    struct owon_arena *arenas;  // One for each worker.
+};
+
 /* For long options that have no equivalent short option, use a
    non-character as a pseudo short option, starting with CHAR_MAX + 1.  */
 enum {
     OPTION_HELP = CHAR_MAX + 1,
-    OPTION_VERSION
+    OPTION_VERSION,
+    OPTION_DECIMATE,
+    OPTION_ENVELOPE,
+    OPTION_MEASURE,
+    OPTION_REFERENCE
 };
 
-static const char *optstring = "f:d:h";
+static const char *optstring = "f:d:hp:j:o:";
 static const struct option longopts[] = {
     {"format", required_argument, NULL, 'f'},
     {"delimiter", required_argument, NULL, 'd'},
     {"header", no_argument, NULL, 'h'},
+    {"precision", required_argument, NULL, 'p'},
+    {"jobs", required_argument, NULL, 'j'},
+    {"output-dir", required_argument, NULL, 'o'},
+    {"decimate", required_argument, NULL, OPTION_DECIMATE},
+    {"envelope", required_argument, NULL, OPTION_ENVELOPE},
+    {"measure", no_argument, NULL, OPTION_MEASURE},
+    {"reference", required_argument, NULL, OPTION_REFERENCE},
     {"help", no_argument, NULL, OPTION_HELP},
     {"version", no_argument, NULL, OPTION_VERSION},
     {NULL, no_argument, NULL, 0}
@@ -63,22 +111,51 @@ void usage(int status) {
                 invocation_name);
     } else {
         printf("Usage: %s [OPTION]... FILEIN FILEOUT\n", invocation_name);
+        printf("  or:  %s [OPTION]... -o OUTDIR FILE...\n", invocation_name);
         fputs(
 "Parse FILEIN created by owondump and print to FILEOUT in specified FORMAT.\n"
+"In the second form, convert each FILE into OUTDIR, keeping its name but\n"
+"changing the extension to match FORMAT.\n"
 "\n"
 "  -f, --format=FORMAT   output in FORMAT\n"
 "  -d, --delimiter=DELIM use DELIM as a delimiter for supported formats\n"
 "                        (default is \\t)\n"
 "  -h, --noheader        do not include header in formats that support it\n"
+"  -p, --precision=N     write N digits after the decimal point in formats\n"
+"                        that support it (default is 6)\n"
+"  -o, --output-dir=DIR  convert every FILE into DIR, continuing past files\n"
+"                        that can't be converted\n"
+"  -j, --jobs=N          convert N files at a time with -o, or compress a\n"
+"                        single PNG on N threads (default is 1)\n"
+"  --decimate=N          average every N samples into one\n"
+"  --envelope=WIDTH      reduce each channel to WIDTH pairs of points, the\n"
+"                        minimum and maximum of each stretch of samples\n"
+"  --measure             instead of the samples, write one delimited line of\n"
+"                        measurements per channel (use -d and -h as for\n"
+"                        delim)\n"
+"  --reference=FILE      FILEIN is a delta record written by owondump\n"
+"                        --unchanged=delta; rebuild it from FILE, the\n"
+"                        capture it names\n"
 "  --help                display this help and exit\n"
 "  --version             output version information and exit\n"
 "\n"
-"When FILEIN is -, read from standard input.\n"
+"When FILEIN is -, read from standard input. With f32 and i16, the input\n"
+"is converted as it arrives; channels are then padded only to the length\n"
+"of the longest channel before them.\n"
 "When FILEOUT is -, write to standard output.\n"
 "\n"
 "Supported formats:\n"
 "  delim   Delimited values, use -d to specify delimiter, \n"
-"          use -h to include header\n"
+"          use -h to include header, use -p to set precision\n"
+"  f32     Samples in mV as raw 32-bit floats, one channel after the other\n"
+"  i16     Samples as raw 16-bit integers from the device, one channel\n"
+"          after the other\n"
+"  npy     NumPy array of samples in mV (float32, one column per channel)\n"
+"  spectrum\n"
+"          Amplitude spectrum of each channel in mV, Hann windowed, each\n"
+"          preceded by its frequency in Hz; -d, -h and -p work as for delim\n"
+"  png     Screen capture (bitmap) as a PNG image\n"
+"  ppm     Screen capture (bitmap) as a binary PPM image\n"
 , stdout);
     }
     exit(status);
@@ -127,6 +204,469 @@ char *ftosi(double d) {
     return str;
 }
 
+/* Describe an error returned by the parser. */
+const char *error_message(int ret) {
+    switch (ret) {
+        case OWON_ERROR_OPEN:
+            return "Unable to open file.";
+        case OWON_ERROR_UNSUPPORTED:
+            return "The osocilloscope model or feature is not currently "
+                "supported.";
+        case OWON_ERROR_MEMORY:
+            return "Unable to allocate adquate memory.";
+        case OWON_ERROR_READ:
+            return "A read error occured.";
+        case OWON_ERROR_HEADER:
+            return "This file is not in the correct format.";
+        case OWON_ERROR_BITMAP:
+            return "This file is a screen capture; use -f png or -f ppm.";
+        default:
+            return "An unknown error occurred.";
+    }
+}
+
+/* File name extension for output in `format`, or NULL if the format is not
+ * supported. */
+const char *format_extension(const char *format) {
+    if (0 == strcmp(format, "delim")) {
+        return ".txt";
+    } else if (0 == strcmp(format, "f32")) {
+        return ".f32";
+    } else if (0 == strcmp(format, "i16")) {
+        return ".i16";
+    } else if (0 == strcmp(format, "npy")) {
+        return ".npy";
+    } else if (0 == strcmp(format, "spectrum")) {
+        return ".spectrum.txt";
+    } else if (0 == strcmp(format, "png")) {
+        return ".png";
+    } else if (0 == strcmp(format, "ppm")) {
+        return ".ppm";
+    }
+    return NULL;
+}
+
+/* Whether `format` is for screen captures rather than waveforms. */
+int image_format(const char *format) {
+    return 0 == strcmp(format, "png") || 0 == strcmp(format, "ppm");
+}
+
+/* Read the screen capture in `fin` and write it to `fout` in the selected
+ * format, compressing PNG on up to `threads` threads. */
+int convert_image(FILE *fin, FILE *fout, int threads) {
+    struct owon_image image;
+    int ret = owon_read_bitmap(&image, fin);
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+    if (0 == strcmp(options.format, "png")) {
+        ret = owon_write_png(&image, threads, fout);
+    } else {
+        ret = owon_write_ppm(&image, fout);
+    }
+    owon_free_image(&image);
+    return ret;
+}
+
+/* Write `capture` to `fp` in the selected format. */
+int write_format(struct owon_capture *capture, FILE *fp) {
+    if (options.measure) {
+        return owon_write_measurements(capture, options.delim, "\n", 
+                options.header, fp);
+    } else if (0 == strcmp(options.format, "delim")) {
+        return owon_write_delim_precision(capture, options.delim, "\n", 
+                options.header, options.precision, fp);
+    } else if (0 == strcmp(options.format, "f32")) {
+        return owon_write_f32(capture, fp);
+    } else if (0 == strcmp(options.format, "i16")) {
+        return owon_write_i16(capture, fp);
+    } else if (0 == strcmp(options.format, "npy")) {
+        return owon_write_npy(capture, fp);
+    } else if (0 == strcmp(options.format, "spectrum")) {
+        return owon_write_spectrum(capture, options.delim, "\n", 
+                options.header, options.precision, fp);
+    }
+    return OWON_ERROR_UNSUPPORTED;
+}
+
+/* Write `capture` to `fp` in the selected format, first reducing it if 
+ * --decimate or --envelope was given. */
+int write_capture(struct owon_capture *capture, FILE *fp) {
+    if (0 == options.decimate && 0 == options.envelope) {
+        return write_format(capture, fp);
+    }
+    struct owon_capture reduced;
+    int ret;
+    if (0 != options.decimate) {
+        ret = owon_decimate(capture, options.decimate, &reduced);
+    } else {
+        ret = owon_envelope(capture, options.envelope, &reduced);
+    }
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+    ret = write_format(&reduced, fp);
+    owon_free_capture(&reduced);
+    return ret;
+}
+
+/* Whether the selected output can be written from a windowed capture (see
+ * owon_open_capture()), one window of samples at a time. */
+int windowed_output(void) {
+    return 0 == options.decimate && 0 == options.envelope && 
+        !options.measure && 0 != strcmp(options.format, "spectrum");
+}
+
+/* Read the capture in the file `path` for conversion. It is parsed into 
+ * `arena` (see owon_parse_file_arena()), its samples mapped where possible.
+ * When the output allows it, a file of WINDOWED_INPUT_SIZE or more, or one
+ * that can't be mapped, is opened with only its headers read instead, and 
+ * the samples are read in windows as they are written, so even a capture 
+ * larger than memory converts in constant memory. */
+int open_input(struct owon_capture *capture, const char *path, 
+        struct owon_arena *arena) {
+    struct stat st;
+    int large = 0 == stat(path, &st) && st.st_size >= WINDOWED_INPUT_SIZE;
+    int ret;
+    if (large && windowed_output()) {
+        ret = owon_open_capture(capture, path);
+        if (OWON_ERROR_UNSUPPORTED != ret) {
+            return ret;
+        }
+    }
+    ret = owon_parse_file_arena(capture, path, arena);
+    if (!large && windowed_output() && 
+            (OWON_ERROR_MEMORY == ret || OWON_ERROR_READ == ret)) {
+        int windowed = owon_open_capture(capture, path);
+        if (OWON_ERROR_UNSUPPORTED != windowed) {
+            return windowed;
+        }
+    }
+    return ret;
+}
+
+/* Read all of `fp` into a new buffer. */
+int read_all(FILE *fp, char **data, size_t *length) {
+    size_t size = STREAM_BLOCK_SIZE;
+    size_t used = 0;
+    char *buffer = malloc(size);
+    while (NULL != buffer) {
+        used += fread(buffer + used, 1, size - used, fp);
+        if (used < size) {
+            break;
+        }
+        size *= 2;
+        char *larger = realloc(buffer, size);
+        if (NULL == larger) {
+            free(buffer);
+        }
+        buffer = larger;
+    }
+    if (NULL == buffer) {
+        return OWON_ERROR_MEMORY;
+    }
+    if (ferror(fp)) {
+        free(buffer);
+        return OWON_ERROR_READ;
+    }
+    *data = buffer;
+    *length = used;
+    return OWON_SUCCESS;
+}
+
+/* Rebuild the capture stood for by the delta record in `fp` from the 
+ * capture given with --reference, and parse it into `capture`. */
+int rebuild_delta(struct owon_capture *capture, FILE *fp) {
+    struct owon_capture reference;
+    int ret = owon_parse_file(&reference, options.reference);
+    if (OWON_SUCCESS != ret) {
+        fprintf(stderr, "%s: %s\n", options.reference, error_message(ret));
+        exit(EXIT_FAILURE);
+    }
+    char *record;
+    size_t length;
+    ret = read_all(fp, &record, &length);
+    if (OWON_SUCCESS == ret) {
+        char *data;
+        size_t data_length;
+        ret = owon_delta_rebuild(record, length, &reference, &data, 
+                &data_length);
+        free(record);
+        if (OWON_SUCCESS == ret) {
+            // The capture takes over `data`.
+            ret = owon_parse_usb_buffer(capture, data, data_length);
+            if (OWON_SUCCESS != ret) {
+                free(data);
+            }
+        }
+    }
+    owon_free_capture(&reference);
+    return ret;
+}
+
+/* Output state for formats that can be written while the capture is still
+ * being read (f32 and i16). */
+struct stream_output {
+    FILE *fp;
+    int f32;
+    int started;        // A channel has been started.
+    int max_samples;    // Longest channel seen so far.
+    int written;        // Samples written for the current channel.
+    union {
+        float f32[OWON_PARSER_CHUNK];
+        short i16[OWON_PARSER_CHUNK];
+    } values;
+};
+
+/* Pad the current channel out to the longest channel seen so far, with NaN
+ * for f32 or zero for i16. */
+int stream_pad(struct stream_output *out) {
+    int remaining = out->max_samples - out->written;
+    int count = (remaining < OWON_PARSER_CHUNK) ? remaining : 
+        OWON_PARSER_CHUNK;
+    int i;
+    for (i = 0; i < count; i++) {
+        if (out->f32) {
+            out->values.f32[i] = NAN;
+        } else {
+            out->values.i16[i] = 0;
+        }
+    }
+    size_t size = out->f32 ? sizeof(float) : sizeof(short);
+    while (remaining > 0) {
+        count = (remaining < OWON_PARSER_CHUNK) ? remaining : 
+            OWON_PARSER_CHUNK;
+        if (count != fwrite(&out->values, size, count, out->fp)) {
+            return OWON_ERROR;
+        }
+        remaining -= count;
+    }
+    out->written = out->max_samples;
+    return OWON_SUCCESS;
+}
+
+int stream_channel(const struct owon_channel *channel, void *user_data) {
+    struct stream_output *out = user_data;
+    if (out->started) {
+        int ret = stream_pad(out);
+        if (OWON_SUCCESS != ret) {
+            return ret;
+        }
+    }
+    out->started = 1;
+    out->written = 0;
+    if (channel->sample_count > out->max_samples) {
+        out->max_samples = channel->sample_count;
+    }
+    return OWON_SUCCESS;
+}
+
+int stream_samples(const struct owon_channel *channel, const short *samples,
+        int offset, int count, void *user_data) {
+    struct stream_output *out = user_data;
+    size_t written;
+    if (out->f32) {
+        owon_convert_samples(samples, count, channel->volts_mul, 
+                channel->attenuation, out->values.f32);
+        written = fwrite(out->values.f32, sizeof(float), count, out->fp);
+    } else {
+        written = fwrite(samples, sizeof(short), count, out->fp);
+    }
+    if (count != written) {
+        return OWON_ERROR;
+    }
+    out->written += count;
+    return OWON_SUCCESS;
+}
+
+static const struct owon_parser_callbacks stream_callbacks = {
+    NULL,
+    stream_channel,
+    stream_samples
+};
+
+/* Convert the capture coming from `fin` to `fout` as it is read, without 
+ * holding more than a block of it in memory. Only f32 and i16 can be 
+ * written this way. Since later channels are not known yet, each channel is
+ * padded to the longest channel before it rather than the longest overall.
+ */
+int stream_capture(FILE *fin, FILE *fout) {
+    struct stream_output *out = calloc(1, sizeof(*out));
+    struct owon_parser *parser = malloc(sizeof(*parser));
+    char *block = malloc(STREAM_BLOCK_SIZE);
+    int ret = OWON_ERROR_MEMORY;
+    if (NULL == out || NULL == parser || NULL == block) {
+        goto done;
+    }
+    out->fp = fout;
+    out->f32 = (0 == strcmp(options.format, "f32"));
+    owon_parser_init(parser, &stream_callbacks, out);
+
+    ret = OWON_SUCCESS;
+    size_t count;
+    while (OWON_SUCCESS == ret && 
+            0 < (count = fread(block, 1, STREAM_BLOCK_SIZE, fin))) {
+        ret = owon_parser_feed(parser, block, count);
+    }
+    if (OWON_SUCCESS == ret) {
+        ret = owon_parser_finish(parser);
+    }
+    if (OWON_SUCCESS == ret) {
+        if (!out->started) {
+            ret = OWON_ERROR;
+        } else {
+            ret = stream_pad(out);
+        }
+    }
+
+done:
+    free(out);
+    free(parser);
+    free(block);
+    return ret;
+}
+
+/* Return a newly allocated path in `outdir` for the output of `filein`. */
+char *output_path(const char *outdir, const char *filein) {
+    const char *base = strrchr(filein, '/');
+    base = (NULL == base) ? filein : base + 1;
+    const char *ext = strrchr(base, '.');
+    int base_length = (NULL == ext || ext == base) ? 
+        (int)strlen(base) : (int)(ext - base);
+    const char *new_ext = options.measure ? ".txt" : 
+        format_extension(options.format);
+    int size = strlen(outdir) + 1 + base_length + strlen(new_ext) + 1;
+    char *path = malloc(size);
+    if (NULL != path) {
+        snprintf(path, size, "%s/%.*s%s", outdir, base_length, base, 
+                new_ext);
+    }
+    return path;
+}
+
+/* Pool work function for batch mode: convert one file. Each worker parses
+ * into an arena of its own, which is reused for every file it converts. */
+void convert_item(int worker, int index, void *user_data) {
+    struct batch *batch = user_data;
+    struct batch_item *item = &batch->items[index];
+
+    struct stat st;
+    if (0 == stat(item->filein, &st)) {
+        item->bytes = st.st_size;
+    }
+
+    if (image_format(options.format)) {
+        // Files are already converted in parallel, so each image is 
+        // compressed on one thread.
+        FILE *fin = fopen(item->filein, "rb");
+        char *fileout = output_path(options.outdir, item->filein);
+        FILE *fp = (NULL == fin || NULL == fileout) ? NULL : 
+            fopen(fileout, "wb");
+        if (NULL == fp) {
+            item->status = OWON_ERROR_OPEN;
+        } else {
+            item->status = convert_image(fin, fp, 1);
+            if (0 != fclose(fp) && OWON_SUCCESS == item->status) {
+                item->status = OWON_ERROR;
+            }
+        }
+        if (NULL != fin) {
+            fclose(fin);
+        }
+        free(fileout);
+        return;
+    }
+
+    struct owon_capture capture;
+    item->status = open_input(&capture, item->filein, 
+            &batch->arenas[worker]);
+    if (OWON_SUCCESS != item->status) {
+        return;
+    }
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < capture.channel_count; chan_idx++) {
+        item->samples += capture.channels[chan_idx].sample_count;
+    }
+
+    char *fileout = output_path(options.outdir, item->filein);
+    FILE *fp = (NULL == fileout) ? NULL : fopen(fileout, "wb");
+    if (NULL == fp) {
+        item->status = OWON_ERROR_OPEN;
+    } else {
+        item->status = write_capture(&capture, fp);
+        if (0 != fclose(fp) && OWON_SUCCESS == item->status) {
+            item->status = OWON_ERROR;
+        }
+    }
+    free(fileout);
+    owon_free_capture(&capture);
+}
+
+/* Convert each of `files` into the output directory on a pool of threads,
+ * then report the files that failed and the overall throughput. */
+int convert_batch(char **files, int count) {
+    struct batch_item *items = calloc(count, sizeof(*items));
+    struct owon_arena *arenas = calloc(options.jobs, sizeof(*arenas));
+    if (NULL == items || NULL == arenas) {
+        fprintf(stderr, "%s\n", error_message(OWON_ERROR_MEMORY));
+        free(items);
+        free(arenas);
+        return EXIT_FAILURE;
+    }
+    int i;
+    for (i = 0; i < count; i++) {
+        items[i].filein = files[i];
+    }
+    for (i = 0; i < options.jobs; i++) {
+        owon_arena_init(&arenas[i]);
+    }
+    struct batch batch = {items, arenas};
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ret = owon_pool_run(options.jobs, count, convert_item, &batch);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (OWON_SUCCESS != ret) {
+        // No file was converted, and the statuses say nothing.
+        fprintf(stderr, "%s\n", error_message(ret));
+        for (i = 0; i < options.jobs; i++) {
+            owon_arena_free(&arenas[i]);
+        }
+        free(arenas);
+        free(items);
+        return EXIT_FAILURE;
+    }
+    double seconds = (end.tv_sec - start.tv_sec) + 
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    int failed = 0;
+    double bytes = 0;
+    double samples = 0;
+    for (i = 0; i < count; i++) {
+        if (OWON_SUCCESS != items[i].status) {
+            fprintf(stderr, "%s: %s\n", items[i].filein, 
+                    error_message(items[i].status));
+            failed++;
+        } else {
+            bytes += items[i].bytes;
+            samples += items[i].samples;
+        }
+    }
+    if (seconds <= 0) {
+        seconds = 1e-9;
+    }
+    fprintf(stderr, "Converted %d of %d files, %.1f MB in %.3f s "
+            "(%.1f MB/s, %.0f samples/s)\n", count - failed, count, 
+            bytes / 1e6, seconds, bytes / 1e6 / seconds, samples / seconds);
+
+    for (i = 0; i < options.jobs; i++) {
+        owon_arena_free(&arenas[i]);
+    }
+    free(arenas);
+    free(items);
+    return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int argc, char **argv) {
     // make copy because basename might modify path
     char *argv0 = strdup(argv[0]);
@@ -138,6 +678,8 @@ int main(int argc, char **argv) {
     options.format = "delim";
     options.delim = "\t";
     options.header = 1;
+    options.precision = OWON_DEFAULT_PRECISION;
+    options.jobs = 1;
 
     int opt = getopt_long(argc, argv, optstring, longopts, NULL);
     while (opt > -1) {
@@ -151,6 +693,46 @@ int main(int argc, char **argv) {
             case 'h':
                 options.header = 0;
                 break;
+            case 'p': {
+                char *end;
+                options.precision = strtol(optarg, &end, 10);
+                if (*end != '\0' || options.precision < 0 || 
+                        options.precision > OWON_MAX_PRECISION) {
+                    fprintf(stderr, "Invalid precision: %s\n", optarg);
+                    usage(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'j':
+                options.jobs = strtol(optarg, NULL, 10);
+                if (options.jobs < 1) {
+                    fprintf(stderr, "Invalid number of jobs: %s\n", optarg);
+                    usage(EXIT_FAILURE);
+                }
+                break;
+            case 'o':
+                options.outdir = optarg;
+                break;
+            case OPTION_MEASURE:
+                options.measure = 1;
+                break;
+            case OPTION_REFERENCE:
+                options.reference = optarg;
+                break;
+            case OPTION_DECIMATE:
+                options.decimate = strtol(optarg, NULL, 10);
+                if (options.decimate < 1) {
+                    fprintf(stderr, "Invalid decimation: %s\n", optarg);
+                    usage(EXIT_FAILURE);
+                }
+                break;
+            case OPTION_ENVELOPE:
+                options.envelope = strtol(optarg, NULL, 10);
+                if (options.envelope < 1) {
+                    fprintf(stderr, "Invalid envelope width: %s\n", optarg);
+                    usage(EXIT_FAILURE);
+                }
+                break;
             case OPTION_HELP:
                 usage(EXIT_SUCCESS);
             case OPTION_VERSION:
@@ -161,7 +743,43 @@ int main(int argc, char **argv) {
         opt = getopt_long(argc, argv, optstring, longopts, NULL);
     }
 
+    if (NULL == format_extension(options.format)) {
+        fprintf(stderr, "Unrecognized format.\n");
+        usage(EXIT_FAILURE);
+    }
+
+    if (0 != options.decimate && 0 != options.envelope) {
+        fprintf(stderr, 
+                "--decimate and --envelope can't be used together.\n");
+        usage(EXIT_FAILURE);
+    }
+
+    if (image_format(options.format) && (0 != options.decimate || 
+                0 != options.envelope || options.measure)) {
+        fprintf(stderr, "--decimate, --envelope and --measure can't be "
+                "used with screen captures.\n");
+        usage(EXIT_FAILURE);
+    }
+
+    if (NULL != options.reference && (NULL != options.outdir || 
+                image_format(options.format))) {
+        fprintf(stderr, "--reference can't be used with -o or screen "
+                "captures.\n");
+        usage(EXIT_FAILURE);
+    }
+
     int fargc = argc - optind;
+
+    if (NULL != options.outdir) {
+        if (fargc < 1) {
+            fprintf(stderr, "FILE arguments are required.\n");
+            usage(EXIT_FAILURE);
+        }
+        int status = convert_batch(argv + optind, fargc);
+        owon_fft_cleanup();
+        free(invocation_name);
+        return status;
+    }
     
     if (fargc < 2) {
         fprintf(stderr, "FILEIN and FILEOUT are required.\n");
@@ -186,45 +804,50 @@ int main(int argc, char **argv) {
         fileout = argv[optind + 1];
     }
 
-    FILE *finp;
-    if (NULL == filein) {
-        finp = stdin;
-    } else {
-        finp = fopen(filein, "rb");
-        if (NULL == finp) {
-            fprintf(stderr, "Unable to open %s\n", filein);
-            exit(EXIT_FAILURE);
+    // Raw sample formats from standard input are converted as they are 
+    // read, so a pipe from owondump needs no more memory for a large 
+    // capture than for a small one.
+    int streaming = (NULL == filein && NULL == options.reference &&
+            0 == options.decimate && 0 == options.envelope && 
+            !options.measure &&
+            (0 == strcmp(options.format, "f32") || 
+             0 == strcmp(options.format, "i16")));
+
+    int image = image_format(options.format);
+    struct owon_capture capture;
+    FILE *finp = stdin;
+    int ret = OWON_SUCCESS;
+    if (image) {
+        // Read while writing, below.
+        if (NULL != filein && NULL == (finp = fopen(filein, "rb"))) {
+            ret = OWON_ERROR_OPEN;
+        }
+    } else if (streaming) {
+        // Parsed while writing, below.
+    } else if (NULL != options.reference) {
+        if (NULL != filein && NULL == (finp = fopen(filein, "rb"))) {
+            ret = OWON_ERROR_OPEN;
+        } else {
+            ret = rebuild_delta(&capture, finp);
+            if (stdin != finp) {
+                fclose(finp);
+            }
         }
+    } else if (NULL == filein) {
+        // Standard input may be a pipe, which can't be mapped.
+        ret = owon_parse(&capture, stdin);
+    } else {
+        ret = open_input(&capture, filein, NULL);
     }
-    
-    struct owon_capture capture;
-    int ret = owon_parse(&capture, finp);
     if (ret != OWON_SUCCESS) {
-        switch (ret) {
-            case OWON_ERROR_UNSUPPORTED:
-                fprintf(stderr, "The osocilloscope model or feature is not "
-                                "currently supported.\n");
-                exit(EXIT_FAILURE);
-            case OWON_ERROR_MEMORY:
-                fprintf(stderr, "Unable to allocate adquate memory.\n");
-                exit(EXIT_FAILURE);
-            case OWON_ERROR_READ:
-                fprintf(stderr, "A read error occured.\n");
-                exit(EXIT_FAILURE);
-            case OWON_ERROR_HEADER:
-                fprintf(stderr, "This file is not in the correct format.\n");
-                exit(EXIT_FAILURE);
-            default:
-                fprintf(stderr, "An unknown error occurred.\n");
-                exit(EXIT_FAILURE);
+        if (OWON_ERROR_OPEN == ret) {
+            fprintf(stderr, "Unable to open %s\n", filein);
+        } else {
+            fprintf(stderr, "%s\n", error_message(ret));
         }
+        exit(EXIT_FAILURE);
     }
     
-    // Only close if actual file (not stdin)
-    if (NULL == filein) {
-        fclose(finp);
-    }
-
     FILE *foutp;
     if (NULL == fileout) {
         foutp = stdout;
@@ -236,22 +859,41 @@ int main(int argc, char **argv) {
         }
     }
    
-    if (0 == strcmp(options.format, "delim")) {
-        owon_write_delim(&capture, options.delim, "\n", 
-                options.header, foutp);
+    if (image) {
+        ret = convert_image(finp, foutp, options.jobs);
+        if (OWON_SUCCESS != ret && !ferror(foutp)) {
+            fprintf(stderr, "%s\n", error_message(ret));
+        }
+        if (stdin != finp) {
+            fclose(finp);
+        }
+    } else if (streaming) {
+        ret = stream_capture(stdin, foutp);
+        if (OWON_SUCCESS != ret && !ferror(foutp)) {
+            fprintf(stderr, "%s\n", error_message(ret));
+        }
     } else {
-        fprintf(stderr, "Unrecognized format.\n");
-        usage(EXIT_FAILURE);
+        ret = write_capture(&capture, foutp);
+        if (OWON_SUCCESS != ret && !ferror(foutp)) {
+            fprintf(stderr, "%s\n", error_message(ret));
+        }
+        owon_free_capture(&capture);
     }
 
-    // Only close if actual file (not stdout)
-    if (NULL == fileout) {
-        fclose(foutp);
+    // Only close if actual file (not stdout); either way, output still 
+    // buffered may fail to be written.
+    int write_error = ferror(foutp);
+    if (0 != ((NULL != fileout) ? fclose(foutp) : fflush(foutp))) {
+        write_error = 1;
+    }
+    if (write_error) {
+        fprintf(stderr, "Unable to write %s\n", 
+                (NULL != fileout) ? fileout : "standard output");
+        ret = OWON_ERROR;
     }
     
-    owon_free_capture(&capture);
-    
+    owon_fft_cleanup();
     free(invocation_name);
 
-    return EXIT_SUCCESS;
+    return (OWON_SUCCESS == ret) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,505 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include "owon.h"
+#include "parse.h"
+#include "archive.h"
+#include "search.h"
+#include "pool.h"
+
+#define __(x) #x
+#define PROGRAM __(owonsearch)
+#define PACKAGE __(owon-utils)
+#define VERSION __(0.1)
+#define AUTHORS __(Lana Larsen)
+
+// Exit statuses, as grep(1).
+#define EXIT_MATCH 0
+#define EXIT_NO_MATCH 1
+#define EXIT_TROUBLE 2
+
+static char *invocation_name;
+
+struct {
+    char *delim;
+    int header;
+    int files_only;
+    int max_count;
+    int jobs;
+    struct owon_predicate *predicates;
+    int predicate_count;
+} options;
+
+// One capture to search: a file, or an entry of an archive.
+struct search_item {
+    const char *path;
+    int index;          // Entry in the archive at `path`, or -1 for a file.
+    int status;
+    int matches;
+    int done;
+    char *output;       // Lines printed for the capture.
+    size_t output_length;
+};
+
+// State kept by each worker thread.
+struct search_worker {
+    struct owon_arena arena;
+    const char *archive_path;   // Archive held open in `archive`, or NULL.
+    struct owon_archive archive;
+};
+
+struct search {
+    struct search_item *items;
+    int count;
+    struct search_worker *workers;
+    pthread_mutex_t lock;
+    int next;           // First item not printed yet.
+    int matched;
+    int failed;
+};
+
+// Where the events of one capture are written.
+struct search_output {
+    FILE *fp;
+    const char *path;
+    int index;
+    int matches;
+};
+
+/* For long options that have no equivalent short option, use a
+   non-character as a pseudo short option, starting with CHAR_MAX + 1.  */
+enum {
+    OPTION_HELP = CHAR_MAX + 1,
+    OPTION_VERSION,
+    OPTION_ABOVE,
+    OPTION_BELOW,
+    OPTION_RISING,
+    OPTION_FALLING,
+    OPTION_HIGH_PULSE,
+    OPTION_LOW_PULSE
+};
+
+static const char *optstring = "d:hlm:j:";
+static const struct option longopts[] = {
+    {"delimiter", required_argument, NULL, 'd'},
+    {"noheader", no_argument, NULL, 'h'},
+    {"files-with-matches", no_argument, NULL, 'l'},
+    {"max-count", required_argument, NULL, 'm'},
+    {"jobs", required_argument, NULL, 'j'},
+    {"above", required_argument, NULL, OPTION_ABOVE},
+    {"below", required_argument, NULL, OPTION_BELOW},
+    {"rising", required_argument, NULL, OPTION_RISING},
+    {"falling", required_argument, NULL, OPTION_FALLING},
+    {"high-pulse", required_argument, NULL, OPTION_HIGH_PULSE},
+    {"low-pulse", required_argument, NULL, OPTION_LOW_PULSE},
+    {"help", no_argument, NULL, OPTION_HELP},
+    {"version", no_argument, NULL, OPTION_VERSION},
+    {NULL, no_argument, NULL, 0}
+};
+
+void usage(int status) {
+    if (status != EXIT_SUCCESS) {
+        fprintf(stderr, "Try `%s --help' for more information\n", 
+                invocation_name);
+    } else {
+        printf("Usage: %s [OPTION]... CONDITION... FILE...\n", 
+                invocation_name);
+        fputs(
+"Search captures created by owondump, or archives of them made with\n"
+"owonarchive, for events on their channels. For each event print the\n"
+"capture, channel, condition, level in mV, offset of the first sample, and\n"
+"the time (us) and width (us) that offset and the event's samples stand\n"
+"for. Captures in an archive are named ARCHIVE:INDEX.\n"
+"\n"
+"Conditions, each of which may be given more than once; an event for any\n"
+"of them is reported. CH is a channel name such as CH1, MV a level in mV\n"
+"and US a width in us. A sample is high if it is at or above MV.\n"
+"  --above=CH,MV         each run of high samples\n"
+"  --below=CH,MV         each run of low samples\n"
+"  --rising=CH,MV        each run of high samples after a low one\n"
+"  --falling=CH,MV       each run of low samples after a high one\n"
+"  --high-pulse=CH,MV,US each run of high samples between low ones that is\n"
+"                        narrower than US\n"
+"  --low-pulse=CH,MV,US  each run of low samples between high ones that is\n"
+"                        narrower than US\n"
+"\n"
+"  -d, --delimiter=DELIM use DELIM between fields (default is \\t)\n"
+"  -h, --noheader        do not print a header line\n"
+"  -l, --files-with-matches\n"
+"                        only print the name of each capture with an event\n"
+"  -m, --max-count=N     stop searching a capture after N events\n"
+"  -j, --jobs=N          search N captures at a time (default 1)\n"
+"  --help                display this help and exit\n"
+"  --version             output version information and exit\n"
+"\n"
+"Exit status is 0 if an event was found, 1 if none was, and 2 if a FILE\n"
+"could not be searched.\n"
+, stdout);
+    }
+    exit(status);
+}
+
+void version() {
+    printf("%s (%s) %s\n", PROGRAM, PACKAGE, VERSION);
+    fputs(
+"License GPLv3+: GNU GPL version 3 or later "
+"<http://gnu.org/licenses/gpl.html>.\n"
+"This is free software: you are free to change and redistribute it.\n"
+"There is NO WARRANTY, to the extent permitted by law.\n"
+"\n"
+, stdout);
+    printf("Written by %s\n", AUTHORS);
+    exit(EXIT_SUCCESS);
+}
+
+/* Describe an error returned while opening or parsing a capture. */
+const char *error_message(int ret) {
+    switch (ret) {
+        case OWON_ERROR_OPEN:
+            return "Unable to open file.";
+        case OWON_ERROR_UNSUPPORTED:
+            return "The osocilloscope model or feature is not currently "
+                "supported.";
+        case OWON_ERROR_MEMORY:
+            return "Unable to allocate adquate memory.";
+        case OWON_ERROR_READ:
+            return "A read error occured.";
+        case OWON_ERROR_HEADER:
+            return "This file is not in the correct format.";
+        case OWON_ERROR_BITMAP:
+            return "This file is a screen capture, not a waveform.";
+        default:
+            return "An unknown error occurred.";
+    }
+}
+
+/* Add the condition in `arg` to options.predicates. */
+void add_predicate(enum owon_event_kind kind, const char *arg) {
+    int pulse = OWON_EVENT_HIGH_PULSE == kind || 
+        OWON_EVENT_LOW_PULSE == kind;
+    struct owon_predicate predicate;
+    memset(&predicate, 0, sizeof(predicate));
+    predicate.kind = kind;
+    char extra;
+    int fields = sscanf(arg, "%3[^,],%f,%f%c", predicate.channel, 
+            &predicate.level, &predicate.width, &extra);
+    if (fields != (pulse ? 3 : 2) || (pulse && !(predicate.width > 0))) {
+        fprintf(stderr, "Invalid condition for --%s: %s\n", 
+                owon_event_name(kind), arg);
+        usage(EXIT_TROUBLE);
+    }
+    struct owon_predicate *predicates = realloc(options.predicates, 
+            (options.predicate_count + 1) * sizeof(*predicates));
+    if (NULL == predicates) {
+        fprintf(stderr, "%s\n", error_message(OWON_ERROR_MEMORY));
+        exit(EXIT_TROUBLE);
+    }
+    predicates[options.predicate_count++] = predicate;
+    options.predicates = predicates;
+}
+
+/* Search callback: print one event. */
+int print_event(const struct owon_predicate *predicate, 
+        const struct owon_channel *channel, int offset, int count, 
+        void *user_data) {
+    struct search_output *out = user_data;
+    out->matches++;
+    if (options.files_only) {
+        return 1;
+    }
+    char *d = options.delim;
+    fputs(out->path, out->fp);
+    if (out->index >= 0) {
+        fprintf(out->fp, ":%d", out->index);
+    }
+    fprintf(out->fp, "%s%s%s%s%s%g%s%d%s%g%s%g\n", d, channel->name, d, 
+            owon_event_name(predicate->kind), d, predicate->level, d, 
+            offset, d, offset * channel->time_mul, d, 
+            count * channel->time_mul);
+    return options.max_count > 0 && out->matches >= options.max_count;
+}
+
+/* Parse `item` into the arena of `worker` and search it, writing the 
+ * events to `fp`. */
+int search_item(struct search_worker *worker, struct search_item *item, 
+        FILE *fp) {
+    struct owon_capture capture;
+    char *data = NULL;
+    int ret;
+    if (item->index < 0) {
+        ret = owon_parse_file_arena(&capture, item->path, &worker->arena);
+    } else {
+        // Keep the last archive open, as its captures usually come to the 
+        // same worker one after another.
+        if (worker->archive_path != item->path) {
+            if (NULL != worker->archive_path) {
+                owon_archive_close(&worker->archive);
+                worker->archive_path = NULL;
+            }
+            ret = owon_archive_open(&worker->archive, item->path, 0);
+            if (OWON_SUCCESS != ret) {
+                return ret;
+            }
+            worker->archive_path = item->path;
+        }
+        size_t length;
+        ret = owon_archive_read(&worker->archive, item->index, &data, 
+                &length);
+        if (OWON_SUCCESS == ret) {
+            // The capture may use `data` for its samples.
+            ret = owon_parse_buffer_arena(&capture, data, length, 
+                    &worker->arena);
+        }
+    }
+    if (OWON_SUCCESS != ret) {
+        free(data);
+        return ret;
+    }
+    struct search_output out = {fp, item->path, item->index, 0};
+    owon_search(&capture, options.predicates, options.predicate_count, 
+            print_event, &out);
+    if (options.files_only && out.matches > 0) {
+        fputs(item->path, fp);
+        if (item->index >= 0) {
+            fprintf(fp, ":%d", item->index);
+        }
+        fputc('\n', fp);
+    }
+    item->matches = out.matches;
+    owon_free_capture(&capture);
+    free(data);
+    return OWON_SUCCESS;
+}
+
+/* Print the output of finished items, in the order they were given, and
+ * release it. Called with the lock held. */
+void print_finished(struct search *search) {
+    while (search->next < search->count && 
+            search->items[search->next].done) {
+        struct search_item *item = &search->items[search->next++];
+        if (OWON_SUCCESS != item->status) {
+            fflush(stdout);
+            if (item->index < 0) {
+                fprintf(stderr, "%s: %s\n", item->path, 
+                        error_message(item->status));
+            } else {
+                fprintf(stderr, "%s:%d: %s\n", item->path, item->index, 
+                        error_message(item->status));
+            }
+            search->failed++;
+        } else {
+            fwrite(item->output, 1, item->output_length, stdout);
+            if (item->matches > 0) {
+                search->matched++;
+            }
+        }
+        free(item->output);
+        item->output = NULL;
+    }
+}
+
+/* Pool work function: search one capture. Each worker parses into an 
+ * arena of its own, and the events are held until the captures before it
+ * have been printed. */
+void search_work(int worker, int index, void *user_data) {
+    struct search *search = user_data;
+    struct search_item *item = &search->items[index];
+    FILE *fp = open_memstream(&item->output, &item->output_length);
+    if (NULL == fp) {
+        item->status = OWON_ERROR_MEMORY;
+    } else {
+        item->status = search_item(&search->workers[worker], item, fp);
+        if (0 != fclose(fp) && OWON_SUCCESS == item->status) {
+            item->status = OWON_ERROR_MEMORY;
+        }
+    }
+    pthread_mutex_lock(&search->lock);
+    item->done = 1;
+    print_finished(search);
+    pthread_mutex_unlock(&search->lock);
+}
+
+/* Add `path` to the captures to search: every capture in it if it is an 
+ * archive, otherwise the file itself. */
+int add_items(struct search *search, int *capacity, const char *path) {
+    struct owon_archive archive;
+    int entries = 1;
+    int ret = owon_archive_open(&archive, path, 0);
+    if (OWON_SUCCESS == ret) {
+        entries = archive.count;
+        owon_archive_close(&archive);
+    } else if (OWON_ERROR_HEADER != ret) {
+        return ret;
+    }
+    if (search->count + entries > *capacity) {
+        int size = *capacity * 2;
+        if (size < search->count + entries) {
+            size = search->count + entries;
+        }
+        struct search_item *items = realloc(search->items, 
+                size * sizeof(*items));
+        if (NULL == items) {
+            return OWON_ERROR_MEMORY;
+        }
+        search->items = items;
+        *capacity = size;
+    }
+    int i;
+    for (i = 0; i < entries; i++) {
+        struct search_item *item = &search->items[search->count++];
+        memset(item, 0, sizeof(*item));
+        item->path = path;
+        item->index = (OWON_SUCCESS == ret) ? i : -1;
+    }
+    return OWON_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    // make copy because basename might modify path
+    char *argv0 = strdup(argv[0]);
+    // make copy because basename might reuse pointer
+    invocation_name = strdup(basename(argv0));
+    free(argv0);
+
+    // default options
+    options.delim = "\t";
+    options.header = 1;
+    options.jobs = 1;
+
+    int opt = getopt_long(argc, argv, optstring, longopts, NULL);
+    while (opt > -1) {
+        switch (opt) {
+            case 'd':
+                options.delim = optarg;
+                break;
+            case 'h':
+                options.header = 0;
+                break;
+            case 'l':
+                options.files_only = 1;
+                break;
+            case 'm':
+                options.max_count = strtol(optarg, NULL, 10);
+                if (options.max_count < 1) {
+                    fprintf(stderr, "Invalid count: %s\n", optarg);
+                    usage(EXIT_TROUBLE);
+                }
+                break;
+            case 'j':
+                options.jobs = strtol(optarg, NULL, 10);
+                if (options.jobs < 1) {
+                    fprintf(stderr, "Invalid number of jobs: %s\n", optarg);
+                    usage(EXIT_TROUBLE);
+                }
+                break;
+            case OPTION_ABOVE:
+                add_predicate(OWON_EVENT_ABOVE, optarg);
+                break;
+            case OPTION_BELOW:
+                add_predicate(OWON_EVENT_BELOW, optarg);
+                break;
+            case OPTION_RISING:
+                add_predicate(OWON_EVENT_RISING, optarg);
+                break;
+            case OPTION_FALLING:
+                add_predicate(OWON_EVENT_FALLING, optarg);
+                break;
+            case OPTION_HIGH_PULSE:
+                add_predicate(OWON_EVENT_HIGH_PULSE, optarg);
+                break;
+            case OPTION_LOW_PULSE:
+                add_predicate(OWON_EVENT_LOW_PULSE, optarg);
+                break;
+            case OPTION_HELP:
+                usage(EXIT_SUCCESS);
+            case OPTION_VERSION:
+                version();
+            default:
+                usage(EXIT_TROUBLE);
+        }
+        opt = getopt_long(argc, argv, optstring, longopts, NULL);
+    }
+
+    if (0 == options.predicate_count) {
+        fprintf(stderr, "No condition given\n");
+        usage(EXIT_TROUBLE);
+    }
+    if (optind >= argc) {
+        usage(EXIT_TROUBLE);
+    }
+
+    struct search search;
+    memset(&search, 0, sizeof(search));
+    int capacity = 0;
+    int trouble = 0;
+    int i;
+    for (i = optind; i < argc; i++) {
+        int ret = add_items(&search, &capacity, argv[i]);
+        if (OWON_SUCCESS != ret) {
+            fprintf(stderr, "%s: %s\n", argv[i], error_message(ret));
+            trouble = 1;
+        }
+    }
+
+    search.workers = calloc(options.jobs, sizeof(*search.workers));
+    if (NULL == search.workers) {
+        fprintf(stderr, "%s\n", error_message(OWON_ERROR_MEMORY));
+        free(search.items);
+        return EXIT_TROUBLE;
+    }
+    for (i = 0; i < options.jobs; i++) {
+        owon_arena_init(&search.workers[i].arena);
+    }
+    pthread_mutex_init(&search.lock, NULL);
+
+    if (options.header && !options.files_only && search.count > 0) {
+        char *d = options.delim;
+        printf("Capture%sChannel%sEvent%sLevel (mV)%sOffset%sTime (us)%s"
+                "Width (us)\n", d, d, d, d, d, d);
+    }
+    if (OWON_SUCCESS != owon_pool_run(options.jobs, search.count, 
+                search_work, &search)) {
+        // Nothing was searched.
+        fprintf(stderr, "%s\n", error_message(OWON_ERROR_MEMORY));
+        search.failed++;
+    }
+
+    for (i = 0; i < options.jobs; i++) {
+        owon_arena_free(&search.workers[i].arena);
+        if (NULL != search.workers[i].archive_path) {
+            owon_archive_close(&search.workers[i].archive);
+        }
+    }
+    pthread_mutex_destroy(&search.lock);
+    free(search.workers);
+    free(search.items);
+    free(options.predicates);
+    free(invocation_name);
+
+    if (trouble || search.failed > 0) {
+        return EXIT_TROUBLE;
+    }
+    return (search.matched > 0) ? EXIT_MATCH : EXIT_NO_MATCH;
+}
@@ -16,19 +16,31 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 
+// Windowed captures (owon_open_capture()) can be larger than 2 GB.
+#define _FILE_OFFSET_BITS 64
+
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 
 #include "owon.h"
 #include "parse.h"
+#include "convert.h"
+#include "models.h"
 
 
-//TODO: for tables, consider using functions to handle values out-of-bounds.
-float _attenuation_table[] = {1.0e0, 1.0e1, 1.0e2, 1.0e3};
+float _attenuation_table[OWON_ATTENUATION_TABLE_SIZE] = {1.0e0, 1.0e1, 1.0e2, 1.0e3};
 
-float _volt_table[] = {
+float _volt_table[OWON_VOLT_TABLE_SIZE] = {
             2.0e-3, 5.0e-3, // 1 mV
     1.0e-2, 2.0e-2, 5.0e-2, // 10 mV
     1.0e-1, 2.0e-1, 5.0e-1, // 100 mV
@@ -40,7 +52,7 @@ float _volt_table[] = {
 };
 
 // 1, 2, 5 step
-float _time_table_10_20_50[] = {
+float _time_table_10_20_50[OWON_TIME_TABLE_SIZE] = {
     1.0e-9, 2.0e-9, 5.0e-9, // 1 ns
     1.0e-8, 2.0e-8, 5.0e-8, // 10 ns
     1.0e-7, 2.0e-7, 5.0e-7, // 100 ns
@@ -56,7 +68,7 @@ float _time_table_10_20_50[] = {
 };
 
 // 1, 2.5, 5 step
-float _time_table_10_25_50[] = {
+float _time_table_10_25_50[OWON_TIME_TABLE_SIZE] = {
     1.0e-9, 2.5e-9, 5.0e-9, // 1 ns
     1.0e-8, 2.5e-8, 5.0e-8, // 10 ns
     1.0e-7, 2.5e-7, 5.0e-7, // 100 ns
@@ -71,11 +83,56 @@ float _time_table_10_25_50[] = {
     1.0e+2, 2.5e+2, 5.0e+2  // 100 s
 };
 
-float *_time_table_10_20_50__1 = &_time_table_10_20_50[0]; // start at 1ns
-float *_time_table_10_20_50__2 = &_time_table_10_20_50[1]; // start at 2ns
-float *_time_table_10_20_50__5 = &_time_table_10_20_50[2]; // start at 5ns
-float *_time_table_10_25_50__5 = &_time_table_10_25_50[2]; // start at 5ns
+// Headers missing from doc/models.tab are read by the 4th character of an 
+// `SPB` header, SPBxyz, where `x` is the character representing the model 
+// type. These models may use the whole time table from where it starts.
+#define FALLBACK_MODEL(c, table, first) \
+    {{'S', 'P', 'B', c}, "", 0, \
+        table + first, OWON_TIME_TABLE_SIZE - first, \
+        _volt_table, OWON_VOLT_TABLE_SIZE, \
+        _attenuation_table, OWON_ATTENUATION_TABLE_SIZE}
+
+static const struct owon_model fallback_models[] = {
+    FALLBACK_MODEL('M', _time_table_10_20_50, 0), // start at 1ns
+    FALLBACK_MODEL('N', _time_table_10_20_50, 1), // start at 2ns
+    FALLBACK_MODEL('O', _time_table_10_20_50, 2), // start at 5ns
+    FALLBACK_MODEL('P', _time_table_10_20_50, 2),
+    FALLBACK_MODEL('Q', _time_table_10_20_50, 2),
+    FALLBACK_MODEL('R', _time_table_10_20_50, 2),
+    FALLBACK_MODEL('S', _time_table_10_20_50, 2),
+    FALLBACK_MODEL('T', _time_table_10_20_50, 2),
+    FALLBACK_MODEL('U', _time_table_10_20_50, 2),
+    FALLBACK_MODEL('V', _time_table_10_25_50, 2),
+    FALLBACK_MODEL('W', _time_table_10_20_50, 2),
+    FALLBACK_MODEL('X', _time_table_10_20_50, 2)
+};
+
+static const struct owon_model *fallback_model(const char c) {
+    if (c < 'M' || c > 'X') {
+        return NULL;
+    }
+    return &fallback_models[c - 'M'];
+}
+
+// Find the model writing files with the 6 character `header`: its entry 
+// in the table generated from doc/models.tab, or failing that the tables 
+// for its model character. Returns NULL if the file is not supported.
+// TODO: add support for SPCX01 (special type)
+const struct owon_model *owon_find_model(const char *header) {
+    int i;
+    for (i = 0; i < owon_model_count; i++) {
+        if (0 == memcmp(owon_models[i].header, header, 
+                    sizeof(owon_models[i].header))) {
+            return &owon_models[i];
+        }
+    }
+    if (0 != strncmp("SPB", header, 3)) {
+        return NULL;
+    }
+    return fallback_model(header[3]);
+}
 
+// The tables for a model character, as used before owon_find_model().
 float *get_attenuation_table(const char c) {
     // only one version across all models
     return _attenuation_table;
@@ -86,131 +143,1095 @@ float *get_volt_table(const char c) {
     return _volt_table;
 }
 
-// The table used is dependent on the type of model, which is indicated by 
-// the 4th character in the file header. Example: SPBxyz, where `x` is the 
-// character representing the model type.
-// TODO: add support for SPCX01 (special type)
 float *get_time_table(const char c) {
-    switch(c) {
-        case 'N': return _time_table_10_20_50__2;
-        case 'M': return _time_table_10_20_50__1;
-        case 'O': return _time_table_10_20_50__5;
-        case 'P': return _time_table_10_20_50__5;
-        case 'Q': return _time_table_10_20_50__5;
-        case 'R': return _time_table_10_20_50__5;
-        case 'S': return _time_table_10_20_50__5;
-        case 'T': return _time_table_10_20_50__5;
-        case 'U': return _time_table_10_20_50__5;
-        case 'V': return _time_table_10_25_50__5;
-        case 'W': return _time_table_10_20_50__5;
-        case 'X': return _time_table_10_20_50__5;
-        default: return NULL;
+    const struct owon_model *model = fallback_model(c);
+    if (NULL == model) {
+        return NULL;
+    }
+    return (float *)model->time_table;
+}
+
+// Copy a raw channel header out of `data`, which must hold at least
+// OWON_CHANNEL_HEADER_SIZE bytes. The fields are not aligned in the file.
+static void decode_channel_header(struct owon_channel_header *chan_header, 
+        const char *data) {
+    memcpy(&chan_header->name, data, sizeof(chan_header->name));
+    data += sizeof(chan_header->name);
+    memcpy(&chan_header->length, data, sizeof(int));
+    data += sizeof(int);
+    memcpy(&chan_header->sample_count, data, sizeof(int));
+    data += sizeof(int);
+    memcpy(&chan_header->sample_screen, data, sizeof(int));
+    data += sizeof(int);
+    memcpy(&chan_header->slow_scan_pos, data, sizeof(int));
+    data += sizeof(int);
+    memcpy(&chan_header->time_div, data, sizeof(int));
+    data += sizeof(int);
+    memcpy(&chan_header->zero_point, data, sizeof(int));
+    data += sizeof(int);
+    memcpy(&chan_header->volts_div, data, sizeof(int));
+    data += sizeof(int);
+    memcpy(&chan_header->attenuation, data, sizeof(int));
+    data += sizeof(int);
+    memcpy(&chan_header->time_mul, data, sizeof(float));
+    data += sizeof(float);
+    memcpy(&chan_header->frequency, data, sizeof(float));
+    data += sizeof(float);
+    memcpy(&chan_header->period, data, sizeof(float));
+    data += sizeof(float);
+    memcpy(&chan_header->volts_mul, data, sizeof(float));
+}
+
+// Tell what a channel holds from its name (not null-terminated).
+enum owon_channel_kind owon_get_channel_kind(const char *name) {
+    if ('C' == name[0] && 'H' == name[1]) {
+        if (name[2] >= '1' && name[2] <= '9') {
+            return OWON_CHANNEL_WAVE;
+        }
+        if (name[2] >= 'A' && name[2] <= 'D') {
+            return OWON_CHANNEL_REFERENCE;
+        }
+    } else if ('C' == name[0] && 'f' == name[1]) {
+        return OWON_CHANNEL_FFT;
+    }
+    return OWON_CHANNEL_UNKNOWN;
+}
+
+// Look up entry `index` of a scale table with `count` entries. Out of 
+// range is NaN, so a bad scale shows up rather than being read from past 
+// the table.
+static float scale(const float *table, int count, int index) {
+    if ((unsigned)index >= (unsigned)count) {
+        return NAN;
+    }
+    return table[index];
+}
+
+// Fill in everything but the samples of `channel` from the raw header. 
+// Scale indices a model does not have are refused for live channels; the 
+// scales of saved and math channels are less well known, so for those 
+// they are just NaN.
+static int fill_channel(struct owon_channel *channel, 
+        const struct owon_channel_header *chan_header, 
+        const struct owon_model *model) {
+    enum owon_channel_kind kind = owon_get_channel_kind(chan_header->name);
+    if (OWON_CHANNEL_WAVE == kind && (
+            (unsigned)chan_header->attenuation >= 
+            (unsigned)model->attenuation_count || 
+            (unsigned)chan_header->volts_div >= 
+            (unsigned)model->volt_count || 
+            (unsigned)chan_header->time_div >= 
+            (unsigned)model->time_count)) {
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    memcpy(&channel->name, chan_header->name, sizeof(chan_header->name));
+    channel->kind = kind;
+    channel->attenuation = scale(model->attenuation_table, 
+            model->attenuation_count, chan_header->attenuation);
+    channel->volts_mul = chan_header->volts_mul;
+    channel->volts_div = scale(model->volt_table, model->volt_count, 
+            chan_header->volts_div);
+    channel->time_mul = chan_header->time_mul;
+    channel->time_div = scale(model->time_table, model->time_count, 
+            chan_header->time_div);
+    channel->frequency = chan_header->frequency;
+    channel->period = chan_header->period;
+    channel->sample_count = chan_header->sample_count;
+    // The FFT channel keeps the sample interval of the wave it was taken 
+    // from, and its points run from 0 Hz up to half the sample rate.
+    if (OWON_CHANNEL_FFT == kind && channel->time_mul > 0 && 
+            channel->sample_count > 0) {
+        channel->frequency_mul = 1e6f / 
+            (2.0f * channel->time_mul * channel->sample_count);
+    }
+    return OWON_SUCCESS;
+}
+
+// Check the file header string and find the tables for it.
+static int check_header(const char *header, const struct owon_model **model) {
+    *model = owon_find_model(header);
+    if (NULL != *model) {
+        return OWON_SUCCESS;
+    }
+    // An `SPB` header is a capture, just from a model without tables.
+    if (0 == strncmp("SPB", header, 3)) {
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    // Screen captures are bitmaps; see owon_decode_bitmap().
+    if (0 == strncmp("BM", header, 2)) {
+        return OWON_ERROR_BITMAP;
+    }
+    return OWON_ERROR_HEADER;
+}
+
+// Alignment of each block handed out by an arena; enough for SIMD loads of
+// the samples.
+#define ARENA_ALIGN 32
+
+void owon_arena_init(struct owon_arena *arena) {
+    memset(arena, 0, sizeof(*arena));
+}
+
+// Forget everything allocated from `arena`, keeping its memory for the 
+// next capture.
+void owon_arena_reset(struct owon_arena *arena) {
+    arena->used = 0;
+}
+
+void owon_arena_free(struct owon_arena *arena) {
+    free(arena->data);
+    owon_arena_init(arena);
+}
+
+// Start a capture in `arena`, or in memory owned by the capture when 
+// `arena` is NULL.
+static void capture_begin(struct owon_capture *capture, 
+        struct owon_arena *arena) {
+    memset(capture, 0, sizeof(*capture));
+    if (NULL == arena) {
+        arena = &capture->memory;
+    }
+    owon_arena_reset(arena);
+    capture->arena = arena;
+}
+
+// Give up on a capture after a parse error. Memory from a caller's arena is
+// left for the next parse.
+static void capture_abort(struct owon_capture *capture) {
+    free(capture->memory.data);
+    memset(capture, 0, sizeof(*capture));
+}
+
+// Allocate `size` bytes for `capture` from its arena. Only a capture whose
+// channels hold more samples than its header length allows makes the arena
+// grow; it may then move, so the channel table and the samples already 
+// copied into it are pointed at the new block. Channels without samples 
+// (see owon_open_capture()) keep their NULL.
+static void *capture_alloc(struct owon_capture *capture, size_t size) {
+    struct owon_arena *arena = capture->arena;
+    size_t start = (arena->used + ARENA_ALIGN - 1) & 
+        ~(size_t)(ARENA_ALIGN - 1);
+    if (start + size > arena->size) {
+        size_t *samples = NULL;
+        size_t table = 0;
+        int chan_idx;
+        if (NULL != capture->channels) {
+            samples = malloc((capture->channel_count + 1) * sizeof(size_t));
+            if (NULL == samples) {
+                return NULL;
+            }
+            table = (char *)capture->channels - arena->data;
+            for (chan_idx = 0; chan_idx < capture->channel_count; 
+                    chan_idx++) {
+                struct owon_channel *channel = &capture->channels[chan_idx];
+                // Windowed captures have no samples in memory.
+                if (!channel->borrowed && NULL != channel->samples) {
+                    samples[chan_idx] = 
+                        (char *)channel->samples - arena->data;
+                }
+            }
+        }
+
+        size_t new_size = 2 * arena->size;
+        if (new_size < start + size) {
+            new_size = start + size;
+        }
+        char *data = realloc(arena->data, new_size);
+        if (NULL == data) {
+            free(samples);
+            return NULL;
+        }
+        arena->data = data;
+        arena->size = new_size;
+
+        if (NULL != capture->channels) {
+            capture->channels = (struct owon_channel *)(data + table);
+            for (chan_idx = 0; chan_idx < capture->channel_count; 
+                    chan_idx++) {
+                struct owon_channel *channel = &capture->channels[chan_idx];
+                if (!channel->borrowed && NULL != channel->samples) {
+                    channel->samples = (short *)(data + samples[chan_idx]);
+                }
+            }
+        }
+        free(samples);
+    }
+    arena->used = start + size;
+    return arena->data + start;
+}
+
+// Set up a table for `channels` channels, reserving enough of the arena 
+// for `length` bytes of samples besides, so a well formed capture is one 
+// allocation.
+static int capture_channels(struct owon_capture *capture, size_t length, 
+        int channels) {
+    struct owon_arena *arena = capture->arena;
+    if (channels < 1) {
+        channels = 1;
+    }
+    size_t table = channels * sizeof(struct owon_channel);
+    size_t reserve = table + length + (channels + 1) * ARENA_ALIGN;
+    if (arena->size < reserve) {
+        char *data = realloc(arena->data, reserve);
+        if (NULL == data) {
+            return OWON_ERROR_MEMORY;
+        }
+        arena->data = data;
+        arena->size = reserve;
+    }
+    capture->channels = capture_alloc(capture, table);
+    memset(capture->channels, 0, table);
+    capture->channel_count = 0;
+    capture->channel_capacity = channels;
+    return OWON_SUCCESS;
+}
+
+// Return the next entry of the channel table, cleared, doubling the table 
+// when it is full. The old table is left in the arena.
+static struct owon_channel *capture_next_channel(
+        struct owon_capture *capture) {
+    if (capture->channel_count == capture->channel_capacity) {
+        int capacity = 2 * capture->channel_capacity;
+        struct owon_channel *channels = capture_alloc(capture, 
+                capacity * sizeof(struct owon_channel));
+        if (NULL == channels) {
+            return NULL;
+        }
+        memcpy(channels, capture->channels, 
+                capture->channel_count * sizeof(struct owon_channel));
+        capture->channels = channels;
+        capture->channel_capacity = capacity;
+    }
+    struct owon_channel *channel = &capture->channels[capture->channel_count];
+    memset(channel, 0, sizeof(*channel));
+    return channel;
+}
+
+// Count the channels of a capture held in memory, so its table can be made
+// the right size, and the bytes of samples that are misaligned and so will
+// be copied. Damaged files are left for the parse itself to report.
+static int count_channels(const char *bytes, size_t length, 
+        long file_length, size_t *copied) {
+    size_t offset = OWON_FILE_HEADER_SIZE;
+    int count = 0;
+    *copied = 0;
+    while (offset < (size_t)file_length && 
+            length - offset >= OWON_CHANNEL_HEADER_SIZE) {
+        struct owon_channel_header chan_header;
+        decode_channel_header(&chan_header, bytes + offset);
+        offset += OWON_CHANNEL_HEADER_SIZE;
+        if (chan_header.sample_count < 0 || (length - offset) / 
+                sizeof(short) < (size_t)chan_header.sample_count) {
+            break;
+        }
+        if (0 != (uintptr_t)(bytes + offset) % sizeof(short)) {
+            *copied += chan_header.sample_count * sizeof(short);
+        }
+        offset += chan_header.sample_count * sizeof(short);
+        count++;
+    }
+    return count;
+}
+
+void owon_parser_init(struct owon_parser *parser, 
+        const struct owon_parser_callbacks *callbacks, void *user_data) {
+    memset(parser, 0, sizeof(*parser));
+    parser->callbacks = callbacks;
+    parser->user_data = user_data;
+    parser->state = OWON_PARSER_FILE_HEADER;
+}
+
+// Stop parsing with `ret` as the result of every later call.
+static int parser_fail(struct owon_parser *parser, int ret) {
+    parser->state = OWON_PARSER_ERROR;
+    parser->status = ret;
+    return ret;
+}
+
+// After a header or a channel, decide whether another channel follows. The
+// length in the file header is where the channel data ends; anything after
+// it is ignored.
+static void parser_next(struct owon_parser *parser) {
+    if (parser->offset < parser->length) {
+        parser->state = OWON_PARSER_CHANNEL_HEADER;
+    } else {
+        parser->state = OWON_PARSER_DONE;
+    }
+    parser->pending = 0;
+}
+
+// Hand the complete samples in the staging buffer to the callback. An odd 
+// trailing byte is kept for the next call.
+static int parser_emit(struct owon_parser *parser) {
+    int count = parser->staged / sizeof(short);
+    if (0 < count && NULL != parser->callbacks->samples) {
+        int ret = parser->callbacks->samples(&parser->channel, parser->stage,
+                parser->sample_offset, count, parser->user_data);
+        if (OWON_SUCCESS != ret) {
+            return parser_fail(parser, ret);
+        }
     }
+    parser->sample_offset += count;
+    if (parser->staged % sizeof(short)) {
+        char *stage = (char *)parser->stage;
+        stage[0] = stage[parser->staged - 1];
+        parser->staged = 1;
+    } else {
+        parser->staged = 0;
+    }
+    return OWON_SUCCESS;
+}
+
+static int parser_file_header(struct owon_parser *parser) {
+    struct owon_header file_header;
+    memcpy(&file_header.header, parser->header, sizeof(file_header.header));
+    memcpy(&file_header.length, parser->header + sizeof(file_header.header), 
+            sizeof(int));
+
+    int ret = check_header(file_header.header, &parser->model);
+    if (OWON_SUCCESS != ret) {
+        return parser_fail(parser, ret);
+    }
+
+    // Custom models are indicated a negative length
+    if (file_header.length < 0) {
+        return parser_fail(parser, OWON_ERROR_UNSUPPORTED);
+    }
+    parser->length = file_header.length;
+
+    if (NULL != parser->callbacks->header) {
+        ret = parser->callbacks->header(file_header.header, 
+                file_header.length, parser->user_data);
+        if (OWON_SUCCESS != ret) {
+            return parser_fail(parser, ret);
+        }
+    }
+    parser_next(parser);
+    return OWON_SUCCESS;
+}
+
+static int parser_channel_header(struct owon_parser *parser) {
+    struct owon_channel_header chan_header;
+    decode_channel_header(&chan_header, parser->header);
+    if (chan_header.sample_count < 0) {
+        return parser_fail(parser, OWON_ERROR_READ);
+    }
+
+    memset(&parser->channel, 0, sizeof(parser->channel));
+    int ret = fill_channel(&parser->channel, &chan_header, parser->model);
+    if (OWON_SUCCESS != ret) {
+        return parser_fail(parser, ret);
+    }
+    parser->sample_offset = 0;
+    parser->staged = 0;
+
+    if (NULL != parser->callbacks->channel) {
+        ret = parser->callbacks->channel(&parser->channel, 
+                parser->user_data);
+        if (OWON_SUCCESS != ret) {
+            return parser_fail(parser, ret);
+        }
+    }
+    if (0 == parser->channel.sample_count) {
+        parser_next(parser);
+    } else {
+        parser->state = OWON_PARSER_SAMPLES;
+    }
+    return OWON_SUCCESS;
+}
+
+// Accumulate `size` bytes of a header, returning how many bytes of `bytes` 
+// were used.
+static size_t parser_fill_header(struct owon_parser *parser, 
+        const char *bytes, size_t length, int size) {
+    size_t take = size - parser->pending;
+    if (take > length) {
+        take = length;
+    }
+    memcpy(parser->header + parser->pending, bytes, take);
+    parser->pending += take;
+    return take;
+}
+
+// Push the next `length` bytes of a capture through the parser. Callbacks 
+// are made as soon as each part is complete, and sample chunks never hold 
+// more than OWON_PARSER_CHUNK samples, so the memory used does not depend 
+// on the size of the capture. Returns OWON_SUCCESS, or the error that 
+// stopped parsing (which is also returned by every later call).
+int owon_parser_feed(struct owon_parser *parser, const void *data, 
+        size_t length) {
+    const char *bytes = data;
+
+    while (length > 0) {
+        size_t used = 0;
+        int ret = OWON_SUCCESS;
+
+        switch (parser->state) {
+        case OWON_PARSER_FILE_HEADER:
+            used = parser_fill_header(parser, bytes, length, 
+                    OWON_FILE_HEADER_SIZE);
+            parser->offset += used;
+            if (OWON_FILE_HEADER_SIZE == parser->pending) {
+                ret = parser_file_header(parser);
+            }
+            break;
+        case OWON_PARSER_CHANNEL_HEADER:
+            used = parser_fill_header(parser, bytes, length, 
+                    OWON_CHANNEL_HEADER_SIZE);
+            parser->offset += used;
+            if (OWON_CHANNEL_HEADER_SIZE == parser->pending) {
+                ret = parser_channel_header(parser);
+            }
+            break;
+        case OWON_PARSER_SAMPLES: {
+            size_t remaining = (size_t)(parser->channel.sample_count - 
+                    parser->sample_offset) * sizeof(short) - parser->staged;
+            size_t space = sizeof(parser->stage) - parser->staged;
+            used = length;
+            if (used > remaining) {
+                used = remaining;
+            }
+            if (used > space) {
+                used = space;
+            }
+            memcpy((char *)parser->stage + parser->staged, bytes, used);
+            parser->staged += used;
+            parser->offset += used;
+            if (used == remaining || used == space) {
+                ret = parser_emit(parser);
+                if (OWON_SUCCESS == ret && 
+                        parser->sample_offset == parser->channel.sample_count) {
+                    parser_next(parser);
+                }
+            }
+            break;
+        }
+        case OWON_PARSER_DONE:
+            return OWON_SUCCESS;
+        default:
+            return parser->status;
+        }
+
+        if (OWON_SUCCESS != ret) {
+            return ret;
+        }
+        bytes += used;
+        length -= used;
+    }
+
+    // Don't sit on samples until the next call; a slow source should still 
+    // produce output as it arrives.
+    if (OWON_PARSER_SAMPLES == parser->state && 
+            parser->staged >= sizeof(short)) {
+        return parser_emit(parser);
+    }
+    return OWON_SUCCESS;
+}
+
+// Call at the end of the input. Returns OWON_ERROR_READ if the capture was 
+// cut short.
+int owon_parser_finish(struct owon_parser *parser) {
+    switch (parser->state) {
+    case OWON_PARSER_DONE:
+        return OWON_SUCCESS;
+    case OWON_PARSER_ERROR:
+        return parser->status;
+    default:
+        return parser_fail(parser, OWON_ERROR_READ);
+    }
+}
+
+static int capture_header(const char *header, int length, void *user_data) {
+    struct owon_capture *capture = user_data;
+    memcpy(&capture->header, header, 6);
+    capture->model = owon_find_model(capture->header);
+
+    // The channels are not known yet; the table grows if there are more.
+    return capture_channels(capture, length, OWON_INITIAL_CHANNELS);
+}
+
+static int capture_channel(const struct owon_channel *channel, 
+        void *user_data) {
+    struct owon_capture *capture = user_data;
+    if (NULL == capture_next_channel(capture)) {
+        return OWON_ERROR_MEMORY;
+    }
+    short *samples = capture_alloc(capture, 
+            channel->sample_count * sizeof(short));
+    if (NULL == samples) {
+        return OWON_ERROR_MEMORY;
+    }
+    struct owon_channel *copy = &capture->channels[capture->channel_count];
+    *copy = *channel;
+    copy->samples = samples;
+    capture->channel_count++;
+    return OWON_SUCCESS;
+}
+
+static int capture_samples(const struct owon_channel *channel, 
+        const short *samples, int offset, int count, void *user_data) {
+    struct owon_capture *capture = user_data;
+    struct owon_channel *copy = 
+        &capture->channels[capture->channel_count - 1];
+    memcpy(copy->samples + offset, samples, count * sizeof(short));
+    return OWON_SUCCESS;
+}
+
+static const struct owon_parser_callbacks capture_callbacks = {
+    capture_header,
+    capture_channel,
+    capture_samples
 };
 
-//TODO: read Wave and FFT channels
+// Set up `parser` to build `capture` as data is fed to it. Once 
+// owon_parser_finish() succeeds the capture is complete and is released 
+// with owon_free_capture(); on failure it must still be freed.
+void owon_parser_init_capture(struct owon_parser *parser, 
+        struct owon_capture *capture) {
+    owon_parser_init_capture_arena(parser, capture, NULL);
+}
+
+// As owon_parser_init_capture(), but the capture is built in `arena` (see
+// owon_parse_buffer_arena()).
+void owon_parser_init_capture_arena(struct owon_parser *parser, 
+        struct owon_capture *capture, struct owon_arena *arena) {
+    capture_begin(capture, arena);
+    owon_parser_init(parser, &capture_callbacks, capture);
+}
+
+// Size of the blocks read by owon_parse().
+#define PARSE_READ_SIZE 65536
+
 //TODO: more helpful error handling
 int owon_parse(struct owon_capture *capture, FILE *fp) {
-    memset(capture, 0, sizeof(*capture));
+    return owon_parse_arena(capture, fp, NULL);
+}
+
+int owon_parse_arena(struct owon_capture *capture, FILE *fp, 
+        struct owon_arena *arena) {
+    struct owon_parser *parser = malloc(sizeof(*parser));
+    char *block = malloc(PARSE_READ_SIZE);
+    if (NULL == parser || NULL == block) {
+        free(parser);
+        free(block);
+        memset(capture, 0, sizeof(*capture));
+        return OWON_ERROR_MEMORY;
+    }
+    owon_parser_init_capture_arena(parser, capture, arena);
+
+    int ret = OWON_SUCCESS;
+    while (OWON_SUCCESS == ret && OWON_PARSER_DONE != parser->state) {
+        size_t count = fread(block, 1, PARSE_READ_SIZE, fp);
+        if (0 == count) {
+            break;
+        }
+        ret = owon_parser_feed(parser, block, count);
+    }
+    if (OWON_SUCCESS == ret) {
+        ret = owon_parser_finish(parser);
+    }
+    if (OWON_SUCCESS != ret) {
+        capture_abort(capture);
+    }
+    free(parser);
+    free(block);
+    return ret;
+}
+
+// Parse a complete capture held in memory. Sample blocks that are suitably 
+// aligned are not copied: the channel points straight into `data` and is 
+// marked as borrowed, so `data` must outlive the capture. Blocks that are 
+// not aligned for `short` (the first channel of a file at the start of a 
+// page, for one) are copied.
+int owon_parse_buffer(struct owon_capture *capture, const void *data, 
+        size_t length) {
+    return owon_parse_buffer_arena(capture, data, length, NULL);
+}
+
+// As owon_parse_buffer(), but the channel table and copied samples are 
+// allocated from `arena`, which is reset first; with a NULL `arena` the 
+// capture has memory of its own. Reusing one arena for many files saves 
+// allocating for each of them. A capture parsed into an arena is only valid
+// until the arena is reset, reused or freed; owon_free_capture() must 
+// still be called for it, but leaves the arena alone.
+int owon_parse_buffer_arena(struct owon_capture *capture, const void *data, 
+        size_t length, struct owon_arena *arena) {
+    capture_begin(capture, arena);
+
+    const char *bytes = data;
+    if (length < OWON_FILE_HEADER_SIZE) {
+        capture_abort(capture);
+        return OWON_ERROR_READ;
+    }
 
     struct owon_header file_header;
-    memset(&file_header, 0, sizeof(file_header));
-
-    fread(&file_header.header, sizeof(char), sizeof(file_header.header), fp);
-    strncpy((char *)&capture->header, file_header.header, sizeof(file_header.header));
-
-    // TODO: not all models start with `SPB`!
-    // Ensure file is the right format.
-    if (0 != strncmp("SPB", (const char *)&file_header.header, 3)) {
-        return OWON_ERROR_HEADER;
-    }
-   
-    // The 4th character (index 3) of the header string indicate which tables
-    // must be used.
-    char model = file_header.header[3];
-    float *attenuation_table = get_attenuation_table(model);
-    float *volt_table = get_volt_table(model);
-    float *time_table = get_time_table(model);
-    if (attenuation_table == NULL || volt_table == NULL || 
-            time_table == NULL) {
-        return OWON_ERROR_UNSUPPORTED;
+    memcpy(&file_header.header, bytes, sizeof(file_header.header));
+    memcpy(&capture->header, file_header.header, sizeof(file_header.header));
+
+    const struct owon_model *model;
+    int ret = check_header(file_header.header, &model);
+    if (OWON_SUCCESS != ret) {
+        goto error;
     }
+    capture->model = model;
 
-    fread(&file_header.length, sizeof(int), 1, fp);
+    memcpy(&file_header.length, bytes + sizeof(file_header.header), 
+            sizeof(int));
 
     // Custom models are indicated a negative length
     if (file_header.length < 0) {
-        return OWON_ERROR_UNSUPPORTED;
+        ret = OWON_ERROR_UNSUPPORTED;
+        goto error;
     }
 
-    // TODO: maybe try to calculate how many channels there are based on the 
-    // length and number of samples? The number of samples may not be 
-    // consistant between channels.
-    capture->channels = calloc(OWON_MAX_CHANNELS, 
-            sizeof(struct owon_channel));
-    if (NULL == capture->channels) {
-        return OWON_ERROR_MEMORY;
+    // Samples are borrowed from `data` where they are aligned, so only 
+    // those that aren't need room in the arena.
+    size_t copied;
+    int channels = count_channels(bytes, length, file_header.length, 
+            &copied);
+    ret = capture_channels(capture, copied, channels);
+    if (OWON_SUCCESS != ret) {
+        goto error;
     }
-    capture->channel_count = 0;
 
-    while (ftell(fp) < file_header.length) {
+    size_t offset = OWON_FILE_HEADER_SIZE;
+    while (offset < (size_t)file_header.length) {
+        if (NULL == capture_next_channel(capture)) {
+            ret = OWON_ERROR_MEMORY;
+            goto error;
+        }
+        if (length - offset < OWON_CHANNEL_HEADER_SIZE) {
+            ret = OWON_ERROR_READ;
+            goto error;
+        }
         struct owon_channel_header chan_header;
-        fread(&chan_header.name, sizeof(char), sizeof(chan_header.name), fp);
-        fread(&chan_header.length, sizeof(int), 1, fp);
-        fread(&chan_header.sample_count, sizeof(int), 1, fp);
-        fread(&chan_header.sample_screen, sizeof(int), 1, fp);
-        fread(&chan_header.slow_scan_pos, sizeof(int), 1, fp);
-        fread(&chan_header.time_div, sizeof(int), 1, fp);
-        fread(&chan_header.zero_point, sizeof(int), 1, fp);
-        fread(&chan_header.volts_div, sizeof(int), 1, fp);
-        fread(&chan_header.attenuation, sizeof(int), 1, fp);
-        fread(&chan_header.time_mul, sizeof(float), 1, fp);
-        fread(&chan_header.frequency, sizeof(float), 1, fp);
-        fread(&chan_header.period, sizeof(float), 1, fp);
-        fread(&chan_header.volts_mul, sizeof(float), 1, fp);
-        
+        decode_channel_header(&chan_header, bytes + offset);
+        offset += OWON_CHANNEL_HEADER_SIZE;
+
+        if (chan_header.sample_count < 0 || 
+                (length - offset) / sizeof(short) < 
+                (size_t)chan_header.sample_count) {
+            ret = OWON_ERROR_READ;
+            goto error;
+        }
+
+        const char *samples = bytes + offset;
+        size_t samples_size = chan_header.sample_count * sizeof(short);
+        short *copy = NULL;
+        if (0 != (uintptr_t)samples % sizeof(short)) {
+            copy = capture_alloc(capture, samples_size);
+            if (NULL == copy) {
+                ret = OWON_ERROR_MEMORY;
+                goto error;
+            }
+            memcpy(copy, samples, samples_size);
+        }
+
         struct owon_channel *channel;
         channel = &capture->channels[capture->channel_count];
-        strncpy((char *)&channel->name, chan_header.name, 
-                sizeof(chan_header.name));
-        channel->attenuation = attenuation_table[chan_header.attenuation];
-        channel->volts_mul = chan_header.volts_mul;
-        channel->volts_div = volt_table[chan_header.volts_div];
-        channel->time_mul = chan_header.time_mul;
-        channel->time_div = time_table[chan_header.time_div];
-        channel->frequency = chan_header.frequency;
-        channel->period = channel->period;
-        channel->sample_count = chan_header.sample_count;
-        channel->samples = malloc(chan_header.sample_count * sizeof(short));
-        if (NULL == channel->samples) {
-            return OWON_ERROR_MEMORY;
+        ret = fill_channel(channel, &chan_header, model);
+        if (OWON_SUCCESS != ret) {
+            goto error;
         }
-        fread(channel->samples, sizeof(short), channel->sample_count, fp);
+        if (NULL == copy) {
+            channel->samples = (short *)samples;
+            channel->borrowed = 1;
+        } else {
+            channel->samples = copy;
+        }
+        offset += samples_size;
 
-        if (feof(fp) || ferror(fp)) {
+        capture->channel_count++;
+    }
+
+    return OWON_SUCCESS;
+
+error:
+    capture_abort(capture);
+    return ret;
+}
+
+// Parse the capture in the file at `path`. Regular files are mapped into 
+// memory and parsed with owon_parse_buffer(); anything else (a FIFO, for 
+// example) is read through stdio with owon_parse(). The mapping is released 
+// by owon_free_capture().
+int owon_parse_file(struct owon_capture *capture, const char *path) {
+    return owon_parse_file_arena(capture, path, NULL);
+}
+
+// As owon_parse_file(), allocating from `arena` (see 
+// owon_parse_buffer_arena()).
+int owon_parse_file_arena(struct owon_capture *capture, const char *path, 
+        struct owon_arena *arena) {
+#ifndef WIN32
+    int fd = open(path, O_RDONLY);
+    if (0 > fd) {
+        return OWON_ERROR_OPEN;
+    }
+    struct stat st;
+    if (0 == fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (MAP_FAILED == mapping) {
             return OWON_ERROR_READ;
         }
+        int ret = owon_parse_buffer_arena(capture, mapping, st.st_size, 
+                arena);
+        if (OWON_SUCCESS != ret) {
+            munmap(mapping, st.st_size);
+            return ret;
+        }
+        capture->mapping = mapping;
+        capture->mapping_length = st.st_size;
+        return OWON_SUCCESS;
+    }
+    close(fd);
+#endif
+    FILE *fp = fopen(path, "rb");
+    if (NULL == fp) {
+        return OWON_ERROR_OPEN;
+    }
+    int ret = owon_parse_arena(capture, fp, arena);
+    fclose(fp);
+    return ret;
+}
+
+#ifndef WIN32
+// Read exactly `size` bytes at `offset` of the file `fd`.
+static int read_at(int fd, void *data, size_t size, long long offset) {
+    char *bytes = data;
+    while (size > 0) {
+        ssize_t count = pread(fd, bytes, size, offset);
+        if (0 >= count) {
+            return OWON_ERROR_READ;
+        }
+        bytes += count;
+        size -= count;
+        offset += count;
+    }
+    return OWON_SUCCESS;
+}
+#endif
+
+// Open the capture in the regular file at `path` without reading its 
+// samples. Only the headers are read; owon_write_delim(), owon_write_f32(),
+// owon_write_i16() and owon_write_npy() then read each channel a window at
+// a time, so a capture of any size is converted in constant memory. The 
+// channels' `samples` are NULL, so anything else that needs the samples 
+// takes a capture from owon_parse_file() instead, and returns 
+// OWON_ERROR_UNSUPPORTED for this one, as does this function for files 
+// that can't be read at random (pipes, or on Windows). The file is closed 
+// by owon_free_capture().
+int owon_open_capture(struct owon_capture *capture, const char *path) {
+#ifdef WIN32
+    memset(capture, 0, sizeof(*capture));
+    return OWON_ERROR_UNSUPPORTED;
+#else
+    capture_begin(capture, NULL);
+    // Check before opening: opening and closing a FIFO would lose its 
+    // writer, so it couldn't be read another way afterwards.
+    struct stat st;
+    if (0 == stat(path, &st) && !S_ISREG(st.st_mode)) {
+        capture_abort(capture);
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    int fd = open(path, O_RDONLY);
+    if (0 > fd) {
+        capture_abort(capture);
+        return OWON_ERROR_OPEN;
+    }
+    int ret;
+    if (0 != fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        ret = OWON_ERROR_UNSUPPORTED;
+        goto error;
+    }
+
+    char header[OWON_CHANNEL_HEADER_SIZE];
+    ret = read_at(fd, header, OWON_FILE_HEADER_SIZE, 0);
+    if (OWON_SUCCESS != ret) {
+        goto error;
+    }
+    struct owon_header file_header;
+    memcpy(&file_header.header, header, sizeof(file_header.header));
+    memcpy(&file_header.length, header + sizeof(file_header.header), 
+            sizeof(int));
+    memcpy(&capture->header, file_header.header, sizeof(file_header.header));
+
+    const struct owon_model *model;
+    ret = check_header(file_header.header, &model);
+    if (OWON_SUCCESS != ret) {
+        goto error;
+    }
+    capture->model = model;
+
+    // Custom models are indicated a negative length
+    if (file_header.length < 0) {
+        ret = OWON_ERROR_UNSUPPORTED;
+        goto error;
+    }
+
+    // None of the samples are held, so nothing is reserved for them.
+    ret = capture_channels(capture, 0, OWON_INITIAL_CHANNELS);
+    if (OWON_SUCCESS != ret) {
+        goto error;
+    }
+
+    long long offset = OWON_FILE_HEADER_SIZE;
+    while (offset < file_header.length) {
+        struct owon_channel *channel = capture_next_channel(capture);
+        if (NULL == channel) {
+            ret = OWON_ERROR_MEMORY;
+            goto error;
+        }
+        ret = read_at(fd, header, OWON_CHANNEL_HEADER_SIZE, offset);
+        if (OWON_SUCCESS != ret) {
+            goto error;
+        }
+        struct owon_channel_header chan_header;
+        decode_channel_header(&chan_header, header);
+        offset += OWON_CHANNEL_HEADER_SIZE;
+
+        if (chan_header.sample_count < 0 || 
+                (st.st_size - offset) / (long long)sizeof(short) < 
+                chan_header.sample_count) {
+            ret = OWON_ERROR_READ;
+            goto error;
+        }
+        ret = fill_channel(channel, &chan_header, model);
+        if (OWON_SUCCESS != ret) {
+            goto error;
+        }
+        channel->file_offset = offset;
+        offset += (long long)chan_header.sample_count * sizeof(short);
 
         capture->channel_count++;
     }
 
+    capture->windowed = 1;
+    capture->fd = fd;
     return OWON_SUCCESS;
+
+error:
+    close(fd);
+    capture_abort(capture);
+    return ret;
+#endif
+}
+
+// Parse the data returned by owon_usb_read() without going through a file.
+// On success the capture takes ownership of `buffer` (samples are borrowed
+// from it where possible) and it is released by owon_free_capture(). On 
+// failure `buffer` still belongs to the caller.
+int owon_parse_usb_buffer(struct owon_capture *capture, char *buffer, 
+        long long length) {
+    if (0 > length || (unsigned long long)length > SIZE_MAX) {
+        memset(capture, 0, sizeof(*capture));
+        return OWON_ERROR_READ;
+    }
+    int ret = owon_parse_buffer(capture, buffer, length);
+    if (OWON_SUCCESS == ret) {
+        capture->buffer = buffer;
+    }
+    return ret;
 }
 
+// Release what the capture holds. Memory from a caller's arena is not 
+// freed; it is reused or released with the arena.
 void owon_free_capture(struct owon_capture *capture) {
-    while (capture->channel_count--) {
-        free(capture->channels[capture->channel_count].samples);
+    free(capture->memory.data);
+#ifndef WIN32
+    if (NULL != capture->mapping) {
+        munmap(capture->mapping, capture->mapping_length);
+    }
+#endif
+    free(capture->buffer);
+#ifndef WIN32
+    if (capture->windowed) {
+        close(capture->fd);
+    }
+#endif
+    memset(capture, 0, sizeof(*capture));
+}
+
+// Size of the buffer that rows are formatted into before being written.
+#define WRITE_BUFFER_SIZE 65536
+
+// Number of rows converted to floats at a time before formatting.
+#define ROW_BLOCK 1024
+
+// Output is formatted into a large buffer and written in big blocks, 
+// rather than going through stdio for each value.
+struct write_buffer {
+    FILE *fp;
+    size_t used;
+    int error;
+    char data[WRITE_BUFFER_SIZE];
+};
+
+static void flush_buffer(struct write_buffer *out) {
+    if (out->used > 0 && 
+            out->used != fwrite(out->data, sizeof(char), out->used, out->fp)) {
+        out->error = 1;
+    }
+    out->used = 0;
+}
+
+// Make sure there is room for `size` more bytes.
+static char *reserve_buffer(struct write_buffer *out, size_t size) {
+    if (out->used + size > sizeof(out->data)) {
+        flush_buffer(out);
+    }
+    return out->data + out->used;
+}
+
+static void put_string(struct write_buffer *out, const char *str) {
+    size_t length = strlen(str);
+    if (length > sizeof(out->data)) {
+        flush_buffer(out);
+        if (length != fwrite(str, sizeof(char), length, out->fp)) {
+            out->error = 1;
+        }
+        return;
+    }
+    memcpy(reserve_buffer(out, length), str, length);
+    out->used += length;
+}
+
+static const double _pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+static const unsigned long long _pow10_int[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 
+    10000000ULL, 100000000ULL, 1000000000ULL
+};
+
+// Write `value` to `str`, which has room for OWON_VALUE_SIZE bytes, with 
+// `precision` digits after the decimal point, exactly as printf("%.*f") 
+// does, and return the length written. `str` isn't necessarily 
+// null-terminated.
+//
+// A float has a 24 bit significand and 10^9 needs 21 bits, so for up to 9 
+// digits `value * 10^precision` is exact in a double. Rounding that to an 
+// integer (half to even, like printf) and printing the digits gives the 
+// same result as printf without any of its parsing or locale handling. 
+// Anything else goes to snprintf().
+int owon_format_fixed(char *str, float value, int precision) {
+    if (precision > 9) {
+        return snprintf(str, OWON_VALUE_SIZE, "%.*f", precision, value);
+    }
+    double scaled = (double)value * _pow10[precision];
+    int negative = signbit(value);
+    if (negative) {
+        scaled = -scaled;
+    }
+    // Also catches NaN.
+    if (!(scaled < 9.0e18)) {
+        return snprintf(str, OWON_VALUE_SIZE, "%.*f", precision, value);
+    }
+    unsigned long long number = (unsigned long long)scaled;
+    double fraction = scaled - (double)number;
+    if (fraction > 0.5 || (fraction == 0.5 && (number & 1))) {
+        number++;
+    }
+
+    char digits[24];
+    int count = 0;
+    unsigned long long integer = number / _pow10_int[precision];
+    unsigned long long decimals = number % _pow10_int[precision];
+    int i;
+    for (i = 0; i < precision; i++) {
+        digits[count++] = '0' + decimals % 10;
+        decimals /= 10;
+    }
+    if (precision > 0) {
+        digits[count++] = '.';
+    }
+    do {
+        digits[count++] = '0' + integer % 10;
+        integer /= 10;
+    } while (integer > 0);
+
+    int length = 0;
+    if (negative) {
+        str[length++] = '-';
+    }
+    while (count > 0) {
+        str[length++] = digits[--count];
+    }
+    return length;
+}
+
+static void put_value(struct write_buffer *out, float value, int precision) {
+    char *str = reserve_buffer(out, OWON_VALUE_SIZE);
+    out->used += owon_format_fixed(str, value, precision);
+}
+
+// Samples `start` to `start + count` of `channel`: where they are held in
+// memory, or for a windowed capture read from its file into `window`. NULL
+// if they can't be read.
+static const short *channel_window(struct owon_capture const *capture, 
+        struct owon_channel const *channel, int start, int count, 
+        short *window) {
+    if (!capture->windowed) {
+        return channel->samples + start;
+    }
+#ifndef WIN32
+    if (OWON_SUCCESS == read_at(capture->fd, window, count * sizeof(short),
+                channel->file_offset + (long long)start * sizeof(short))) {
+        return window;
     }
-    free(capture->channels);
+#endif
+    return NULL;
 }
 
 int owon_write_delim(struct owon_capture const *capture, char *delim,
         char *line_end, int header, FILE *fp) {
+    return owon_write_delim_precision(capture, delim, line_end, header, 
+            OWON_DEFAULT_PRECISION, fp);
+}
+
+// Index of the channel whose time axis the capture is written with: the 
+// first that is not an FFT channel, if there is one.
+static int time_channel(struct owon_capture const *capture) {
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+        if (OWON_CHANNEL_FFT != capture->channels[chan_idx].kind) {
+            return chan_idx;
+        }
+    }
+    return 0;
+}
+
+// Write the capture as delimited text, one row per sample with the time 
+// followed by each channel, with `precision` digits after the decimal 
+// point. An FFT channel is preceded by a column with its own frequency 
+// axis.
+int owon_write_delim_precision(struct owon_capture const *capture, 
+        char *delim, char *line_end, int header, int precision, FILE *fp) {
     if (capture->channel_count < 1) {
         return OWON_ERROR;
     }
+    if (precision < 0 || precision > OWON_MAX_PRECISION) {
+        return OWON_ERROR;
+    }
+    struct write_buffer *out = malloc(sizeof(*out));
+    float *values = malloc((capture->channel_count + 1) * ROW_BLOCK * 
+            sizeof(float));
+    short *window = malloc(ROW_BLOCK * sizeof(short));
+    if (NULL == out || NULL == values || NULL == window) {
+        free(out);
+        free(values);
+        free(window);
+        return OWON_ERROR_MEMORY;
+    }
+    out->fp = fp;
+    out->used = 0;
+    out->error = 0;
+
     if (header) {
-        fprintf(fp, "Time (us)%s", delim);
+        put_string(out, "Time (us)");
+        put_string(out, delim);
     }
     int chan_idx;
     int max_samples = 0;
@@ -226,28 +1247,261 @@ int owon_write_delim(struct owon_capture const *capture, char *delim,
             } else {
                 s = line_end;
             }
-            fprintf(fp, "%s (mV)%s", channel->name, s);
+            if (OWON_CHANNEL_FFT == channel->kind) {
+                put_string(out, channel->name);
+                put_string(out, " frequency (Hz)");
+                put_string(out, delim);
+            }
+            put_string(out, channel->name);
+            put_string(out, " (mV)");
+            put_string(out, s);
         }
     }
-    int sample_idx;
-    for (sample_idx = 0; sample_idx < max_samples; sample_idx++) {
-        fprintf(fp, "%f%s", sample_idx * capture->channels[0].time_mul, delim);
+
+    // Convert a block of rows for every channel in one go, then format 
+    // them. The time axis goes in the last block of `values`.
+    float *times = values + capture->channel_count * ROW_BLOCK;
+    int block;
+    for (block = 0; block < max_samples; block += ROW_BLOCK) {
+        int rows = max_samples - block;
+        if (rows > ROW_BLOCK) {
+            rows = ROW_BLOCK;
+        }
+        owon_time_axis(block, rows, 
+                capture->channels[time_channel(capture)].time_mul, times);
         for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
             struct owon_channel *channel = &capture->channels[chan_idx];
-            char *s;
-            if (chan_idx < capture->channel_count - 1) {
-                s = delim;
-            } else {
-                s = line_end;
+            int count = channel->sample_count - block;
+            if (count > rows) {
+                count = rows;
+            }
+            if (count > 0) {
+                const short *samples = channel_window(capture, channel, 
+                        block, count, window);
+                if (NULL == samples) {
+                    out->error = 1;
+                    break;
+                }
+                owon_convert_samples(samples, count, channel->volts_mul, 
+                        channel->attenuation, values + chan_idx * ROW_BLOCK);
+            }
+        }
+        if (out->error) {
+            break;
+        }
+
+        int row;
+        for (row = 0; row < rows; row++) {
+            put_value(out, times[row], precision);
+            put_string(out, delim);
+            for (chan_idx = 0; chan_idx < capture->channel_count; 
+                    chan_idx++) {
+                struct owon_channel *channel = &capture->channels[chan_idx];
+                char *s;
+                if (chan_idx < capture->channel_count - 1) {
+                    s = delim;
+                } else {
+                    s = line_end;
+                }
+                if (OWON_CHANNEL_FFT == channel->kind) {
+                    if (block + row < channel->sample_count) {
+                        put_value(out, 
+                                (block + row) * channel->frequency_mul, 
+                                precision);
+                    } else {
+                        put_string(out, " ");
+                    }
+                    put_string(out, delim);
+                }
+                if (block + row < channel->sample_count) {
+                    put_value(out, values[chan_idx * ROW_BLOCK + row], 
+                            precision);
+                } else {
+                    put_string(out, " ");
+                }
+                put_string(out, s);
             }
-            if (sample_idx < channel->sample_count) {
-                fprintf(fp, "%f%s", channel->samples[sample_idx] * 
-                        channel->volts_mul * channel->attenuation, s);
+        }
+    }
+    flush_buffer(out);
+    int error = out->error;
+    free(values);
+    free(window);
+    free(out);
+    return error ? OWON_ERROR : OWON_SUCCESS;
+}
+
+// The binary formats below write each channel as one contiguous column, so 
+// the result can be mapped and used directly. Like the parser, they assume a
+// little-endian host.
+
+static int max_sample_count(struct owon_capture const *capture) {
+    int max_samples = 0;
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+        if (capture->channels[chan_idx].sample_count > max_samples) {
+            max_samples = capture->channels[chan_idx].sample_count;
+        }
+    }
+    return max_samples;
+}
+
+// Most samples converted or copied at a time by the binary writers, so the 
+// memory they use does not depend on the length of the capture.
+#define WINDOW_SAMPLES 65536
+
+// Size of the windows for channels up to `count` samples long.
+static int window_size(int count) {
+    if (count > WINDOW_SAMPLES) {
+        return WINDOW_SAMPLES;
+    }
+    return (count > 0) ? count : 1;
+}
+
+// Write each channel `count` values long as 32-bit floats in mV, padding 
+// channels with fewer samples with NaN. 
+static int write_columns_f32(struct owon_capture const *capture, int count,
+        FILE *fp) {
+    int window_samples = window_size(count);
+    float *values = malloc(window_samples * sizeof(float));
+    short *window = malloc(window_samples * sizeof(short));
+    if (NULL == values || NULL == window) {
+        free(values);
+        free(window);
+        return OWON_ERROR_MEMORY;
+    }
+    int ret = OWON_SUCCESS;
+    int chan_idx;
+    for (chan_idx = 0; OWON_SUCCESS == ret && 
+            chan_idx < capture->channel_count; chan_idx++) {
+        struct owon_channel *channel = &capture->channels[chan_idx];
+        int start;
+        for (start = 0; start < count; start += window_samples) {
+            int size = count - start;
+            if (size > window_samples) {
+                size = window_samples;
+            }
+            int samples = channel->sample_count - start;
+            if (samples > size) {
+                samples = size;
+            }
+            if (samples > 0) {
+                const short *window_samples = channel_window(capture, 
+                        channel, start, samples, window);
+                if (NULL == window_samples) {
+                    ret = OWON_ERROR_READ;
+                    break;
+                }
+                owon_convert_samples(window_samples, samples, 
+                        channel->volts_mul, channel->attenuation, values);
             } else {
-                fprintf(fp, " %s", s);
+                samples = 0;
+            }
+            int i;
+            for (i = samples; i < size; i++) {
+                values[i] = NAN;
+            }
+            if (size != fwrite(values, sizeof(float), size, fp)) {
+                ret = OWON_ERROR;
+                break;
             }
         }
     }
-    return OWON_SUCCESS;
+    free(values);
+    free(window);
+    return ret;
+}
+
+// Raw 32-bit floats in mV, one channel after the other. 
+int owon_write_f32(struct owon_capture const *capture, FILE *fp) {
+    if (capture->channel_count < 1) {
+        return OWON_ERROR;
+    }
+    return write_columns_f32(capture, max_sample_count(capture), fp);
+}
+
+// The samples as they came from the device (16-bit integers), one channel
+// after the other. Channels with fewer samples are padded with zeros.
+int owon_write_i16(struct owon_capture const *capture, FILE *fp) {
+    if (capture->channel_count < 1) {
+        return OWON_ERROR;
+    }
+    int max_samples = max_sample_count(capture);
+    int window_samples = window_size(max_samples);
+    // Samples in memory are written as they are, so the window is only for
+    // reading a windowed capture and as a block of zeros for the padding.
+    short *window = NULL;
+    int ret = OWON_SUCCESS;
+    int chan_idx;
+    for (chan_idx = 0; OWON_SUCCESS == ret && 
+            chan_idx < capture->channel_count; chan_idx++) {
+        struct owon_channel *channel = &capture->channels[chan_idx];
+        int padding = max_samples - channel->sample_count;
+        if (NULL == window && (capture->windowed || padding > 0)) {
+            window = malloc(window_samples * sizeof(short));
+            if (NULL == window) {
+                return OWON_ERROR_MEMORY;
+            }
+        }
+        int step = capture->windowed ? window_samples : max_samples;
+        int start;
+        for (start = 0; start < channel->sample_count; start += step) {
+            int size = channel->sample_count - start;
+            if (size > step) {
+                size = step;
+            }
+            const short *samples = channel_window(capture, channel, start, 
+                    size, window);
+            if (NULL == samples) {
+                ret = OWON_ERROR_READ;
+                break;
+            }
+            if (size != fwrite(samples, sizeof(short), size, fp)) {
+                ret = OWON_ERROR;
+                break;
+            }
+        }
+        if (OWON_SUCCESS == ret && padding > 0) {
+            memset(window, 0, window_size(padding) * sizeof(short));
+        }
+        while (OWON_SUCCESS == ret && padding > 0) {
+            int size = window_size(padding);
+            if (size != fwrite(window, sizeof(short), size, fp)) {
+                ret = OWON_ERROR;
+            }
+            padding -= size;
+        }
+    }
+    free(window);
+    return ret;
 }
 
+// A NumPy .npy file (format version 1.0) holding a samples x channels 
+// float32 array in mV. The array is stored in Fortran (column-major) order,
+// so each channel is still contiguous. Channels with fewer samples are 
+// padded with NaN.
+int owon_write_npy(struct owon_capture const *capture, FILE *fp) {
+    if (capture->channel_count < 1) {
+        return OWON_ERROR;
+    }
+    int max_samples = max_sample_count(capture);
+
+    // The header is padded with spaces and ends with a newline so that the
+    // data starts on a 64 byte boundary.
+    char header[128];
+    int length = snprintf(header, sizeof(header), 
+            "{'descr': '<f4', 'fortran_order': True, 'shape': (%d, %d), }", 
+            max_samples, capture->channel_count);
+    int padded = ((10 + length + 1 + 63) / 64) * 64 - 10;
+    memset(header + length, ' ', padded - length - 1);
+    header[padded - 1] = '\n';
+
+    unsigned char preamble[10] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0, 
+        padded & 0xff, padded >> 8};
+    fwrite(preamble, sizeof(preamble), 1, fp);
+    fwrite(header, sizeof(char), padded, fp);
+    if (ferror(fp)) {
+        return OWON_ERROR;
+    }
+    return write_columns_f32(capture, max_samples, fp);
+}
@@ -21,11 +21,30 @@
 
 // TODO: consider using stdint.h for header data types?
 
-#define OWON_MAX_CHANNELS 6
+// Entries of the channel table set aside before the number of channels is 
+// known; it grows if a capture has more.
+#define OWON_INITIAL_CHANNELS 6
+
+struct owon_model;
+
+// Number of digits after the decimal point written by owon_write_delim().
+#define OWON_DEFAULT_PRECISION 6
+#define OWON_MAX_PRECISION 20
+
+// Room needed for one value formatted by owon_format_fixed(): sign, up to 
+// 39 integer digits of a float, decimal point and OWON_MAX_PRECISION digits.
+#define OWON_VALUE_SIZE 64
+
+// Sizes, in bytes, of the headers as they are stored in the file.
+#define OWON_FILE_HEADER_SIZE 10
+#define OWON_CHANNEL_HEADER_SIZE 51
 
 struct owon_header {
     char header[6];
-    int length;
+    int length;         // Offset at which the channel data ends. Stored as
+                        // a signed 32-bit value; negative means a custom 
+                        // model. The samples of the last channel may run 
+                        // past it, so files can be larger.
 };
 
 // Raw channel header as it comes from the device.
@@ -58,8 +77,17 @@ struct owon_channel_header {
                         // sample point value to get the actual value in mV.
 };
 
+// What a channel holds, told from its name.
+enum owon_channel_kind {
+    OWON_CHANNEL_WAVE,      // CH1, CH2, ...: a live channel.
+    OWON_CHANNEL_REFERENCE, // CHA-CHD: a wave saved on the scope.
+    OWON_CHANNEL_FFT,       // Cf1: the FFT math channel.
+    OWON_CHANNEL_UNKNOWN
+};
+
 struct owon_channel {
     char name[4]; // 3 characters plus a null terminator
+    enum owon_channel_kind kind;
     float attenuation;
     float volts_mul;
     float volts_div;
@@ -67,22 +95,122 @@ struct owon_channel {
     float time_div;
     float frequency;
     float period;
+    float frequency_mul; // FFT channels only: Hz between points, which run
+                         // from 0 Hz. 0 for other channels.
     int sample_count;
     short *samples;
+    int borrowed; // Non-zero when `samples` points into the parsed data 
+                  // rather than the capture's memory (see 
+                  // owon_parse_buffer()).
+    long long file_offset; // Where the samples start in the file, for 
+                           // captures opened with owon_open_capture().
+};
+
+// Memory that captures are parsed into: the channel table and any samples
+// that have to be copied. See owon_parse_buffer_arena().
+struct owon_arena {
+    char *data;
+    size_t size;
+    size_t used;
 };
 
 struct owon_capture {
     char header[7]; // 6 characters plus a null terminator
     int channel_count;
+    int channel_capacity;   // Entries in `channels`.
     struct owon_channel *channels;
+    const struct owon_model *model; // Tables the file was read with.
+    struct owon_arena memory;   // Used when not parsed into an arena of the
+                                // caller's.
+    struct owon_arena *arena;   // Arena the capture is built in.
+    void *mapping;          // File mapped by owon_parse_file(), or NULL.
+    size_t mapping_length;
+    char *buffer;           // Buffer handed over by owon_parse_usb_buffer(),
+                            // or NULL.
+    int windowed;           // Opened with owon_open_capture(): `samples` 
+    int fd;                 // are NULL and are read from `fd` as needed.
+};
+
+// Largest number of samples handed to owon_parser_callbacks.samples at once.
+#define OWON_PARSER_CHUNK 4096
+
+enum owon_parser_state {
+    OWON_PARSER_FILE_HEADER,
+    OWON_PARSER_CHANNEL_HEADER,
+    OWON_PARSER_SAMPLES,
+    OWON_PARSER_DONE,
+    OWON_PARSER_ERROR
+};
+
+// Called by owon_parser_feed() as each part of a capture is complete. Any 
+// of them may be NULL. Returning anything but OWON_SUCCESS stops parsing 
+// and is passed back to the caller.
+struct owon_parser_callbacks {
+    // The file header string (not null-terminated) and its length field.
+    int (*header)(const char *header, int length, void *user_data);
+    // A channel header. `channel->samples` is NULL; the samples follow.
+    int (*channel)(const struct owon_channel *channel, void *user_data);
+    // `count` samples of `channel` starting at sample `offset`. The samples
+    // are only valid during the call.
+    int (*samples)(const struct owon_channel *channel, const short *samples,
+            int offset, int count, void *user_data);
+};
+
+// Push parser state. Data can be fed in pieces of any size, so it works on 
+// pipes and on data as it arrives from the device.
+struct owon_parser {
+    const struct owon_parser_callbacks *callbacks;
+    void *user_data;
+    enum owon_parser_state state;
+    int status;         // Error that stopped the parser.
+    const struct owon_model *model;
+    long long offset;   // Bytes consumed so far.
+    long long length;   // Length field of the file header.
+    char header[OWON_CHANNEL_HEADER_SIZE]; // Header being accumulated.
+    int pending;        // Bytes of `header` filled in.
+    struct owon_channel channel;
+    int sample_offset;  // Samples of `channel` already handed over.
+    size_t staged;      // Bytes in `stage`.
+    short stage[OWON_PARSER_CHUNK];
 };
 
+void owon_arena_init(struct owon_arena *arena);
+void owon_arena_reset(struct owon_arena *arena);
+void owon_arena_free(struct owon_arena *arena);
 float *get_attenuation_table(const char c);
 float *get_volt_table(const char c);
 float *get_time_table(const char c);
+enum owon_channel_kind owon_get_channel_kind(const char *name);
+void owon_parser_init(struct owon_parser *parser, 
+        const struct owon_parser_callbacks *callbacks, void *user_data);
+void owon_parser_init_capture(struct owon_parser *parser, 
+        struct owon_capture *capture);
+void owon_parser_init_capture_arena(struct owon_parser *parser, 
+        struct owon_capture *capture, struct owon_arena *arena);
+int owon_parser_feed(struct owon_parser *parser, const void *data, 
+        size_t length);
+int owon_parser_finish(struct owon_parser *parser);
 int owon_parse(struct owon_capture *capture, FILE *fp);
+int owon_parse_arena(struct owon_capture *capture, FILE *fp, 
+        struct owon_arena *arena);
+int owon_parse_buffer(struct owon_capture *capture, const void *data, 
+        size_t length);
+int owon_parse_buffer_arena(struct owon_capture *capture, const void *data, 
+        size_t length, struct owon_arena *arena);
+int owon_parse_file(struct owon_capture *capture, const char *path);
+int owon_parse_file_arena(struct owon_capture *capture, const char *path, 
+        struct owon_arena *arena);
+int owon_format_fixed(char *str, float value, int precision);
+int owon_parse_usb_buffer(struct owon_capture *capture, char *buffer, 
+        long long length);
+int owon_open_capture(struct owon_capture *capture, const char *path);
 void owon_free_capture(struct owon_capture *capture);
 int owon_write_delim(struct owon_capture const *capture, char *delim, 
         char *line_end, int header, FILE *fp);
+int owon_write_delim_precision(struct owon_capture const *capture, 
+        char *delim, char *line_end, int header, int precision, FILE *fp);
+int owon_write_f32(struct owon_capture const *capture, FILE *fp);
+int owon_write_i16(struct owon_capture const *capture, FILE *fp);
+int owon_write_npy(struct owon_capture const *capture, FILE *fp);
 
 #endif // __OWON__PARSE_H__
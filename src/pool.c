@@ -0,0 +1,102 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "owon.h"
+#include "pool.h"
+
+struct pool {
+    owon_pool_fn fn;
+    void *user_data;
+    int count;
+    int next;       // Next item index to hand out.
+    pthread_mutex_t mutex;
+};
+
+struct worker {
+    struct pool *pool;
+    int id;
+};
+
+static void *worker_main(void *arg) {
+    struct worker *worker = arg;
+    struct pool *pool = worker->pool;
+    for (;;) {
+        pthread_mutex_lock(&pool->mutex);
+        int index = pool->next++;
+        pthread_mutex_unlock(&pool->mutex);
+        if (index >= pool->count) {
+            break;
+        }
+        pool->fn(worker->id, index, pool->user_data);
+    }
+    return NULL;
+}
+
+// Call `fn` for each index from 0 to `count` - 1 on up to `threads` 
+// threads, and wait for all of them to finish. Items are handed out one at
+// a time, so uneven work balances out. With one thread, everything runs on
+// the calling thread.
+int owon_pool_run(int threads, int count, owon_pool_fn fn, 
+        void *user_data) {
+    struct pool pool = {fn, user_data, count, 0};
+    pthread_mutex_init(&pool.mutex, NULL);
+
+    if (threads > count) {
+        threads = count;
+    }
+    if (threads <= 1) {
+        struct worker worker = {&pool, 0};
+        worker_main(&worker);
+        pthread_mutex_destroy(&pool.mutex);
+        return OWON_SUCCESS;
+    }
+
+    pthread_t *handles = malloc(threads * sizeof(pthread_t));
+    struct worker *workers = malloc(threads * sizeof(struct worker));
+    if (NULL == handles || NULL == workers) {
+        free(handles);
+        free(workers);
+        pthread_mutex_destroy(&pool.mutex);
+        return OWON_ERROR_MEMORY;
+    }
+    int started;
+    for (started = 0; started < threads; started++) {
+        workers[started].pool = &pool;
+        workers[started].id = started;
+        if (0 != pthread_create(&handles[started], NULL, worker_main, 
+                    &workers[started])) {
+            break;
+        }
+    }
+    // If no thread could be started, do the work here.
+    if (0 == started) {
+        workers[0].id = 0;
+        worker_main(&workers[0]);
+    }
+    int i;
+    for (i = 0; i < started; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    free(handles);
+    free(workers);
+    pthread_mutex_destroy(&pool.mutex);
+    return OWON_SUCCESS;
+}
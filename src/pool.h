@@ -0,0 +1,29 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef __OWON__POOL_H__
+#define __OWON__POOL_H__
+
+// Work function for owon_pool_run(), called once for each item index. 
+// `worker` identifies the thread making the call, from 0 to the number of 
+// threads - 1, so per-thread state can be kept by the caller.
+typedef void (*owon_pool_fn)(int worker, int index, void *user_data);
+
+int owon_pool_run(int threads, int count, owon_pool_fn fn, void *user_data);
+
+#endif // __OWON__POOL_H__
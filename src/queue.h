@@ -0,0 +1,43 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef __OWON__QUEUE_H__
+#define __OWON__QUEUE_H__
+
+#include <pthread.h>
+
+// Bounded ring queue of pointers, safe to share between one or more 
+// producer and consumer threads.
+struct owon_queue {
+    void **items;
+    int capacity;
+    int head;       // Index of the oldest item.
+    int count;      // Number of items queued.
+    int closed;     // Set by owon_queue_close(); no more items will come.
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+int owon_queue_init(struct owon_queue *queue, int capacity);
+void owon_queue_destroy(struct owon_queue *queue);
+int owon_queue_push(struct owon_queue *queue, void *item);
+void *owon_queue_pop(struct owon_queue *queue);
+void owon_queue_close(struct owon_queue *queue);
+
+#endif // __OWON__QUEUE_H__
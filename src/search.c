@@ -0,0 +1,252 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "owon.h"
+#include "parse.h"
+#include "search.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OWON_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Searching works on the raw samples: the level is turned into a sample 
+// value once per channel, so finding the next crossing is a comparison of
+// 16-bit integers, eight at a time with SSE2.
+
+static int find_high_scalar(const short *samples, int start, int count, 
+        int level) {
+    int i;
+    for (i = start; i < count && samples[i] < level; i++) {
+    }
+    return i;
+}
+
+static int find_low_scalar(const short *samples, int start, int count, 
+        int level) {
+    int i;
+    for (i = start; i < count && samples[i] >= level; i++) {
+    }
+    return i;
+}
+
+#ifdef OWON_X86_SIMD
+// `level` is in the range of a short plus one; the callers deal with 
+// levels no sample can reach.
+__attribute__((target("sse2")))
+static int find_high_sse2(const short *samples, int start, int count, 
+        int level) {
+    __m128i below = _mm_set1_epi16((short)(level - 1));
+    int i;
+    for (i = start; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(samples + i));
+        int mask = _mm_movemask_epi8(_mm_cmpgt_epi16(x, below));
+        if (0 != mask) {
+            return i + __builtin_ctz(mask) / 2;
+        }
+    }
+    return find_high_scalar(samples, i, count, level);
+}
+
+__attribute__((target("sse2")))
+static int find_low_sse2(const short *samples, int start, int count, 
+        int level) {
+    __m128i at = _mm_set1_epi16((short)level);
+    int i;
+    for (i = start; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(samples + i));
+        int mask = _mm_movemask_epi8(_mm_cmplt_epi16(x, at));
+        if (0 != mask) {
+            return i + __builtin_ctz(mask) / 2;
+        }
+    }
+    return find_low_scalar(samples, i, count, level);
+}
+#endif
+
+typedef int (*find_fn)(const short *, int, int, int);
+
+static find_fn get_find_high(void) {
+#ifdef OWON_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        return find_high_sse2;
+    }
+#endif
+    return find_high_scalar;
+}
+
+static find_fn get_find_low(void) {
+#ifdef OWON_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        return find_low_sse2;
+    }
+#endif
+    return find_low_scalar;
+}
+
+const char *owon_event_name(enum owon_event_kind kind) {
+    switch (kind) {
+        case OWON_EVENT_ABOVE:
+            return "above";
+        case OWON_EVENT_BELOW:
+            return "below";
+        case OWON_EVENT_RISING:
+            return "rising";
+        case OWON_EVENT_FALLING:
+            return "falling";
+        case OWON_EVENT_HIGH_PULSE:
+            return "high-pulse";
+        case OWON_EVENT_LOW_PULSE:
+            return "low-pulse";
+        default:
+            return "unknown";
+    }
+}
+
+// `sample` in mV, rounded as owon_convert_samples() does.
+static float to_mv(const struct owon_channel *channel, int sample) {
+    float value = sample * channel->volts_mul;
+    return value * channel->attenuation;
+}
+
+// The smallest raw sample of `channel` at or above `level` mV, limited to 
+// one past either end of the range of a short. Channels without a voltage
+// scale (FFT channels, or saved waves whose scale is not known) give 
+// OWON_ERROR_UNSUPPORTED.
+int owon_raw_level(const struct owon_channel *channel, float level, 
+        int *raw) {
+    double mul = (double)channel->volts_mul * channel->attenuation;
+    if (OWON_CHANNEL_FFT == channel->kind || !(mul > 0) || isnan(level)) {
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    double value = ceil(level / mul);
+    if (value > SHRT_MAX + 1) {
+        value = SHRT_MAX + 1;
+    } else if (value < SHRT_MIN) {
+        value = SHRT_MIN;
+    }
+    // The division is exact to within a sample; settle the boundary by the
+    // values the samples convert to, so a search agrees with the output of
+    // owonparse.
+    int sample = (int)value;
+    while (sample > SHRT_MIN && to_mv(channel, sample - 1) >= level) {
+        sample--;
+    }
+    while (sample <= SHRT_MAX && to_mv(channel, sample) < level) {
+        sample++;
+    }
+    *raw = sample;
+    return OWON_SUCCESS;
+}
+
+// Whether a run of `count` samples from `offset`, high or not, is an event
+// for `predicate`. `end` is the number of samples in the channel.
+static int is_event(const struct owon_predicate *predicate, 
+        const struct owon_channel *channel, int high, int offset, int count,
+        int end) {
+    int inside = offset > 0 && offset + count < end;
+    switch (predicate->kind) {
+        case OWON_EVENT_ABOVE:
+            return high;
+        case OWON_EVENT_BELOW:
+            return !high;
+        case OWON_EVENT_RISING:
+            return high && offset > 0;
+        case OWON_EVENT_FALLING:
+            return !high && offset > 0;
+        case OWON_EVENT_HIGH_PULSE:
+            return high && inside && 
+                (double)count * channel->time_mul < predicate->width;
+        case OWON_EVENT_LOW_PULSE:
+            return !high && inside && 
+                (double)count * channel->time_mul < predicate->width;
+        default:
+            return 0;
+    }
+}
+
+// Report each event for `predicate` on `channel`, which is taken to be the
+// channel the predicate names. Returns OWON_SUCCESS, OWON_ERROR if the 
+// callback stopped the search, or OWON_ERROR_UNSUPPORTED if the level 
+// can't be turned into a sample value.
+int owon_search_channel(const struct owon_channel *channel, 
+        const struct owon_predicate *predicate, 
+        owon_event_callback callback, void *user_data) {
+    int level;
+    int ret = owon_raw_level(channel, predicate->level, &level);
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+    find_fn find_high = get_find_high();
+    find_fn find_low = get_find_low();
+    int count = channel->sample_count;
+    int offset = 0;
+    while (offset < count) {
+        int high = channel->samples[offset] >= level;
+        int end;
+        if (high) {
+            end = (level <= SHRT_MIN) ? count : 
+                find_low(channel->samples, offset + 1, count, level);
+        } else {
+            end = (level > SHRT_MAX) ? count : 
+                find_high(channel->samples, offset + 1, count, level);
+        }
+        if (is_event(predicate, channel, high, offset, end - offset, 
+                    count) && 
+                0 != callback(predicate, channel, offset, end - offset, 
+                    user_data)) {
+            return OWON_ERROR;
+        }
+        offset = end;
+    }
+    return OWON_SUCCESS;
+}
+
+// Search every channel named by each of `predicates` in turn. Channels 
+// that can't be searched are skipped. Returns OWON_ERROR if the callback
+// stopped the search.
+int owon_search(const struct owon_capture *capture, 
+        const struct owon_predicate *predicates, int count, 
+        owon_event_callback callback, void *user_data) {
+    if (capture->windowed) {
+        return OWON_ERROR_UNSUPPORTED;
+    }
+    int i;
+    for (i = 0; i < count; i++) {
+        int chan_idx;
+        for (chan_idx = 0; chan_idx < capture->channel_count; chan_idx++) {
+            const struct owon_channel *channel = &capture->channels[chan_idx];
+            if (0 != strcmp(channel->name, predicates[i].channel)) {
+                continue;
+            }
+            if (OWON_ERROR == owon_search_channel(channel, &predicates[i],
+                        callback, user_data)) {
+                return OWON_ERROR;
+            }
+        }
+    }
+    return OWON_SUCCESS;
+}
@@ -0,0 +1,61 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef __OWON__SEARCH_H__
+#define __OWON__SEARCH_H__
+
+struct owon_channel;
+struct owon_capture;
+
+// What owon_search() looks for on a channel. The level divides the samples
+// into high (at or above it) and low (below it) runs.
+enum owon_event_kind {
+    OWON_EVENT_ABOVE,       // Each high run.
+    OWON_EVENT_BELOW,       // Each low run.
+    OWON_EVENT_RISING,      // Each high run after a low one.
+    OWON_EVENT_FALLING,     // Each low run after a high one.
+    OWON_EVENT_HIGH_PULSE,  // Each high run between low ones, narrower 
+                            // than the width.
+    OWON_EVENT_LOW_PULSE    // Each low run between high ones, narrower 
+                            // than the width.
+};
+
+struct owon_predicate {
+    enum owon_event_kind kind;
+    char channel[4];    // Name of the channel to search.
+    float level;        // mV
+    float width;        // us; pulses only.
+};
+
+// Called by owon_search() for each event: `count` samples of `channel` 
+// from sample `offset`. Return non-zero to stop searching.
+typedef int (*owon_event_callback)(const struct owon_predicate *predicate,
+        const struct owon_channel *channel, int offset, int count, 
+        void *user_data);
+
+const char *owon_event_name(enum owon_event_kind kind);
+int owon_raw_level(const struct owon_channel *channel, float level, 
+        int *raw);
+int owon_search_channel(const struct owon_channel *channel, 
+        const struct owon_predicate *predicate, 
+        owon_event_callback callback, void *user_data);
+int owon_search(const struct owon_capture *capture, 
+        const struct owon_predicate *predicates, int count, 
+        owon_event_callback callback, void *user_data);
+
+#endif // __OWON__SEARCH_H__
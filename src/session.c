@@ -0,0 +1,179 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "owon.h"
+#include "parse.h"
+#include "usb.h"
+#include "measure.h"
+#include "fft.h"
+#include "session.h"
+
+struct owon_session {
+    struct owon_arena arena;
+    struct owon_capture capture;
+    int parsed;             // `capture` holds a capture.
+    char *usb_buffer;       // Data from the last download.
+    size_t usb_capacity;
+    FILE *out;              // Memory stream for exports, reused so its 
+    char *out_data;         // buffer is kept between them.
+    size_t out_length;
+};
+
+void owon_export_defaults(struct owon_export_options *options) {
+    options->format = OWON_FORMAT_DELIM;
+    options->delim = "\t";
+    options->header = 1;
+    options->precision = OWON_DEFAULT_PRECISION;
+}
+
+// Write `capture` to `fp` in the format given by `options`.
+int owon_write(struct owon_capture const *capture, 
+        const struct owon_export_options *options, FILE *fp) {
+    switch (options->format) {
+        case OWON_FORMAT_DELIM:
+            return owon_write_delim_precision(capture, options->delim, "\n",
+                    options->header, options->precision, fp);
+        case OWON_FORMAT_F32:
+            return owon_write_f32(capture, fp);
+        case OWON_FORMAT_I16:
+            return owon_write_i16(capture, fp);
+        case OWON_FORMAT_NPY:
+            return owon_write_npy(capture, fp);
+        case OWON_FORMAT_SPECTRUM:
+            return owon_write_spectrum(capture, options->delim, "\n", 
+                    options->header, options->precision, fp);
+        case OWON_FORMAT_MEASURE:
+            return owon_write_measurements(capture, options->delim, "\n",
+                    options->header, fp);
+        default:
+            return OWON_ERROR_UNSUPPORTED;
+    }
+}
+
+struct owon_session *owon_session_new(void) {
+    struct owon_session *session = calloc(1, sizeof(*session));
+    if (NULL == session) {
+        return NULL;
+    }
+    owon_arena_init(&session->arena);
+    return session;
+}
+
+// Let go of the current capture, keeping its memory for the next one.
+static void release_capture(struct owon_session *session) {
+    if (session->parsed) {
+        owon_free_capture(&session->capture);
+        session->parsed = 0;
+    }
+}
+
+void owon_session_free(struct owon_session *session) {
+    if (NULL == session) {
+        return;
+    }
+    release_capture(session);
+    owon_arena_free(&session->arena);
+    free(session->usb_buffer);
+    if (NULL != session->out) {
+        fclose(session->out);
+    }
+    free(session->out_data);
+    free(session);
+}
+
+static int finish_parse(struct owon_session *session, int ret, 
+        const struct owon_capture **capture) {
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+    session->parsed = 1;
+    *capture = &session->capture;
+    return OWON_SUCCESS;
+}
+
+// Parse a capture held in memory into the session. Samples may be borrowed
+// from `data` (see owon_parse_buffer()), so it must be kept until the next 
+// capture. The capture is valid until the next parse or download.
+int owon_session_parse_buffer(struct owon_session *session, 
+        const void *data, size_t length, 
+        const struct owon_capture **capture) {
+    release_capture(session);
+    int ret = owon_parse_buffer_arena(&session->capture, data, length, 
+            &session->arena);
+    return finish_parse(session, ret, capture);
+}
+
+// Parse the capture in the file at `path` into the session. The capture is
+// valid until the next parse or download.
+int owon_session_parse_file(struct owon_session *session, const char *path,
+        const struct owon_capture **capture) {
+    release_capture(session);
+    int ret = owon_parse_file_arena(&session->capture, path, 
+            &session->arena);
+    return finish_parse(session, ret, capture);
+}
+
+// Download a capture from the device and parse it, reusing the session's
+// buffers. The capture is valid until the next parse or download.
+int owon_session_download(struct owon_session *session, 
+        struct owon_usb_handle *handle, const struct owon_capture **capture) {
+    release_capture(session);
+    long long length = owon_usb_read_into(handle, &session->usb_buffer, 
+            &session->usb_capacity);
+    if (0 > length) {
+        return (int)length;
+    }
+    int ret = owon_parse_buffer_arena(&session->capture, session->usb_buffer,
+            length, &session->arena);
+    return finish_parse(session, ret, capture);
+}
+
+// Export `capture` into memory owned by the session. `*data` is valid until
+// the next export; its buffer is reused rather than allocated each time. It
+// is null terminated at `*length`, so text formats can be used as strings.
+int owon_session_export(struct owon_session *session, 
+        struct owon_capture const *capture, 
+        const struct owon_export_options *options, const char **data, 
+        size_t *length) {
+    if (NULL == session->out) {
+        session->out = open_memstream(&session->out_data, 
+                &session->out_length);
+        if (NULL == session->out) {
+            return OWON_ERROR_MEMORY;
+        }
+    }
+    rewind(session->out);
+    int ret = owon_write(capture, options, session->out);
+    if (0 != fflush(session->out) && OWON_SUCCESS == ret) {
+        ret = OWON_ERROR_MEMORY;
+    }
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+    // Rewinding leaves any longer earlier export after the end, and the 
+    // stream only terminates the buffer at the end of everything written.
+    session->out_data[session->out_length] = '\0';
+    *data = session->out_data;
+    *length = session->out_length;
+    return OWON_SUCCESS;
+}
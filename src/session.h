@@ -0,0 +1,67 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef __OWON__SESSION_H__
+#define __OWON__SESSION_H__
+
+struct owon_capture;
+struct owon_usb_handle;
+
+// Output formats written by owon_write() and owon_session_export().
+enum owon_format {
+    OWON_FORMAT_DELIM,      // owon_write_delim_precision()
+    OWON_FORMAT_F32,        // owon_write_f32()
+    OWON_FORMAT_I16,        // owon_write_i16()
+    OWON_FORMAT_NPY,        // owon_write_npy()
+    OWON_FORMAT_SPECTRUM,   // owon_write_spectrum()
+    OWON_FORMAT_MEASURE     // owon_write_measurements()
+};
+
+struct owon_export_options {
+    enum owon_format format;
+    char *delim;            // For the delimited formats.
+    int header;
+    int precision;          // For delim and spectrum.
+};
+
+// Everything a program needs to handle one capture after another without
+// allocating for each: an arena to parse into, a buffer for data from the
+// device and a buffer for exported data. A session holds one capture at a
+// time; parsing or downloading another replaces it. Sessions are not 
+// shared between threads, but each thread can have its own.
+struct owon_session;
+
+void owon_export_defaults(struct owon_export_options *options);
+int owon_write(struct owon_capture const *capture, 
+        const struct owon_export_options *options, FILE *fp);
+struct owon_session *owon_session_new(void);
+void owon_session_free(struct owon_session *session);
+int owon_session_parse_buffer(struct owon_session *session, 
+        const void *data, size_t length, 
+        const struct owon_capture **capture);
+int owon_session_parse_file(struct owon_session *session, const char *path,
+        const struct owon_capture **capture);
+int owon_session_download(struct owon_session *session, 
+        struct owon_usb_handle *handle, const struct owon_capture **capture);
+int owon_session_export(struct owon_session *session, 
+        struct owon_capture const *capture, 
+        const struct owon_export_options *options, const char **data, 
+        size_t *length);
+
+#endif // __OWON__SESSION_H__
@@ -0,0 +1,284 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "owon.h"
+#include "parse.h"
+#include "usb.h"
+#include "sim.h"
+
+// Most channels in a generated capture.
+#define SIM_MAX_CHANNELS 6
+
+// A simulated oscilloscope: answers START like the real thing and then 
+// streams the next payload no faster than the configured bandwidth.
+
+enum {
+    SIM_IDLE,
+    SIM_RESPONSE,
+    SIM_DATA
+};
+
+struct sim_device {
+    const struct owon_sim_config *config;
+    int state;
+    int payload;        // Index of the payload being sent.
+    long long offset;   // Bytes of the payload sent so far.
+    long long length;   // Bytes to send for this capture.
+    struct timespec ready; // When the next transfer can complete.
+};
+
+static void add_ms(struct timespec *ts, double ms) {
+    long long ns = ts->tv_nsec + (long long)(ms * 1e6);
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+static void sleep_until(const struct timespec *ts) {
+    while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, ts, 
+                NULL)) {
+    }
+}
+
+static int sim_bulk_write(void *context, const char *bytes, int size, 
+        int timeout) {
+    struct sim_device *sim = context;
+    if (OWON_START_CMD_LEN == size && 
+            0 == memcmp(bytes, OWON_START_CMD, OWON_START_CMD_LEN)) {
+        sim->state = SIM_RESPONSE;
+        clock_gettime(CLOCK_MONOTONIC, &sim->ready);
+        add_ms(&sim->ready, sim->config->latency);
+    }
+    return size;
+}
+
+static int sim_bulk_read(void *context, char *bytes, int size, 
+        int timeout) {
+    struct sim_device *sim = context;
+    const struct owon_sim_config *config = sim->config;
+    const struct owon_sim_payload *payload = 
+        &config->payloads[sim->payload];
+
+    if (SIM_RESPONSE == sim->state) {
+        if (size < OWON_START_RESPONSE_LEN) {
+            return -EOVERFLOW;
+        }
+        sleep_until(&sim->ready);
+        struct owon_start_response response = config->response;
+        if (0 == response.length) {
+            response.length = payload->length;
+        }
+        memcpy(bytes, &response, OWON_START_RESPONSE_LEN);
+        sim->state = SIM_DATA;
+        sim->offset = 0;
+        sim->length = response.length;
+        return OWON_START_RESPONSE_LEN;
+    }
+
+    if (SIM_DATA == sim->state) {
+        int count = size;
+        if (sim->length - sim->offset < count) {
+            count = sim->length - sim->offset;
+        }
+        if (config->bandwidth > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (now.tv_sec > sim->ready.tv_sec || 
+                    (now.tv_sec == sim->ready.tv_sec && 
+                     now.tv_nsec > sim->ready.tv_nsec)) {
+                sim->ready = now;
+            }
+            add_ms(&sim->ready, count * 1000.0 / config->bandwidth);
+            sleep_until(&sim->ready);
+        }
+        // Anything past the end of the payload (when the response says 
+        // there is more) is sent as zeros.
+        int available = count;
+        if (payload->length - sim->offset < available) {
+            available = (payload->length > sim->offset) ? 
+                payload->length - sim->offset : 0;
+        }
+        memcpy(bytes, payload->data + sim->offset, available);
+        memset(bytes + available, 0, count - available);
+        sim->offset += count;
+        if (sim->offset >= sim->length) {
+            sim->state = SIM_IDLE;
+            sim->payload = (sim->payload + 1) % config->payload_count;
+        }
+        return count;
+    }
+
+    // Nothing to send: behave like a transfer that timed out.
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    add_ms(&deadline, timeout);
+    sleep_until(&deadline);
+    return -ETIMEDOUT;
+}
+
+static void sim_close(void *context) {
+    free(context);
+}
+
+static const struct owon_usb_backend sim_backend = {
+    sim_bulk_write,
+    sim_bulk_read,
+    sim_close,
+    NULL
+};
+
+// Open a simulated oscilloscope. `config` must have at least one payload 
+// and must outlive the handle.
+struct owon_usb_handle *owon_sim_open(const struct owon_sim_config *config) {
+    if (config->payload_count < 1) {
+        return NULL;
+    }
+    struct sim_device *sim = calloc(1, sizeof(*sim));
+    if (NULL == sim) {
+        return NULL;
+    }
+    sim->config = config;
+    sim->state = SIM_IDLE;
+    struct owon_usb_handle *handle = owon_usb_open_backend(&sim_backend, 
+            sim);
+    if (NULL == handle) {
+        free(sim);
+    }
+    return handle;
+}
+
+static int add_payload(struct owon_sim_config *config, char *data, 
+        int length) {
+    struct owon_sim_payload *payloads = realloc(config->payloads, 
+            (config->payload_count + 1) * sizeof(*payloads));
+    if (NULL == payloads) {
+        return OWON_ERROR_MEMORY;
+    }
+    payloads[config->payload_count].data = data;
+    payloads[config->payload_count].length = length;
+    config->payloads = payloads;
+    config->payload_count++;
+    return OWON_SUCCESS;
+}
+
+// Replay the file at `path` (as written by owondump) as a payload.
+int owon_sim_add_file(struct owon_sim_config *config, const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (NULL == fp) {
+        return OWON_ERROR_OPEN;
+    }
+    fseek(fp, 0, SEEK_END);
+    long length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (length <= 0) {
+        fclose(fp);
+        return OWON_ERROR_READ;
+    }
+    char *data = malloc(length);
+    if (NULL == data) {
+        fclose(fp);
+        return OWON_ERROR_MEMORY;
+    }
+    if (length != fread(data, sizeof(char), length, fp)) {
+        free(data);
+        fclose(fp);
+        return OWON_ERROR_READ;
+    }
+    fclose(fp);
+    int ret = add_payload(config, data, length);
+    if (OWON_SUCCESS != ret) {
+        free(data);
+    }
+    return ret;
+}
+
+// Add a generated waveform capture with `channels` channels of `samples` 
+// samples each: a sine wave, shifted in phase for each channel.
+int owon_sim_add_generated(struct owon_sim_config *config, int channels, 
+        int samples) {
+    if (channels < 1 || channels > SIM_MAX_CHANNELS || samples < 1) {
+        return OWON_ERROR;
+    }
+    int length = OWON_FILE_HEADER_SIZE + channels * 
+        (OWON_CHANNEL_HEADER_SIZE + samples * (int)sizeof(short));
+    char *data = malloc(length);
+    if (NULL == data) {
+        return OWON_ERROR_MEMORY;
+    }
+    memcpy(data, "SPBV11", 6);
+    memcpy(data + 6, &length, sizeof(int));
+
+    char *p = data + OWON_FILE_HEADER_SIZE;
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < channels; chan_idx++) {
+        // Fields of the raw channel header, in file order.
+        int ints[8] = {
+            samples * (int)sizeof(short) + 48, // length
+            samples,    // sample_count
+            samples,    // sample_screen
+            0,          // slow_scan_pos
+            9,          // time_div: 1 us
+            0,          // zero_point
+            8,          // volts_div: 1 V
+            1           // attenuation: x10
+        };
+        float floats[4] = {
+            0.04f,      // time_mul: 25 samples per division
+            1.0e4f,     // frequency
+            100.0f,     // period
+            40.0f       // volts_mul
+        };
+        char name[3] = {'C', 'H', '1' + chan_idx};
+        memcpy(p, name, sizeof(name));
+        p += sizeof(name);
+        memcpy(p, ints, sizeof(ints));
+        p += sizeof(ints);
+        memcpy(p, floats, sizeof(floats));
+        p += sizeof(floats);
+
+        // 2500 samples per period to match the frequency above.
+        int i;
+        for (i = 0; i < samples; i++) {
+            short sample = (short)(100.0 * sin(2.0 * M_PI * i / 2500.0 + 
+                        chan_idx * M_PI / 2.0));
+            memcpy(p, &sample, sizeof(short));
+            p += sizeof(short);
+        }
+    }
+
+    int ret = add_payload(config, data, length);
+    if (OWON_SUCCESS != ret) {
+        free(data);
+    }
+    return ret;
+}
+
+void owon_sim_free_config(struct owon_sim_config *config) {
+    while (config->payload_count--) {
+        free(config->payloads[config->payload_count].data);
+    }
+    free(config->payloads);
+    config->payloads = NULL;
+    config->payload_count = 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef __OWON__SIM_H__
+#define __OWON__SIM_H__
+
+#include "usb.h"
+
+// Data sent by the simulated oscilloscope for one capture.
+struct owon_sim_payload {
+    char *data;
+    int length;
+};
+
+struct owon_sim_config {
+    struct owon_sim_payload *payloads; // Sent in turn, one per START.
+    int payload_count;
+    struct owon_start_response response; // Sent in reply to START. A 
+                                         // length of 0 means the length of
+                                         // the payload.
+    long bandwidth;  // Bytes per second, or 0 for no limit.
+    long latency;    // Milliseconds between START and the response.
+};
+
+int owon_sim_add_file(struct owon_sim_config *config, const char *path);
+int owon_sim_add_generated(struct owon_sim_config *config, int channels, 
+        int samples);
+void owon_sim_free_config(struct owon_sim_config *config);
+struct owon_usb_handle *owon_sim_open(const struct owon_sim_config *config);
+
+#endif // __OWON__SIM_H__
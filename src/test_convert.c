@@ -0,0 +1,155 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// Checks each version of the sample conversion in convert.c against the 
+// scalar formula, over unaligned starts and lengths that leave every 
+// possible tail. Run with `make check`.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// The versions are static, so build them into this program.
+#include "convert.c"
+
+// Largest start offset and length tried; longer than a few vectors so every
+// loop runs several times before its tail.
+#define MAX_OFFSET 17
+#define MAX_LENGTH 70
+
+// A long run as well, as converted for a real capture.
+#define LONG_LENGTH 10007
+
+struct version {
+    const char *name;
+    convert_fn convert;
+    const char *cpu;    // Feature the version needs, or NULL.
+};
+
+static const struct version versions[] = {
+    {"scalar", convert_scalar, NULL},
+#ifdef OWON_X86_SIMD
+    {"sse2", convert_sse2, "sse2"},
+    {"avx2", convert_avx2, "avx2"},
+#endif
+    {"dispatch", owon_convert_samples, NULL}
+};
+
+static int supported(const struct version *version) {
+    if (NULL == version->cpu) {
+        return 1;
+    }
+#ifdef OWON_X86_SIMD
+    __builtin_cpu_init();
+    if (0 == strcmp(version->cpu, "sse2")) {
+        return __builtin_cpu_supports("sse2");
+    } else if (0 == strcmp(version->cpu, "avx2")) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return 0;
+}
+
+// Convert `count` samples from `offset` and compare every value, and the 
+// floats either side of the output, with the formula.
+static int check(const struct version *version, const short *samples, 
+        int offset, int count, float volts_mul, float attenuation, 
+        float *values) {
+    const float guard = -12345.5f;
+    int i;
+    for (i = 0; i < count + 2; i++) {
+        values[i] = guard;
+    }
+    version->convert(samples + offset, count, volts_mul, attenuation, 
+            values + 1);
+    if (guard != values[0] || guard != values[count + 1]) {
+        printf("%s: offset %d, length %d: wrote outside the output\n", 
+                version->name, offset, count);
+        return 1;
+    }
+    for (i = 0; i < count; i++) {
+        float expected = samples[offset + i] * volts_mul * attenuation;
+        if (0 != memcmp(&expected, &values[i + 1], sizeof(float))) {
+            printf("%s: offset %d, length %d, volts_mul %g, attenuation %g:"
+                    " sample %d (%d) gave %.9g, expected %.9g\n", 
+                    version->name, offset, count, volts_mul, attenuation, 
+                    i, samples[offset + i], values[i + 1], expected);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    // Scales of the kind found in captures, including ones that don't 
+    // divide evenly in binary.
+    const float volts_muls[] = {0.04f, 0.2f, 1.0f, 2.0f, 80.0f, 200.0f, 
+        -0.4f};
+    const float attenuations[] = {1.0f, 10.0f, 100.0f, 1000.0f, 0.1f};
+    int scales = sizeof(volts_muls) / sizeof(volts_muls[0]);
+    int attens = sizeof(attenuations) / sizeof(attenuations[0]);
+
+    short *samples = malloc((MAX_OFFSET + LONG_LENGTH) * sizeof(short));
+    float *values = malloc((LONG_LENGTH + 2) * sizeof(float));
+    if (NULL == samples || NULL == values) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    // Both ends of the range, then a spread of other values.
+    srand(1);
+    samples[0] = -32768;
+    samples[1] = 32767;
+    samples[2] = 0;
+    samples[3] = -1;
+    int i;
+    for (i = 4; i < MAX_OFFSET + LONG_LENGTH; i++) {
+        samples[i] = (short)(rand() & 0xffff);
+    }
+
+    int failed = 0;
+    int v;
+    for (v = 0; v < (int)(sizeof(versions) / sizeof(versions[0])); v++) {
+        const struct version *version = &versions[v];
+        if (!supported(version)) {
+            printf("%s: not supported by this CPU, skipped\n", 
+                    version->name);
+            continue;
+        }
+        int errors = 0;
+        int s, a;
+        for (s = 0; s < scales; s++) {
+            for (a = 0; a < attens; a++) {
+                int offset, count;
+                for (offset = 0; offset <= MAX_OFFSET; offset++) {
+                    for (count = 0; count <= MAX_LENGTH; count++) {
+                        errors += check(version, samples, offset, count, 
+                                volts_muls[s], attenuations[a], values);
+                    }
+                }
+                errors += check(version, samples, 1, LONG_LENGTH, 
+                        volts_muls[s], attenuations[a], values);
+            }
+        }
+        printf("%s: %s\n", version->name, (0 == errors) ? "ok" : "FAILED");
+        failed += errors;
+    }
+
+    free(samples);
+    free(values);
+    return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,196 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+// Checks that captures with more channels than the parser first makes room
+// for (OWON_INITIAL_CHANNELS) come out the same from every way of reading 
+// them: parsed from an aligned or a misaligned buffer, and opened windowed,
+// where the samples must stay NULL while the channel table grows. Run with 
+// `make check`.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "owon.h"
+#include "parse.h"
+
+#define CHANNELS (OWON_INITIAL_CHANNELS + 2)
+
+static void put_int(char *p, int v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+static void put_float(char *p, float v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+// Build a capture with CHANNELS channels of different lengths into `data`
+// (with room for it), returning its length.
+static size_t make_capture(char *data) {
+    size_t offset = OWON_FILE_HEADER_SIZE;
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < CHANNELS; chan_idx++) {
+        int count = 100 + 7 * chan_idx;
+        char *header = data + offset;
+        snprintf(header, 4, "CH%d", chan_idx + 1);
+        put_int(header + 3, 48 + 2 * count);    // length
+        put_int(header + 7, count);             // samples
+        put_int(header + 11, count);            // samples on screen
+        put_int(header + 15, 0);                // slow scan position
+        put_int(header + 19, 10);               // time/div
+        put_int(header + 23, 0);                // zero point
+        put_int(header + 27, 8);                // volts/div
+        put_int(header + 31, 0);                // attenuation
+        put_float(header + 35, 0.4f);           // time multiplier
+        put_float(header + 39, 1000.0f);        // frequency
+        put_float(header + 43, 1000.0f);        // period
+        put_float(header + 47, 40.0f);          // volts multiplier
+        offset += OWON_CHANNEL_HEADER_SIZE;
+        int i;
+        for (i = 0; i < count; i++) {
+            short sample = (short)(i * (chan_idx + 1) - 50);
+            memcpy(data + offset, &sample, sizeof(sample));
+            offset += sizeof(sample);
+        }
+    }
+    memcpy(data, "SPBV11", 6);
+    put_int(data + 6, (int)offset);
+    return offset;
+}
+
+// Write `capture` as f32, for comparing captures read different ways.
+static char *to_f32(const struct owon_capture *capture, size_t *length) {
+    char *out = NULL;
+    FILE *fp = open_memstream(&out, length);
+    if (NULL == fp) {
+        return NULL;
+    }
+    int ret = owon_write_f32(capture, fp);
+    fclose(fp);
+    if (OWON_SUCCESS != ret) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+// Compare `capture`, read as `how`, with `expected` in f32.
+static int check(const char *how, const struct owon_capture *capture, 
+        const char *expected, size_t expected_length) {
+    if (CHANNELS != capture->channel_count) {
+        printf("%s: %d channels, expected %d\n", how, 
+                capture->channel_count, CHANNELS);
+        return 1;
+    }
+    int chan_idx;
+    for (chan_idx = 0; chan_idx < CHANNELS; chan_idx++) {
+        const struct owon_channel *channel = &capture->channels[chan_idx];
+        if (capture->windowed && NULL != channel->samples) {
+            printf("%s: %s has samples %p, expected NULL\n", how, 
+                    channel->name, (void *)channel->samples);
+            return 1;
+        }
+        if (100 + 7 * chan_idx != channel->sample_count) {
+            printf("%s: %s has %d samples\n", how, channel->name, 
+                    channel->sample_count);
+            return 1;
+        }
+    }
+    size_t length;
+    char *values = to_f32(capture, &length);
+    int same = NULL != values && length == expected_length && 
+        0 == memcmp(values, expected, length);
+    free(values);
+    if (!same) {
+        printf("%s: samples differ\n", how);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    // Room for the capture and a byte more, so it can be moved to an odd 
+    // address.
+    char *buffer = malloc(1 << 16);
+    if (NULL == buffer) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    size_t length = make_capture(buffer);
+    int failed = 0;
+
+    struct owon_capture capture;
+    if (OWON_SUCCESS != owon_parse_buffer(&capture, buffer, length)) {
+        printf("buffer: not parsed\n");
+        free(buffer);
+        return EXIT_FAILURE;
+    }
+    size_t expected_length;
+    char *expected = to_f32(&capture, &expected_length);
+    failed += check("buffer", &capture, expected, expected_length);
+    owon_free_capture(&capture);
+
+    // Misaligned, so every channel is copied into the arena as it grows.
+    memmove(buffer + 1, buffer, length);
+    if (OWON_SUCCESS != owon_parse_buffer(&capture, buffer + 1, length)) {
+        printf("misaligned buffer: not parsed\n");
+        failed++;
+    } else {
+        failed += check("misaligned buffer", &capture, expected, 
+                expected_length);
+        owon_free_capture(&capture);
+    }
+
+    char path[] = "/tmp/test_parse-XXXXXX";
+    int fd = mkstemp(path);
+    FILE *fp = (fd < 0) ? NULL : fdopen(fd, "wb");
+    if (NULL == fp || length != fwrite(buffer + 1, 1, length, fp) || 
+            0 != fclose(fp)) {
+        printf("Unable to write %s\n", path);
+        failed++;
+    } else {
+        if (OWON_SUCCESS != owon_open_capture(&capture, path)) {
+            printf("windowed: not opened\n");
+            failed++;
+        } else if (!capture.windowed) {
+            printf("windowed: not windowed\n");
+            owon_free_capture(&capture);
+            failed++;
+        } else {
+            failed += check("windowed", &capture, expected, 
+                    expected_length);
+            owon_free_capture(&capture);
+        }
+        if (OWON_SUCCESS != owon_parse_file(&capture, path)) {
+            printf("file: not parsed\n");
+            failed++;
+        } else {
+            failed += check("file", &capture, expected, expected_length);
+            owon_free_capture(&capture);
+        }
+    }
+    if (fd >= 0) {
+        unlink(path);
+    }
+
+    printf("%d channels: %s\n", CHANNELS, (0 == failed) ? "ok" : "FAILED");
+    free(expected);
+    free(buffer);
+    return (0 == failed) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -16,6 +16,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 
+#include <stdlib.h>
+#include <stdint.h>
 #ifdef WIN32
 #include <lusb0_usb.h>
 #else
@@ -48,30 +50,114 @@ struct usb_device *owon_usb_get_device() {
     return NULL;
 }
 
-/* TODO
+// Find every attached oscilloscope. Returns a NULL-terminated array, 
+// which the caller must free(), or NULL if memory can't be allocated.
 struct usb_device **owon_usb_get_devices() {
-    return NULL;
+    usb_find_busses();
+    usb_find_devices();
+
+    struct usb_bus *bus;
+    struct usb_device *dev;
+    int count = 0;
+
+    for (bus = usb_get_busses(); bus; bus = bus->next) {
+        for (dev = bus->devices; dev; dev = dev->next) {
+            if (dev->descriptor.idVendor == OWON_USB_VENDOR_ID &&
+                    dev->descriptor.idProduct == OWON_USB_PRODUCT_ID) {
+                count++;
+            }
+        }
+    }
+
+    struct usb_device **devices = calloc(count + 1, sizeof(*devices));
+    if (NULL == devices) {
+        return NULL;
+    }
+    count = 0;
+    for (bus = usb_get_busses(); bus; bus = bus->next) {
+        for (dev = bus->devices; dev; dev = dev->next) {
+            if (dev->descriptor.idVendor == OWON_USB_VENDOR_ID &&
+                    dev->descriptor.idProduct == OWON_USB_PRODUCT_ID) {
+                devices[count++] = dev;
+            }
+        }
+    }
+
+    return devices;
+}
+
+// Get the bus number and device address of `dev`, as shown by lsusb.
+void owon_usb_get_location(struct usb_device *dev, int *bus, int *address) {
+    *bus = atoi(dev->bus->dirname);
+    *address = dev->devnum;
+}
+
+static int usb0_bulk_write(void *context, const char *bytes, int size, 
+        int timeout) {
+    return usb_bulk_write(context, OWON_USB_ENDPOINT_OUT, (char *)bytes, 
+            size, timeout);
+}
+
+static int usb0_bulk_read(void *context, char *bytes, int size, 
+        int timeout) {
+    return usb_bulk_read(context, OWON_USB_ENDPOINT_IN, bytes, size, 
+            timeout);
 }
-*/
 
-struct usb_dev_handle *owon_usb_open(struct usb_device *dev) {
+static void usb0_close(void *context) {
+    usb_release_interface(context, OWON_USB_INTERFACE);
+    usb_close(context);
+}
+
+static const struct owon_usb_backend usb0_backend = {
+    usb0_bulk_write,
+    usb0_bulk_read,
+    usb0_close,
+    NULL
+};
+
+struct owon_usb_handle *owon_usb_open(struct usb_device *dev) {
     struct usb_dev_handle *dev_handle = usb_open(dev);
+    if (NULL == dev_handle) {
+        return NULL;
+    }
     int ret;
     ret = usb_set_configuration(dev_handle, OWON_USB_CONFIGURATION);
     ret = usb_claim_interface(dev_handle, OWON_USB_INTERFACE);
     //ret = usb_clear_halt(dev_handle, OWON_USB_ENDPOINT_IN);
     //ret = usb_clear_halt(dev_handle, OWON_USB_ENDPOINT_OUT);
     if (0 > ret) {
+        usb_close(dev_handle);
+        return NULL;
+    }
+    struct owon_usb_handle *handle = 
+        owon_usb_open_backend(&usb0_backend, dev_handle);
+    if (NULL == handle) {
+        usb0_close(dev_handle);
+    }
+    return handle;
+}
+
+// Wrap an already open transport in a handle. `backend->close` is called 
+// with `context` by owon_usb_close().
+struct owon_usb_handle *owon_usb_open_backend(
+        const struct owon_usb_backend *backend, void *context) {
+    struct owon_usb_handle *handle = malloc(sizeof(*handle));
+    if (NULL == handle) {
         return NULL;
     }
-    return dev_handle;
+    handle->backend = backend;
+    handle->context = context;
+    return handle;
 }
 
-int owon_usb_read(struct usb_dev_handle *dev_handle, char **buffer) {
+// Send the START command and read the device's response, which gives the
+// length of the data that follows.
+int owon_usb_start(struct owon_usb_handle *handle, 
+        struct owon_start_response *start_response) {
     // Send the START command.
     int ret;
-    ret = usb_bulk_write(dev_handle, 
-            OWON_USB_ENDPOINT_OUT, 
+    ret = handle->backend->bulk_write(handle->context, 
             OWON_START_CMD, 
             OWON_START_CMD_LEN, 
             OWON_USB_TRANSFER_TIMEOUT);
@@ -80,37 +166,149 @@ int owon_usb_read(struct usb_dev_handle *dev_handle, char **buffer) {
     }
 
     // Get the response back.
-    struct owon_start_response start_response;
-    ret = usb_bulk_read(dev_handle, 
-            OWON_USB_ENDPOINT_IN, 
-            (char *)&start_response, 
+    ret = handle->backend->bulk_read(handle->context, 
+            (char *)start_response, 
             OWON_START_RESPONSE_LEN, 
             OWON_USB_TRANSFER_TIMEOUT);
     if (OWON_START_RESPONSE_LEN != ret) {
         return OWON_ERROR_USB;
     }
+    return OWON_SUCCESS;
+}
 
-    // Allocate enough memory to hold the data from the ocilloscope.
-    *buffer = malloc(start_response.length);
-    if (NULL == *buffer) {
-        return OWON_ERROR_MEMORY;
+// Read the next chunk of at most `size` bytes into `chunk`. Returns the 
+// number of bytes read, which may be less than `size`.
+static int read_chunk(struct owon_usb_handle *handle, char *chunk, 
+        int size) {
+    if (size > OWON_USB_CHUNK_SIZE) {
+        size = OWON_USB_CHUNK_SIZE;
     }
-   
-    // Read the data from the ocilloscope.
-    ret = usb_bulk_read(dev_handle, 
-            OWON_USB_ENDPOINT_IN, 
-            *buffer, 
-            start_response.length, 
+    int ret = handle->backend->bulk_read(handle->context, 
+            chunk, 
+            size, 
             OWON_USB_TRANSFER_TIMEOUT);
-    if (start_response.length != ret) {
+    if (0 >= ret) {
         return OWON_ERROR_USB;
     }
+    return ret;
+}
+
+long long owon_usb_read(struct owon_usb_handle *handle, char **buffer) {
+    size_t capacity = 0;
+    *buffer = NULL;
+    long long ret = owon_usb_read_into(handle, buffer, &capacity);
+    if (0 > ret) {
+        free(*buffer);
+        *buffer = NULL;
+    }
+    return ret;
+}
+
+// The length of the data following a START response. The field is 
+// unsigned 32-bit, so deep-memory captures may be over 2 GB.
+static long long data_length(const struct owon_start_response *response) {
+    return response->length;
+}
 
-    return start_response.length; 
+// As owon_usb_read(), but reuse `*buffer`, which holds `*capacity` bytes, 
+// growing it only when the data does not fit. Both may start as NULL and 
+// 0. The buffer belongs to the caller even on failure.
+long long owon_usb_read_into(struct owon_usb_handle *handle, char **buffer,
+        size_t *capacity) {
+    struct owon_start_response start_response;
+    int ret = owon_usb_start(handle, &start_response);
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+
+    // Make sure there is enough memory to hold the data from the 
+    // ocilloscope.
+    long long length = data_length(&start_response);
+    if ((unsigned long long)length > SIZE_MAX) {
+        return OWON_ERROR_MEMORY;
+    }
+    if (NULL == *buffer || *capacity < (size_t)length) {
+        char *larger = realloc(*buffer, length > 0 ? (size_t)length : 1);
+        if (NULL == larger) {
+            return OWON_ERROR_MEMORY;
+        }
+        *buffer = larger;
+        *capacity = length;
+    }
+   
+    if (NULL != handle->backend->read_data) {
+        ret = handle->backend->read_data(handle->context, *buffer, length, 
+                OWON_USB_TRANSFER_TIMEOUT);
+        if (0 > ret) {
+            return ret;
+        }
+        return length;
+    }
+
+    // Read the data from the ocilloscope, a chunk at a time.
+    long long offset = 0;
+    while (offset < length) {
+        long long left = length - offset;
+        ret = read_chunk(handle, *buffer + offset, 
+                left > OWON_USB_CHUNK_SIZE ? OWON_USB_CHUNK_SIZE : left);
+        if (0 > ret) {
+            return ret;
+        }
+        offset += ret;
+    }
+
+    return length; 
+}
+
+// Download data from the device without holding all of it in memory: each
+// chunk is read into `chunk` (`chunk_size` bytes, allocated here if NULL) 
+// and passed to `callback` before the next one is read. Returns the length
+// of the data, or an error.
+long long owon_usb_read_stream(struct owon_usb_handle *handle, char *chunk, 
+        int chunk_size, owon_usb_chunk_callback callback, void *user_data) {
+    if (0 >= chunk_size) {
+        return OWON_ERROR;
+    }
+
+    struct owon_start_response start_response;
+    int ret = owon_usb_start(handle, &start_response);
+    if (OWON_SUCCESS != ret) {
+        return ret;
+    }
+    long long length = data_length(&start_response);
+
+    char *own_chunk = NULL;
+    if (NULL == chunk) {
+        chunk = own_chunk = malloc(chunk_size);
+        if (NULL == chunk) {
+            return OWON_ERROR_MEMORY;
+        }
+    }
+
+    long long offset = 0;
+    while (offset < length) {
+        long long left = length - offset;
+        ret = read_chunk(handle, chunk, 
+                left > chunk_size ? chunk_size : left);
+        if (0 > ret) {
+            break;
+        }
+        if (0 != callback(chunk, ret, offset, length, user_data)) {
+            ret = OWON_ERROR;
+            break;
+        }
+        offset += ret;
+    }
+
+    free(own_chunk);
+    if (0 > ret) {
+        return ret;
+    }
+    return length;
 }
 
-void owon_usb_close(struct usb_dev_handle *dev_handle) {
-    usb_release_interface(dev_handle, OWON_USB_INTERFACE);
-    usb_close(dev_handle);
+void owon_usb_close(struct owon_usb_handle *handle) {
+    handle->backend->close(handle->context);
+    free(handle);
 }
 
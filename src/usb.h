@@ -35,6 +35,12 @@
 // Transfer timout in milliseconds
 #define OWON_USB_TRANSFER_TIMEOUT 2000    
 
+// Size of each bulk read when downloading data, in bytes. Must be a 
+// multiple of the endpoint's maximum packet size. Each chunk gets its own
+// OWON_USB_TRANSFER_TIMEOUT, so large captures no longer have to arrive 
+// within a single timeout.
+#define OWON_USB_CHUNK_SIZE 16384
+
 // Command to initiate download
 #define OWON_START_CMD "START" 
 
@@ -50,11 +56,52 @@ struct owon_start_response {
     unsigned int bitmap; // 0 for waveform, 1 for bitmap
 };
 
+// Called by owon_usb_read_stream() for each chunk as it arrives. `offset` 
+// is the position of the chunk within the data and `total` is the length 
+// of the data. Return non-zero to abort the transfer.
+typedef int (*owon_usb_chunk_callback)(const char *chunk, int length, 
+        long long offset, long long total, void *user_data);
+
+// Transport used to talk to the oscilloscope: libusb for real devices, or 
+// a simulation (see sim.h). Writes go to OWON_USB_ENDPOINT_OUT and reads 
+// come from OWON_USB_ENDPOINT_IN. Both return the number of bytes 
+// transferred, or a negative value on error.
+//
+// `read_data` is optional: it reads all `length` bytes of data following 
+// the START response, so a backend can keep several transfers in flight.
+// When it is NULL, the data is read with `bulk_read` a chunk at a time.
+// It returns OWON_SUCCESS or a negative error; the length comes from the 
+// unsigned 32-bit field of the START response, so it can be more than an 
+// int holds.
+struct owon_usb_backend {
+    int (*bulk_write)(void *context, const char *bytes, int size, 
+            int timeout);
+    int (*bulk_read)(void *context, char *bytes, int size, int timeout);
+    void (*close)(void *context);
+    int (*read_data)(void *context, char *buffer, long long length, 
+            int timeout);
+};
+
+// An open oscilloscope.
+struct owon_usb_handle {
+    const struct owon_usb_backend *backend;
+    void *context;
+};
+
 void owon_usb_init(void);
 struct usb_device *owon_usb_get_device(void);
-//TODO: struct usb_device **owon_usb_get_devices(void);
-struct usb_dev_handle *owon_usb_open(struct usb_device *dev);
-int owon_usb_read(struct usb_dev_handle *dev_handle, char **buffer);
-void owon_usb_close(struct usb_dev_handle *dev_handle);
+struct usb_device **owon_usb_get_devices(void);
+void owon_usb_get_location(struct usb_device *dev, int *bus, int *address);
+struct owon_usb_handle *owon_usb_open(struct usb_device *dev);
+struct owon_usb_handle *owon_usb_open_backend(
+        const struct owon_usb_backend *backend, void *context);
+int owon_usb_start(struct owon_usb_handle *handle, 
+        struct owon_start_response *start_response);
+long long owon_usb_read(struct owon_usb_handle *handle, char **buffer);
+long long owon_usb_read_into(struct owon_usb_handle *handle, char **buffer,
+        size_t *capacity);
+long long owon_usb_read_stream(struct owon_usb_handle *handle, char *chunk, 
+        int chunk_size, owon_usb_chunk_callback callback, void *user_data);
+void owon_usb_close(struct owon_usb_handle *handle);
 
 #endif // __OWON__USB_H__
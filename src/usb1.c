@@ -0,0 +1,264 @@
+/*
+ * owon-utils - a set of programs to use with OWON Oscilloscopes
+ * Copyright (c) 2012  Lana Larsen <lana@stoatly.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <libusb.h>
+
+#include "owon.h"
+#include "usb.h"
+#include "usb1.h"
+
+// Backend built on the asynchronous libusb-1.0 API. START and its response
+// use synchronous transfers; the data that follows is read with 
+// OWON_USB1_TRANSFERS bulk transfers in flight at once, so the host always
+// has a request queued when the device has more to send. A thread handles
+// libusb events for as long as the device is open.
+
+struct usb1_device {
+    libusb_context *ctx;
+    libusb_device_handle *dev_handle;
+    pthread_t event_thread;
+    volatile int running;
+};
+
+// State of one call to usb1_read_data(), shared with transfer callbacks.
+struct usb1_read {
+    char *buffer;
+    long long length;
+    long long next;     // Offset of the next chunk to request.
+    int in_flight;
+    int status;         // OWON_SUCCESS, or the first error seen.
+    struct libusb_transfer *transfers[OWON_USB1_TRANSFERS];
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+};
+
+static void *event_main(void *arg) {
+    struct usb1_device *usb1 = arg;
+    while (usb1->running) {
+        struct timeval timeout = {0, 100000};
+        libusb_handle_events_timeout_completed(usb1->ctx, &timeout, NULL);
+    }
+    return NULL;
+}
+
+static int usb1_bulk_write(void *context, const char *bytes, int size, 
+        int timeout) {
+    struct usb1_device *usb1 = context;
+    int transferred = 0;
+    int ret = libusb_bulk_transfer(usb1->dev_handle, OWON_USB_ENDPOINT_OUT, 
+            (unsigned char *)bytes, size, &transferred, timeout);
+    return (0 > ret) ? ret : transferred;
+}
+
+static int usb1_bulk_read(void *context, char *bytes, int size, 
+        int timeout) {
+    struct usb1_device *usb1 = context;
+    int transferred = 0;
+    int ret = libusb_bulk_transfer(usb1->dev_handle, OWON_USB_ENDPOINT_IN, 
+            (unsigned char *)bytes, size, &transferred, timeout);
+    return (0 > ret) ? ret : transferred;
+}
+
+// Point `transfer` at the next chunk of the buffer and submit it. Called 
+// with the mutex held.
+static int submit_next(struct usb1_read *read, 
+        struct libusb_transfer *transfer) {
+    int size = OWON_USB_CHUNK_SIZE;
+    if (read->length - read->next < size) {
+        size = read->length - read->next;
+    }
+    transfer->buffer = (unsigned char *)read->buffer + read->next;
+    transfer->length = size;
+    if (0 > libusb_submit_transfer(transfer)) {
+        return OWON_ERROR_USB;
+    }
+    read->next += size;
+    read->in_flight++;
+    return OWON_SUCCESS;
+}
+
+static void LIBUSB_CALL transfer_done(struct libusb_transfer *transfer) {
+    struct usb1_read *read = transfer->user_data;
+    pthread_mutex_lock(&read->mutex);
+    read->in_flight--;
+    if (OWON_SUCCESS == read->status) {
+        // Each chunk was sized to what is left, so anything short is an 
+        // error rather than the end of the data.
+        if (LIBUSB_TRANSFER_COMPLETED != transfer->status || 
+                transfer->actual_length != transfer->length) {
+            read->status = OWON_ERROR_USB;
+        } else if (read->next < read->length) {
+            read->status = submit_next(read, transfer);
+        }
+        if (OWON_SUCCESS != read->status) {
+            int i;
+            for (i = 0; i < OWON_USB1_TRANSFERS; i++) {
+                if (transfer != read->transfers[i]) {
+                    libusb_cancel_transfer(read->transfers[i]);
+                }
+            }
+        }
+    }
+    if (0 == read->in_flight) {
+        pthread_cond_signal(&read->done);
+    }
+    pthread_mutex_unlock(&read->mutex);
+}
+
+static int usb1_read_data(void *context, char *buffer, long long length,
+        int timeout) {
+    struct usb1_device *usb1 = context;
+    struct usb1_read read;
+    memset(&read, 0, sizeof(read));
+    read.buffer = buffer;
+    read.length = length;
+    read.status = OWON_SUCCESS;
+    pthread_mutex_init(&read.mutex, NULL);
+    pthread_cond_init(&read.done, NULL);
+
+    int i;
+    for (i = 0; i < OWON_USB1_TRANSFERS; i++) {
+        read.transfers[i] = libusb_alloc_transfer(0);
+        if (NULL == read.transfers[i]) {
+            read.status = OWON_ERROR_MEMORY;
+            break;
+        }
+        libusb_fill_bulk_transfer(read.transfers[i], usb1->dev_handle, 
+                OWON_USB_ENDPOINT_IN, NULL, 0, transfer_done, &read, 
+                timeout);
+    }
+
+    pthread_mutex_lock(&read.mutex);
+    for (i = 0; OWON_SUCCESS == read.status && i < OWON_USB1_TRANSFERS &&
+            read.next < read.length; i++) {
+        read.status = submit_next(&read, read.transfers[i]);
+    }
+    // Transfers already submitted are cancelled by the callback on error,
+    // so this always ends with nothing in flight.
+    if (OWON_SUCCESS != read.status) {
+        for (i = 0; i < OWON_USB1_TRANSFERS; i++) {
+            if (NULL != read.transfers[i]) {
+                libusb_cancel_transfer(read.transfers[i]);
+            }
+        }
+    }
+    while (read.in_flight > 0) {
+        pthread_cond_wait(&read.done, &read.mutex);
+    }
+    pthread_mutex_unlock(&read.mutex);
+
+    for (i = 0; i < OWON_USB1_TRANSFERS; i++) {
+        libusb_free_transfer(read.transfers[i]);
+    }
+    pthread_cond_destroy(&read.done);
+    pthread_mutex_destroy(&read.mutex);
+    return read.status;
+}
+
+static void usb1_close(void *context) {
+    struct usb1_device *usb1 = context;
+    usb1->running = 0;
+    libusb_release_interface(usb1->dev_handle, OWON_USB_INTERFACE);
+    // Closing the device wakes up the event thread.
+    libusb_close(usb1->dev_handle);
+    pthread_join(usb1->event_thread, NULL);
+    libusb_exit(usb1->ctx);
+    free(usb1);
+}
+
+static const struct owon_usb_backend usb1_backend = {
+    usb1_bulk_write,
+    usb1_bulk_read,
+    usb1_close,
+    usb1_read_data
+};
+
+// Find the oscilloscope at `bus` and `address`, or the first one if `bus`
+// is negative.
+static libusb_device_handle *open_device(libusb_context *ctx, int bus, 
+        int address) {
+    libusb_device **list;
+    ssize_t count = libusb_get_device_list(ctx, &list);
+    if (0 > count) {
+        return NULL;
+    }
+    libusb_device_handle *dev_handle = NULL;
+    ssize_t i;
+    for (i = 0; i < count && NULL == dev_handle; i++) {
+        struct libusb_device_descriptor desc;
+        if (0 != libusb_get_device_descriptor(list[i], &desc) ||
+                desc.idVendor != OWON_USB_VENDOR_ID ||
+                desc.idProduct != OWON_USB_PRODUCT_ID) {
+            continue;
+        }
+        if (0 <= bus && (libusb_get_bus_number(list[i]) != bus ||
+                    libusb_get_device_address(list[i]) != address)) {
+            continue;
+        }
+        if (0 != libusb_open(list[i], &dev_handle)) {
+            dev_handle = NULL;
+        }
+    }
+    libusb_free_device_list(list, 1);
+    return dev_handle;
+}
+
+// Open the oscilloscope at `bus` and `address` (or the first one found if 
+// `bus` is negative) with the asynchronous libusb-1.0 backend.
+struct owon_usb_handle *owon_usb1_open(int bus, int address) {
+    struct usb1_device *usb1 = calloc(1, sizeof(*usb1));
+    if (NULL == usb1) {
+        return NULL;
+    }
+    if (0 != libusb_init(&usb1->ctx)) {
+        free(usb1);
+        return NULL;
+    }
+    usb1->dev_handle = open_device(usb1->ctx, bus, address);
+    if (NULL == usb1->dev_handle) {
+        libusb_exit(usb1->ctx);
+        free(usb1);
+        return NULL;
+    }
+    libusb_set_configuration(usb1->dev_handle, OWON_USB_CONFIGURATION);
+    if (0 != libusb_claim_interface(usb1->dev_handle, OWON_USB_INTERFACE)) {
+        libusb_close(usb1->dev_handle);
+        libusb_exit(usb1->ctx);
+        free(usb1);
+        return NULL;
+    }
+
+    usb1->running = 1;
+    if (0 != pthread_create(&usb1->event_thread, NULL, event_main, usb1)) {
+        libusb_release_interface(usb1->dev_handle, OWON_USB_INTERFACE);
+        libusb_close(usb1->dev_handle);
+        libusb_exit(usb1->ctx);
+        free(usb1);
+        return NULL;
+    }
+
+    struct owon_usb_handle *handle = owon_usb_open_backend(&usb1_backend, 
+            usb1);
+    if (NULL == handle) {
+        usb1_close(usb1);
+    }
+    return handle;
+}